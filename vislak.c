@@ -50,12 +50,50 @@ Quit(void)
 	AG_Terminate(0);
 }
 
+/*
+ * Headless batch mode: initialize only the GUI globals (for surfaces),
+ * the worker pool and the project threads, without a graphics driver
+ * or PortAudio.
+ */
+static int
+RunBatch(char **ops, int nOps, char **files, int nFiles)
+{
+	int status;
+
+	if (nFiles == 0) {
+		fprintf(stderr, "%s -b: No project files\n", agProgName);
+		return (1);
+	}
+	agVerbose = 1;
+	if (AG_InitGUIGlobals() == -1) {
+		goto fail;
+	}
+	AG_ConfigLoad();
+	VS_InitGUI();
+	AG_RegisterClass(&vsProjectClass);
+	VS_StatsInit();
+	if (VS_PoolInit(0) == -1) {
+		goto fail;
+	}
+	status = VS_BatchRun(ops, nOps, files, nFiles);
+
+	VS_PoolDestroy();
+	VS_DestroyGUI();
+	AG_DestroyGUIGlobals();
+	AG_Destroy();
+	return (status);
+fail:
+	fprintf(stderr, "%s\n", AG_GetError());
+	return (1);
+}
+
 int
 main(int argc, char *argv[])
 {
 	const char *fontSpec = NULL, *driverSpec = NULL;
 	char *optArg = NULL, *ep;
-	int optInd = 1, c, i, j;
+	char *batchOps[64];
+	int optInd = 1, c, i, j, batch = 0, nBatchOps = 0;
 	PaError rv;
 
 #ifdef ENABLE_NLS
@@ -67,12 +105,22 @@ main(int argc, char *argv[])
 		fprintf(stderr, "%s\n", AG_GetError());
 		return (1);
 	}
-	while ((c = AG_Getopt(argc, argv, "?hvd:t:", &optArg, &optInd))
+	while ((c = AG_Getopt(argc, argv, "?hvbo:d:t:", &optArg, &optInd))
 	    != -1) {
 		switch (c) {
 		case 'v':
 			printf("Vislak %s\n", VERSION);
 			return (0);
+		case 'b':
+			batch = 1;
+			break;
+		case 'o':
+			if (nBatchOps == sizeof(batchOps)/sizeof(batchOps[0])) {
+				fprintf(stderr, "Too many operations\n");
+				return (1);
+			}
+			batchOps[nBatchOps++] = optArg;
+			break;
 		case 'd':
 			driverSpec = optArg;
 			break;
@@ -83,9 +131,15 @@ main(int argc, char *argv[])
 		default:
 			printf("%s [-v] [-d agar-driver-spec] "
 			       "[-t font,size,flags] [file ...]\n", agProgName);
+			printf("%s -b [-o operation ...] file ...\n", agProgName);
+			VS_BatchUsage();
 			return (1);
 		}
 	}
+	if (batch) {
+		return RunBatch(batchOps, nBatchOps, &argv[optInd],
+		    argc - optInd);
+	}
 	if (AG_InitGraphics(driverSpec) == -1) {
 		fprintf(stderr, "%s\n", AG_GetError());
 		return (1);
@@ -110,6 +164,7 @@ main(int argc, char *argv[])
 #endif
 	VS_InitGUI();
 	AG_RegisterClass(&vsProjectClass);
+	VS_StatsInit();
 
 	/* Initialize the audio subsystem. */
 	if ((rv = Pa_Initialize()) != paNoError) {
@@ -118,6 +173,12 @@ main(int argc, char *argv[])
 		goto fail;
 	}
 
+	/* Start the worker threads (one per CPU). */
+	if (VS_PoolInit(0) == -1) {
+		Pa_Terminate();
+		goto fail;
+	}
+
 	if (optInd < argc) {				/* File(s) to load */
 		for (i = optInd; i < argc; i++) {
 			const AG_FileExtMapping *me = NULL;
@@ -156,6 +217,7 @@ main(int argc, char *argv[])
 
 	Pa_Terminate();
 	VS_DestroyGUI();
+	VS_PoolDestroy();
 	AG_DestroyGraphics();
 	AG_Destroy();
 	return (0);
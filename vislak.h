@@ -48,9 +48,19 @@
 # endif
 #endif
 
+#include "vs_clock.h"
+#include "vs_latency.h"
+#include "vs_stats.h"
+#include "vs_pool.h"
+#include "vs_select.h"
 #include "vs_clip.h"
+#include "vs_evlog.h"
+#include "vs_journal.h"
 #include "vs_player.h"
 #include "vs_project.h"
+#include "vs_render.h"
+#include "vs_export.h"
+#include "vs_batch.h"
 #include "vs_view.h"
 #include "vs_gui.h"
 
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Headless batch mode (vislak -b). A list of operations is run in order
+ * on each project file, through the project's job thread, and projects
+ * which were modified are saved. No graphics driver or PortAudio stream
+ * is needed; status messages are written to the console.
+ */
+
+#include <vislak.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sndfile.h>
+
+static const struct {
+	const char *name;
+	const char *descr;
+} vsBatchOps[] = {
+	{ "import=DIR",		N_("Import the numbered JPEG frames in DIR") },
+	{ "audio=FILE",		N_("Import the audio track from FILE") },
+	{ "verify",		N_("Check that all frames decode (no output)") },
+	{ "compact",		N_("Renumber frame files, remove deleted ones") },
+	{ "render=LOG[@FPS]",	N_("Render a performance log to the output") },
+	{ "bounce=FILE",	N_("Render the output audio (.wav or .flac)") },
+	{ "export=FILE[@H]",	N_("Export the output (.mov, or .y4m at H)") },
+	{ "stats=FILE",		N_("Save performance statistics as JSON") }
+};
+static const int vsBatchOpCount = sizeof(vsBatchOps)/sizeof(vsBatchOps[0]);
+
+void
+VS_BatchUsage(void)
+{
+	int i;
+
+	printf(_("Batch operations (-o):\n"));
+	for (i = 0; i < vsBatchOpCount; i++)
+		printf("  %-18s %s\n", vsBatchOps[i].name, _(vsBatchOps[i].descr));
+}
+
+/* Reload the output audio if needed by a render or export. */
+static void
+LoadAudio(VS_Project *vsp)
+{
+	VS_Clip *vOut = vsp->output;
+
+	if (vOut->audioFile != NULL && vOut->sndFile == NULL)
+		VS_ProjectRunOperation(vsp, VS_PROC_LOAD_AUDIO, NULL, 1);
+}
+
+/* Return the extension of path (or ""). */
+static const char *
+Extension(const char *path)
+{
+	const char *ext;
+
+	return ((ext = strrchr(path, '.')) != NULL) ? ext : "";
+}
+
+/* Queue the jobs of a batch operation. */
+static int
+QueueOp(VS_Project *vsp, const char *op)
+{
+	char name[32], arg[AG_PATHNAME_MAX];
+	VS_Clip *vIn = vsp->input;
+	VS_Clip *vOut = vsp->output;
+	const char *s;
+	char *at;
+	int n = 0;
+
+	if ((s = strchr(op, '=')) != NULL) {
+		Strlcpy(name, op, MIN(sizeof(name), (size_t)(s-op)+1));
+		Strlcpy(arg, &s[1], sizeof(arg));
+	} else {
+		Strlcpy(name, op, sizeof(name));
+		arg[0] = '\0';
+	}
+	/* Only render and export take an @N suffix. */
+	if ((strcmp(name, "render") == 0 || strcmp(name, "export") == 0) &&
+	    (at = strrchr(arg, '@')) != NULL) {
+		*at = '\0';
+		n = atoi(&at[1]);
+	}
+
+	if (strcmp(name, "import") == 0 && arg[0] != '\0') {
+		AG_MutexLock(&vIn->lock);
+		Free(vIn->dir);
+		vIn->dir = Strdup(arg);
+		AG_MutexUnlock(&vIn->lock);
+		VS_ProjectRunOperation(vsp, VS_PROC_LOAD_VIDEO, NULL, 0);
+	} else if (strcmp(name, "audio") == 0 && arg[0] != '\0') {
+		AG_MutexLock(&vOut->lock);
+		Free(vOut->audioFile);
+		vOut->audioFile = Strdup(arg);
+		AG_MutexUnlock(&vOut->lock);
+		VS_ProjectRunOperation(vsp, VS_PROC_LOAD_AUDIO, NULL, 0);
+	} else if (strcmp(name, "verify") == 0) {
+		VS_ProjectRunOperation(vsp, VS_PROC_LOAD_THUMBS, NULL, 0);
+	} else if (strcmp(name, "compact") == 0) {
+		VS_ProjectRunOperation(vsp, VS_PROC_COMPACT, NULL, 0);
+	} else if (strcmp(name, "render") == 0 && arg[0] != '\0') {
+		if (VS_EventLogLoad(&vsp->evlog, arg) == -1) {
+			return (-1);
+		}
+		VS_ProjectRunOperation(vsp, VS_PROC_RENDER_TAKE, NULL,
+		    (n > 0) ? n : vsp->frameRate);
+	} else if (strcmp(name, "bounce") == 0 && arg[0] != '\0') {
+		LoadAudio(vsp);
+		VS_ProjectRunOperation(vsp, VS_PROC_RENDER_AUDIO, arg,
+		    (strcasecmp(Extension(arg), ".flac") == 0) ?
+		    SF_FORMAT_FLAC|SF_FORMAT_PCM_24 :
+		    SF_FORMAT_WAV|SF_FORMAT_FLOAT);
+	} else if (strcmp(name, "export") == 0 && arg[0] != '\0') {
+		LoadAudio(vsp);
+		if (strcasecmp(Extension(arg), ".mov") == 0) {
+			VS_ProjectRunOperation(vsp, VS_PROC_EXPORT_VIDEO, arg,
+			    VS_EXPORT_MOV);
+		} else if (strcasecmp(Extension(arg), ".y4m") == 0 ||
+		           strcmp(arg, "-") == 0) {
+			VS_ProjectRunOperation(vsp, VS_PROC_EXPORT_VIDEO, arg,
+			    VS_EXPORT_ARG(VS_EXPORT_Y4M, n));
+		} else {
+			AG_SetError(_("%s: Unknown export format"), arg);
+			return (-1);
+		}
+	} else if (strcmp(name, "stats") == 0 && arg[0] != '\0') {
+		if (VS_StatsSaveJSON(arg) == -1)
+			return (-1);
+	} else {
+		AG_SetError(_("Bad operation: %s"), op);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Run the operations on a project file (which is created if it does not
+ * exist), stopping at the first failure. The project is saved if it was
+ * modified.
+ */
+static int
+RunProject(const char *path, char **ops, int nOps)
+{
+	const char *name = AG_ShortFilename(path);
+	VS_Project *vsp;
+	int i, rv = -1;
+
+	if ((vsp = VS_ProjectNew(&vsVfsRoot, name)) == NULL) {
+		return (-1);
+	}
+	if (AG_FileExists(path) == 1 &&
+	    VS_ProjectLoad(vsp, path, VS_PROJECT_LOAD_DEFER) == -1) {
+		goto out;
+	}
+	for (i = 0; i < nOps; i++) {
+		Verbose("%s: %s\n", name, ops[i]);
+		if (QueueOp(vsp, ops[i]) == -1) {
+			goto out;
+		}
+		if (VS_ProjectWaitOperations(vsp) > 0) {
+			AG_SetError(_("Failed: %s"), ops[i]);
+			goto out;
+		}
+	}
+	if (VS_ProjectChanged(vsp)) {
+		if (VS_ProjectSave(vsp, path) == -1) {
+			goto out;
+		}
+		Verbose("%s: Saved\n", name);
+	}
+	rv = 0;
+out:
+	VS_ProjectCancelOperation(vsp, 0);
+	(void)VS_ProjectWaitOperations(vsp);
+	if (rv == 0) {
+		VS_JournalDiscard(vsp);		/* Saved; journal is empty */
+	} else {
+		VS_JournalClose(vsp);		/* Keep any recovered edits */
+	}
+	AG_ObjectDelete(vsp);
+	return (rv);
+}
+
+/*
+ * Run the batch operations on each project file. Returns the exit status
+ * (0 if all operations succeeded on all projects).
+ */
+int
+VS_BatchRun(char **ops, int nOps, char **files, int nFiles)
+{
+	int i, status = 0;
+
+	for (i = 0; i < nFiles; i++) {
+		if (RunProject(files[i], ops, nOps) == -1) {
+			fprintf(stderr, "%s: %s\n", files[i], AG_GetError());
+			status = 1;
+		}
+	}
+	return (status);
+}
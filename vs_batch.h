@@ -0,0 +1,11 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_BATCH_H_
+#define _VISLAK_BATCH_H_
+
+__BEGIN_DECLS
+int  VS_BatchRun(char **, int, char **, int);
+void VS_BatchUsage(void);
+__END_DECLS
+
+#endif /* _VISLAK_BATCH_H_ */
@@ -43,21 +43,39 @@ VS_ClipNew(VS_Project *vsp)
 	v->proj = vsp;
 	v->frames = NULL;
 	v->n = 0;
+	v->nIDs = 0;
+	v->gen = 0;
 	v->dir = NULL;
 	v->audioFile = NULL;
 	v->fileFmt = Strdup("%s/%08u.jpg");
 	v->fileFirst = 1;
 	v->fileLast = -1;
+	v->src = NULL;
+	v->nRefs = 0;
+	v->busy = NULL;
+	v->edits = NULL;
+	v->nEdits = 0;
+	v->maxEdits = 0;
+	VS_SelInit(&v->sel);
+	v->nLoops = 0;
+	v->cueWindow = 4;
+	v->cueGen = 0;
 
 	v->x = 0;
 	v->xVel = 0.0;
 	v->xVelCur = 0.0;
+	v->tTrig = 0;
+	v->trigSrc = VS_TRIGGER_MIDI;
 
 	v->sndFile = NULL;
 	v->sndPos = 0;
 	v->sndBuf = NULL;
 	v->sndViz = NULL;
 	v->sndVizFrames = 0;
+	for (i = 0; i < VS_CLIP_VIZLEVELS; i++) {
+		v->sndVizLvl[i] = NULL;
+		v->sndVizLvlFrames[i] = 0;
+	}
 	v->sndStream = NULL;
 	v->samplesPerFrame = 0;
 	v->midi = NULL;
@@ -78,21 +96,81 @@ VS_ClipClearKeys(VS_Clip *v)
 	Uint i, nCleared = 0;
 	
 	for (i = 0; i < AG_KEY_LAST; i++) {
-		if (v->kbdKeymap[i] != 0) {
-			v->kbdKeymap[i] = 0;
-			v->frames[i].kbdKey = -1;
+		int f = v->kbdKeymap[i];
+
+		if (f != -1) {
+			if (f < v->n) {
+				v->frames[f].kbdKey = -1;
+			}
+			v->kbdKeymap[i] = -1;
 			nCleared++;
 		}
 	}
+	VS_JournalLog(v, VS_JOURNAL_CLEARKBD, 0, 0, 0);
+	VS_ClipCuesChanged(v);
 	return (nCleared);
 }
 
+/*
+ * Build the waveform pyramid from sndViz. Each sample of level k is the
+ * peak of two samples of level k-1, so level k has one sample per pixel
+ * when a thumbnail column spans 2^k frames.
+ */
+int
+VS_ClipBuildViz(VS_Clip *v)
+{
+	sf_count_t i, n;
+	int k;
+
+	v->sndVizLvl[0] = v->sndViz;
+	v->sndVizLvlFrames[0] = v->sndVizFrames;
+	for (k = 1; k < VS_CLIP_VIZLEVELS; k++) {
+		const float *lo = v->sndVizLvl[k-1];
+		sf_count_t nLo = v->sndVizLvlFrames[k-1];
+		float *lvl;
+
+		n = (nLo + 1)/2;
+		if ((lvl = TryMalloc((n+1)*sizeof(float))) == NULL) {
+			VS_ClipFreeViz(v);
+			return (-1);
+		}
+		for (i = 0; i < n; i++) {
+			lvl[i] = (2*i+1 < nLo) ? MAX(lo[2*i], lo[2*i+1]) :
+			                         lo[2*i];
+		}
+		v->sndVizLvl[k] = lvl;
+		v->sndVizLvlFrames[k] = n;
+	}
+	return (0);
+}
+
+/* Free the waveform visualization buffers. */
+void
+VS_ClipFreeViz(VS_Clip *v)
+{
+	int k;
+
+	for (k = 1; k < VS_CLIP_VIZLEVELS; k++) {
+		Free(v->sndVizLvl[k]);
+	}
+	for (k = 0; k < VS_CLIP_VIZLEVELS; k++) {
+		v->sndVizLvl[k] = NULL;
+		v->sndVizLvlFrames[k] = 0;
+	}
+	Free(v->sndViz);
+	v->sndViz = NULL;
+	v->sndVizFrames = 0;
+}
+
 void
 VS_ClipDestroy(VS_Clip *v)
 {
 	AG_MutexDestroy(&v->lock);
 	AG_MutexDestroy(&v->sndLock);
 	Free(v->frames);
+	Free(v->edits);
+	VS_SelDestroy(&v->sel);
+	VS_ClipFreeViz(v);
 	Free(v->dir);
 	Free(v->audioFile);
 	Free(v->fileFmt);
@@ -114,6 +192,286 @@ VS_ClipSetArchivePath(void *obj, const char *path)
 	}
 }
 
+/*
+ * Save the frame table, selection, loops and key mappings of a clip.
+ * Thumbnails and audio data are not saved; they are reloaded from the
+ * referenced files after the project is opened.
+ */
+int
+VS_ClipSave(VS_Clip *v, AG_DataSource *ds)
+{
+	VS_FrameRec *recs;
+	Uint i;
+	int key, rv = 0;
+
+	AG_MutexLock(&v->lock);
+	if ((recs = TryMalloc((v->n+1)*sizeof(VS_FrameRec))) == NULL) {
+		AG_MutexUnlock(&v->lock);
+		return (-1);
+	}
+	for (i = 0; i < v->n; i++) {
+		const VS_Frame *vf = &v->frames[i];
+		VS_FrameRec *rec = &recs[i];
+
+		rec->f = AG_SwapLE32(vf->f);
+		rec->flags = AG_SwapLE32(vf->flags);
+
+		/* Skip mappings which have since been reassigned. */
+		key = vf->midiKey;
+		if (key < 0 || key >= VS_MIDI_MAXKEYS ||
+		    (v->midi != NULL && v->midi->keymap[key] != (int)i)) {
+			key = -1;
+		}
+		rec->midiKey = (Sint16)AG_SwapLE16((Uint16)key);
+		key = vf->kbdKey;
+		if (key < 0 || key >= AG_KEY_LAST || v->kbdKeymap[key] != (int)i) {
+			key = -1;
+		}
+		rec->kbdKey = (Sint16)AG_SwapLE16((Uint16)key);
+	}
+
+	AG_WriteUint32(ds, VS_CLIP_MAGIC);
+	AG_WriteUint32(ds, VS_CLIP_VERSION);
+	AG_WriteString(ds, (v->dir != NULL) ? v->dir : "");
+	AG_WriteString(ds, (v->audioFile != NULL) ? v->audioFile : "");
+	AG_WriteString(ds, v->fileFmt);
+	AG_WriteSint32(ds, (Sint32)v->fileFirst);
+	AG_WriteSint32(ds, (Sint32)v->fileLast);
+	AG_WriteUint32(ds, v->nIDs);
+	AG_WriteUint32(ds, v->x);
+	AG_WriteSint32(ds, (Sint32)v->cueWindow);
+
+	AG_WriteUint32(ds, v->n);
+	if (v->n > 0 &&
+	    AG_Write(ds, recs, v->n*sizeof(VS_FrameRec)) == -1) {
+		rv = -1;
+		goto out;
+	}
+	AG_WriteUint32(ds, v->sel.nRuns);
+	for (i = 0; i < v->sel.nRuns; i++) {
+		AG_WriteUint32(ds, v->sel.runs[i].start);
+		AG_WriteUint32(ds, v->sel.runs[i].end);
+	}
+	AG_WriteUint32(ds, v->nLoops);
+	for (i = 0; i < v->nLoops; i++) {
+		AG_WriteUint32(ds, v->loops[i].start);
+		AG_WriteUint32(ds, v->loops[i].end);
+	}
+out:
+	AG_MutexUnlock(&v->lock);
+	Free(recs);
+	return (rv);
+}
+
+/* Convert an empty string read from a clip section to NULL. */
+static char *
+EmptyToNULL(char *s)
+{
+	if (s[0] == '\0') {
+		Free(s);
+		return (NULL);
+	}
+	return (s);
+}
+
+/*
+ * Check that a frame file format read from a project takes exactly the
+ * directory (%s) followed by the frame number (%u, with optional width).
+ */
+static int
+ValidFileFmt(const char *fmt)
+{
+	const char *c;
+	int nConv = 0;
+
+	for (c = fmt; *c != '\0'; c++) {
+		if (*c != '%') {
+			continue;
+		}
+		if (*++c == '%') {
+			continue;
+		}
+		if (nConv == 0) {
+			if (*c != 's')
+				return (0);
+		} else {
+			while (*c == '0' || (*c >= '1' && *c <= '9'))
+				c++;
+			if (*c != 'u' || nConv > 1)
+				return (0);
+		}
+		nConv++;
+	}
+	return (nConv == 2);
+}
+
+/*
+ * Load a clip saved by VS_ClipSave(), replacing its frames. References
+ * (VS_FRAME_REF) are resolved against clip src, which must be loaded
+ * first. Thumbnails are left NULL for the caller to load in background.
+ */
+int
+VS_ClipLoad(VS_Clip *v, VS_Clip *src, AG_DataSource *ds)
+{
+	VS_FrameRec *recs = NULL;
+	VS_Frame *frames = NULL;
+	char *dir = NULL, *audioFile = NULL, *fileFmt = NULL;
+	Uint32 version, nIDs, x, n, nRuns, nLoops, start, end;
+	Uint i, nRefs = 0, nRefsOld = 0;
+	int fileFirst, fileLast, cueWindow;
+
+	if (AG_ReadUint32(ds) != VS_CLIP_MAGIC) {
+		AG_SetError(_("Bad clip section"));
+		return (-1);
+	}
+	if ((version = AG_ReadUint32(ds)) > VS_CLIP_VERSION) {
+		AG_SetError(_("Clip section version %u is not supported"),
+		    (Uint)version);
+		return (-1);
+	}
+	if ((dir = AG_ReadString(ds)) == NULL ||
+	    (audioFile = AG_ReadString(ds)) == NULL ||
+	    (fileFmt = AG_ReadString(ds)) == NULL) {
+		goto fail;
+	}
+	if (!ValidFileFmt(fileFmt)) {
+		AG_SetError(_("Bad frame file format: %s"), fileFmt);
+		goto fail;
+	}
+	fileFirst = (int)AG_ReadSint32(ds);
+	fileLast = (int)AG_ReadSint32(ds);
+	nIDs = AG_ReadUint32(ds);
+	x = AG_ReadUint32(ds);
+	cueWindow = (int)AG_ReadSint32(ds);
+
+	/* Read the frame table in one block and decode it in place. */
+	if ((n = AG_ReadUint32(ds)) >= 0x7fffffff/sizeof(VS_Frame)) {
+		AG_SetError(_("Bad frame count: %u"), (Uint)n);
+		goto fail;
+	}
+	if ((recs = TryMalloc((n+1)*sizeof(VS_FrameRec))) == NULL ||
+	    (frames = TryMalloc((n+1)*sizeof(VS_Frame))) == NULL) {
+		goto fail;
+	}
+	if (n > 0 && AG_Read(ds, recs, n*sizeof(VS_FrameRec)) == -1) {
+		goto fail;
+	}
+	for (i = 0; i < n; i++) {
+		const VS_FrameRec *rec = &recs[i];
+		VS_Frame *vf = &frames[i];
+
+		vf->thumb = NULL;
+		vf->f = AG_SwapLE32(rec->f);
+		vf->flags = AG_SwapLE32(rec->flags) & VS_FRAME_REF;
+		vf->midiKey = (Sint16)AG_SwapLE16((Uint16)rec->midiKey);
+		vf->kbdKey = (Sint16)AG_SwapLE16((Uint16)rec->kbdKey);
+		if (vf->midiKey < -1 || vf->midiKey >= VS_MIDI_MAXKEYS)
+			vf->midiKey = -1;
+		if (vf->kbdKey < -1 || vf->kbdKey >= AG_KEY_LAST)
+			vf->kbdKey = -1;
+
+		if (vf->flags & VS_FRAME_REF) {
+			if (src == NULL || vf->f >= src->nIDs) {
+				AG_SetError(_("Frame %u references missing "
+				              "frame %u"), i, vf->f);
+				goto fail;
+			}
+			nRefs++;
+		} else if (vf->f >= nIDs) {
+			AG_SetError(_("Bad frame ID %u"), vf->f);
+			goto fail;
+		}
+	}
+	Free(recs);
+	recs = NULL;
+
+	VS_ClipDiscardEdits(v);
+	AG_MutexLock(&v->lock);
+
+	/* Release the previous frames. */
+	for (i = 0; i < v->n; i++) {
+		VS_Frame *vf = &v->frames[i];
+
+		if (vf->flags & VS_FRAME_REF) {
+			nRefsOld++;
+		} else if (vf->thumb != NULL) {
+			AG_SurfaceFree(vf->thumb);
+		}
+	}
+	if (nRefsOld > 0) {
+		AG_MutexLock(&v->src->lock);
+		v->src->nRefs -= nRefsOld;
+		AG_MutexUnlock(&v->src->lock);
+	}
+	Free(v->frames);
+	v->frames = frames;
+	v->n = n;
+	v->nIDs = nIDs;
+	Free(v->dir);
+	Free(v->audioFile);
+	Free(v->fileFmt);
+	v->dir = EmptyToNULL(dir);
+	v->audioFile = EmptyToNULL(audioFile);
+	v->fileFmt = fileFmt;
+	v->fileFirst = fileFirst;
+	v->fileLast = fileLast;
+	v->x = (x < n) ? x : 0;
+	v->cueWindow = (cueWindow >= 0) ? cueWindow : 0;
+	if (nRefs > 0) {
+		v->src = src;
+		AG_MutexLock(&src->lock);
+		src->nRefs += nRefs;
+		AG_MutexUnlock(&src->lock);
+	}
+
+	/* Rebuild the keymaps from the frame table. */
+	for (i = 0; i < AG_KEY_LAST; i++) {
+		v->kbdKeymap[i] = -1;
+	}
+	if (v->midi != NULL) {
+		for (i = 0; i < VS_MIDI_MAXKEYS; i++)
+			v->midi->keymap[i] = -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (frames[i].kbdKey != -1) {
+			v->kbdKeymap[frames[i].kbdKey] = i;
+		}
+		if (frames[i].midiKey != -1 && v->midi != NULL)
+			v->midi->keymap[frames[i].midiKey] = i;
+	}
+
+	VS_SelClear(&v->sel);
+	nRuns = AG_ReadUint32(ds);
+	for (i = 0; i < nRuns; i++) {
+		start = AG_ReadUint32(ds);
+		end = AG_ReadUint32(ds);
+		if (start < end && end <= n)
+			(void)VS_SelAdd(&v->sel, start, end);
+	}
+	v->nLoops = 0;
+	nLoops = AG_ReadUint32(ds);
+	for (i = 0; i < nLoops; i++) {
+		start = AG_ReadUint32(ds);
+		end = AG_ReadUint32(ds);
+		if (start < end && end <= n && v->nLoops < VS_CLIP_MAXLOOPS) {
+			v->loops[v->nLoops].start = start;
+			v->loops[v->nLoops].end = end;
+			v->nLoops++;
+		}
+	}
+	v->gen++;
+	VS_ClipCuesChanged(v);
+	AG_MutexUnlock(&v->lock);
+	return (0);
+fail:
+	Free(dir);
+	Free(audioFile);
+	Free(fileFmt);
+	Free(recs);
+	Free(frames);
+	return (-1);
+}
+
 struct my_error_mgr {
 	struct jpeg_error_mgr pub;
 	jmp_buf setjmp_buffer;
@@ -128,34 +486,55 @@ my_error_exit(j_common_ptr cinfo)
 	longjmp(myerr->setjmp_buffer, 1);
 }
 
-/* Clip must be locked. */
-static int
-LoadFrameJPEG(VS_Clip *v, VS_Frame *vf, FILE *f)
+/*
+ * Decode a JPEG file into a new surface. If wMin and hMin are > 0, let
+ * libjpeg downscale in the DCT domain as far as it can while keeping the
+ * output at least wMin x hMin (much cheaper than a full-size decode when
+ * generating thumbnails).
+ */
+static AG_Surface *
+DecodeJPEG(const char *path, int wMin, int hMin)
 {
 	struct jpeg_decompress_struct cinfo;
 	struct my_error_mgr jerr;
 	JSAMPROW pRow[1];
-	AG_Surface *su = NULL;
-	int thumbSz;
+	AG_Surface *volatile su = NULL;
+	FILE *f;
+	Uint denom;
 
+	if ((f = fopen(path, "rb")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (NULL);
+	}
 	cinfo.err = jpeg_std_error(&jerr.pub);
 	jerr.pub.error_exit = my_error_exit;
 	if (setjmp(jerr.setjmp_buffer)) {
 		jpeg_destroy_decompress(&cinfo);
-		AG_SetError("Error loading JPEG image");
-		return (-1);
+		if (su != NULL) { AG_SurfaceFree(su); }
+		fclose(f);
+		AG_SetError("%s: Error loading JPEG image", path);
+		return (NULL);
 	}
 
-	AG_MutexUnlock(&v->lock);
-
 	jpeg_create_decompress(&cinfo);
 	jpeg_stdio_src(&cinfo, f);
 	(void)jpeg_read_header(&cinfo, TRUE);
 
+	cinfo.quantize_colors = FALSE;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = 1;
+	if (wMin > 0 && hMin > 0) {
+		for (denom = 8; denom > 1; denom >>= 1) {
+			if (cinfo.image_width/denom >= (Uint)wMin &&
+			    cinfo.image_height/denom >= (Uint)hMin)
+				break;
+		}
+		cinfo.scale_denom = denom;
+	}
+
 	/* Allocate Agar surface */
 	if (cinfo.num_components == 4) {
 		cinfo.out_color_space = JCS_CMYK;
-		cinfo.quantize_colors = FALSE;
 		jpeg_calc_output_dimensions(&cinfo);
 
 		su = AG_SurfaceRGBA(
@@ -171,15 +550,11 @@ LoadFrameJPEG(VS_Clip *v, VS_Frame *vf, FILE *f)
 		);
 	} else {
 		cinfo.out_color_space = JCS_RGB;
-		cinfo.quantize_colors = FALSE;
-#if 1
 		/* For speed */
-		cinfo.scale_num   = 1;
-		cinfo.scale_denom = 1;
 		cinfo.dct_method = JDCT_FASTEST;
 		cinfo.do_fancy_upsampling = FALSE;
-#endif
 		jpeg_calc_output_dimensions(&cinfo);
+
 		su = AG_SurfaceRGB(
 		    cinfo.output_width,
 		    cinfo.output_height,
@@ -192,167 +567,677 @@ LoadFrameJPEG(VS_Clip *v, VS_Frame *vf, FILE *f)
 #endif
 		);
 	}
-	if (su == NULL)
-		goto fail;
+	if (su == NULL) {
+		jpeg_destroy_decompress(&cinfo);
+		fclose(f);
+		return (NULL);
+	}
 
 	(void)jpeg_start_decompress(&cinfo);
-	
-	AG_MutexLock(&v->lock);
-	
-	/* Read the image data. */
 	while (cinfo.output_scanline < su->h) {
 		pRow[0] = (JSAMPROW)(Uint8 *)su->pixels +
 		          cinfo.output_scanline*su->pitch;
 		jpeg_read_scanlines(&cinfo, pRow, (JDIMENSION)1);
 	}
+	(void)jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	fclose(f);
+	return (su);
+}
 
-	/* Generate a thumbnail */
-	if (AG_ScaleSurface(su, v->proj->thumbSz, v->proj->thumbSz, &vf->thumb)
-	    == -1)
-		goto fail;
+/* Decode an image file and scale it to w x h. */
+static AG_Surface *
+ReadImage(const char *path, int w, int h)
+{
+	AG_Surface *su, *suScaled = NULL;
+	Uint64 t0 = VS_ClockNow();
 
+	if ((su = DecodeJPEG(path, w, h)) == NULL) {
+		return (NULL);
+	}
+	VS_StatsTime(VS_STAT_DECODE, t0);
+	if (su->w == w && su->h == h) {
+		return (su);
+	}
+	t0 = VS_ClockNow();
+	if (AG_ScaleSurface(su, w, h, &suScaled) == -1) {
+		AG_SurfaceFree(su);
+		return (NULL);
+	}
 	AG_SurfaceFree(su);
-	(void)jpeg_finish_decompress(&cinfo);
-	jpeg_destroy_decompress(&cinfo);
-	return (0);
-fail:
-	if (su != NULL) { AG_SurfaceFree(su); }
-	(void)jpeg_finish_decompress(&cinfo);
-	jpeg_destroy_decompress(&cinfo);
-	return (-1);
+	VS_StatsTime(VS_STAT_SCALE, t0);
+	return (suScaled);
+}
+
+/*
+ * Decode video frame f and return a new surface scaled to w x h.
+ * The clip need not be locked during the decode; this is safe to call
+ * from pool tasks.
+ */
+AG_Surface *
+VS_ClipReadFrame(VS_Clip *v, Uint f, int w, int h)
+{
+	char path[AG_PATHNAME_MAX];
+
+	if (VS_ClipGetFrameSource(v, f, path, sizeof(path)) == -1) {
+		return (NULL);
+	}
+	return ReadImage(path, w, h);
 }
 
-/* Create a frame from image file */
+/*
+ * Decode the thumbnail of the clip's own image file with on-disk ID id.
+ * Used by pool tasks during import and project loading.
+ */
+AG_Surface *
+VS_ClipReadThumb(VS_Clip *v, Uint id)
+{
+	char path[AG_PATHNAME_MAX];
+	AG_Surface *thumb;
+	int thumbSz;
+	Uint64 t0 = VS_ClockNow();
+
+	AG_MutexLock(&v->lock);
+	VS_ClipGetFramePath(v, id, path, sizeof(path));
+	thumbSz = v->proj->thumbSz;
+	AG_MutexUnlock(&v->lock);
+
+	if ((thumb = ReadImage(path, thumbSz, thumbSz)) == NULL) {
+		return (NULL);
+	}
+	VS_StatsTime(VS_STAT_IMPORT, t0);
+	return (thumb);
+}
+
+/*
+ * Attach a thumbnail to the clip's own frame with on-disk ID id, which
+ * was at position x when its decode was queued. Edits can only move the
+ * frame toward the start of the clip, so it is searched from x down. If
+ * the frame is gone or already has a thumbnail, the surface is freed.
+ * Returns 0 if the thumbnail was attached.
+ */
 int
-VS_ClipAddFrame(VS_Clip *v, const char *path)
+VS_ClipSetThumb(VS_Clip *v, Uint id, Uint x, AG_Surface *thumb)
 {
-	VS_Frame *framesNew, *vf;
-	FILE *f;
-	char *s;
+	VS_Frame *vf;
+	int i;
 
-	if ((f = fopen(path, "rb")) == NULL) {
+	AG_MutexLock(&v->lock);
+	for (i = (int)MIN(x, v->n-1); i >= 0 && v->n > 0; i--) {
+		vf = &v->frames[i];
+		if (vf->f == id && !(vf->flags & VS_FRAME_REF))
+			break;
+	}
+	if (i < 0 || v->n == 0 || v->frames[i].thumb != NULL) {
+		AG_MutexUnlock(&v->lock);
+		AG_SurfaceFree(thumb);
 		return (-1);
 	}
-	AG_MutexLock(&v->lock);
-	if ((framesNew = AG_TryRealloc(v->frames, (v->n + 1)*sizeof(VS_Frame)))
-	    == NULL) {
-		goto fail;
+	v->frames[i].thumb = thumb;
+	v->gen++;				/* Redraw the thumbnail strip */
+	AG_MutexUnlock(&v->lock);
+	return (0);
+}
+
+/* Return the new position of frame p after deleting the given runs. */
+static Uint
+DelMapPos(const VS_SelRun *runs, Uint nRuns, Uint p)
+{
+	Uint r, nDel = 0;
+
+	for (r = 0; r < nRuns && runs[r].start < p; r++) {
+		nDel += MIN(runs[r].end, p) - runs[r].start;
 	}
-	v->frames = framesNew;
-	vf = &v->frames[v->n++];
-	vf->thumb = NULL;
-	vf->f = (v->n-1);
-	vf->flags = 0;
-	vf->midiKey = -1;
-	vf->kbdKey = -1;
-	if ((s = strrchr(path, '.')) != NULL && s[1] != '\0') {
-		if (!strcasecmp(&s[1], "jpg") ||
-		    !strcasecmp(&s[1], "jpeg")) {
-			if (LoadFrameJPEG(v, vf, f) == -1)
-				goto fail;
+	return (p - nDel);
+}
+
+/* Update the loop regions after deleting the given runs. */
+static void
+DelMapLoops(VS_Clip *v, const VS_SelRun *runs, Uint nRuns)
+{
+	Uint i, nLoops = 0, start, end;
+
+	for (i = 0; i < v->nLoops; i++) {
+		start = DelMapPos(runs, nRuns, v->loops[i].start);
+		end = DelMapPos(runs, nRuns, v->loops[i].end);
+		if (end > start) {
+			v->loops[nLoops].start = start;
+			v->loops[nLoops].end = end;
+			nLoops++;
 		}
 	}
-	AG_MutexUnlock(&v->lock);
-	fclose(f);
+	v->nLoops = nLoops;
+}
+
+/*
+ * Delete the frames in a sorted set of disjoint runs, in a single pass
+ * over the frame array. Only the frame index is updated; the image files
+ * of deleted frames are left on disk until VS_ClipCompact(). Key mappings
+ * follow the frames. Returns the number of deleted references to
+ * clip->src. Clip must be locked.
+ */
+static Uint
+DelRuns(VS_Clip *v, const VS_SelRun *runs, Uint nRuns)
+{
+	Uint i, w, r = 0, nRefsDel = 0, nDel = 0, end;
+
+	if (nRuns == 0 || runs[0].start >= v->n) {
+		return (0);
+	}
+
+	/* Journal the runs as successive deletions. */
+	for (i = 0; i < nRuns && runs[i].start < v->n; i++) {
+		end = MIN(runs[i].end, v->n);
+		VS_JournalLog(v, VS_JOURNAL_DELETE, runs[i].start - nDel,
+		    end - nDel, 0);
+		nDel += end - runs[i].start;
+	}
+	for (i = runs[0].start, w = i; i < v->n; i++) {
+		VS_Frame *vf = &v->frames[i];
+
+		while (r < nRuns && runs[r].end <= i) {
+			r++;
+		}
+		if (r < nRuns && runs[r].start <= i) {		/* Delete */
+			if (v->midi != NULL && vf->midiKey != -1)
+				VS_MidiDelKey(v->midi, vf->midiKey);
+			if (vf->kbdKey != -1)
+				v->kbdKeymap[vf->kbdKey] = -1;
+
+			if (vf->flags & VS_FRAME_REF) {
+				nRefsDel++;
+			} else if (vf->thumb != NULL) {
+				AG_SurfaceFree(vf->thumb);
+			}
+			continue;
+		}
+		if (w != i) {					/* Move */
+			v->frames[w] = *vf;
+			vf = &v->frames[w];
+			if (v->midi != NULL && vf->midiKey != -1)
+				v->midi->keymap[vf->midiKey] = w;
+			if (vf->kbdKey != -1)
+				v->kbdKeymap[vf->kbdKey] = w;
+		}
+		w++;
+	}
+	v->n = w;
+	v->gen++;
+	DelMapLoops(v, runs, nRuns);
+	VS_ClipCuesChanged(v);
+	return (nRefsDel);
+}
+
+static int
+DelCheckRefs(VS_Clip *v)
+{
+	if (v->nRefs > 0) {
+		AG_SetError(_("Clip is referenced by %u recorded frames"),
+		    v->nRefs);
+		return (-1);
+	}
 	return (0);
-fail:
-	AG_MutexUnlock(&v->lock);
-	fclose(f);
-	return (-1);
 }
 
-/* Delete a range of frames. */
-void
+/*
+ * Frame deletions are refused while a job (import or compaction) works
+ * on the frame array with the clip unlocked.
+ */
+static int
+DelCheck(VS_Clip *v)
+{
+	if (v->busy != NULL) {
+		AG_SetError(_("Cannot delete frames during %s"), v->busy);
+		return (-1);
+	}
+	return DelCheckRefs(v);
+}
+
+static void
+DelReleaseRefs(VS_Clip *v, Uint nRefsDel)
+{
+	if (nRefsDel > 0) {
+		AG_MutexLock(&v->src->lock);
+		v->src->nRefs -= nRefsDel;
+		AG_MutexUnlock(&v->src->lock);
+	}
+}
+
+/*
+ * Delete a range of frames. Frames referenced by another clip cannot be
+ * deleted.
+ */
+int
 VS_ClipDelFrames(VS_Clip *v, Uint f1, Uint f2)
 {
-	char pathOld[AG_PATHNAME_MAX];
-	char pathNew[AG_PATHNAME_MAX];
-	Uint i;
+	VS_SelRun run;
+	Uint nRefsDel;
+
+	AG_MutexLock(&v->lock);
+	if (DelCheck(v) == -1) {
+		AG_MutexUnlock(&v->lock);
+		return (-1);
+	}
+	run.start = f1;
+	run.end = f2;
+	nRefsDel = DelRuns(v, &run, 1);
+	VS_SelClear(&v->sel);
+	AG_MutexUnlock(&v->lock);
 
-	printf("DELFRAMES(%u - %u)\n", f1, f2);
+	DelReleaseRefs(v, nRefsDel);
+	return (0);
+}
 
-#if 0
-	if (f2 == (v->n-1)) {
-		printf("Trivial: n->%u\n", (f2-f1));
-		v->n -= (f2-f1);
-		return;
+/* Delete the selected frames. */
+int
+VS_ClipDelSelection(VS_Clip *v)
+{
+	Uint nRefsDel;
+
+	AG_MutexLock(&v->lock);
+	if (DelCheck(v) == -1) {
+		AG_MutexUnlock(&v->lock);
+		return (-1);
 	}
-#endif
+	nRefsDel = DelRuns(v, v->sel.runs, v->sel.nRuns);
+	VS_SelClear(&v->sel);
+	AG_MutexUnlock(&v->lock);
 
-	/* Delete frames f1 through f2. */
-	for (i = f1; i < f2; i++) {
-		VS_Frame *vf = &v->frames[i];
+	DelReleaseRefs(v, nRefsDel);
+	return (0);
+}
 
-		printf("Deleting: f%d\n", i);
+/*
+ * Renumber the image files of a clip to follow the frame order and remove
+ * the files of deleted frames. This relies on frames only ever being
+ * deleted or appended, so the IDs of owned frames increase along the
+ * clip and every ID is >= its frame's position; renaming in ascending
+ * order then never overwrites a live file. The clip is only locked for
+ * one rename at a time, so compaction may run as a background job;
+ * deletions are refused until it completes, since they would move frames
+ * behind the rename loop. Referenced frames would be renumbered, so this
+ * fails while nRefs > 0.
+ */
+int
+VS_ClipCompact(VS_Clip *v, Uint *nMoved, Uint *nRemoved)
+{
+	char pathOld[AG_PATHNAME_MAX];
+	char pathNew[AG_PATHNAME_MAX];
+	Uint8 *live;
+	Uint i, id, nIDs;
 
-		if (vf->thumb != NULL)
-			AG_SurfaceFree(vf->thumb);
-		if (v->midi != NULL && vf->midiKey != -1)
-			VS_MidiDelKey(v->midi, vf->midiKey);
-		if (vf->kbdKey != -1)
-			v->kbdKeymap[vf->kbdKey] = -1;
+	*nMoved = 0;
+	*nRemoved = 0;
 
-		VS_ClipGetFramePath(v, i, pathOld, sizeof(pathOld));
-		if (unlink(pathOld) == -1)
+	AG_MutexLock(&v->lock);
+	if (DelCheckRefs(v) == -1) {
+		goto fail;
+	}
+	if (v->dir == NULL) {
+		AG_SetError(_("Clip has no frame directory"));
+		goto fail;
+	}
+	nIDs = v->nIDs;
+	if ((live = TryMalloc(nIDs+1)) == NULL) {
+		goto fail;
+	}
+	memset(live, 0, nIDs);
+	for (i = 0; i < v->n; i++) {
+		if (!(v->frames[i].flags & VS_FRAME_REF))
+			live[v->frames[i].f] = 1;
+	}
+	v->busy = _("compaction");
+	AG_MutexUnlock(&v->lock);
+
+	/* Remove the files of frames deleted before we started. */
+	for (id = 0; id < nIDs; id++) {
+		if (live[id]) {
+			continue;
+		}
+		VS_ClipGetFramePath(v, id, pathOld, sizeof(pathOld));
+		if (unlink(pathOld) == 0) {
+			(*nRemoved)++;
+		} else if (errno != ENOENT) {
 			fprintf(stderr, "%s: %s\n", pathOld, strerror(errno));
+		}
 	}
-	printf("Memmove: f%d <- f%d (n=%d)\n", f1, f2, f2-f1);
-	memmove(&v->frames[f1], &v->frames[f2], (f2-f1)*sizeof(VS_Frame));
+	Free(live);
+
+	/* Rename the remaining files in ascending order. */
+	for (i = 0; ; i++) {
+		VS_Frame *vf;
 
-	/* Renumber the remaining frames. */
-	for (i = f2; i < v->n; i++) {
-		VS_ClipGetFramePath(v, i, pathOld, sizeof(pathOld));
-		VS_ClipGetFramePath(v, i - (f2-f1), pathNew, sizeof(pathNew));
-		printf("Rename: %s -> %s\n", pathOld, pathNew);
+		if (VS_ProjectCancelled(v->proj)) {
+			AG_SetError(_("Cancelled"));
+			AG_MutexLock(&v->lock);
+			goto fail;
+		}
+		AG_MutexLock(&v->lock);
+		if (i >= v->n) {
+			break;
+		}
+		if (DelCheckRefs(v) == -1) {
+			goto fail;
+		}
+		vf = &v->frames[i];
+		if ((vf->flags & VS_FRAME_REF) || vf->f == i) {
+			AG_MutexUnlock(&v->lock);
+			continue;
+		}
+		VS_ClipGetFramePath(v, vf->f, pathOld, sizeof(pathOld));
+		VS_ClipGetFramePath(v, i, pathNew, sizeof(pathNew));
 		if (rename(pathOld, pathNew) == -1) {
-			fprintf(stderr, "Rename %s -> %s: %s\n",
-			    pathOld, pathNew,
-			    strerror(errno));
+			AG_SetError("%s: %s", pathOld, strerror(errno));
+			goto fail;
 		}
-		v->frames[i].f = i;
+		vf->f = i;
+		(*nMoved)++;
+		AG_MutexUnlock(&v->lock);
 	}
-	v->n -= (f2-f1);
+	for (i = 0, nIDs = 0; i < v->n; i++) {
+		if (!(v->frames[i].flags & VS_FRAME_REF) &&
+		    v->frames[i].f >= nIDs)
+			nIDs = v->frames[i].f+1;
+	}
+	v->nIDs = nIDs;
+	v->busy = NULL;
+	AG_MutexUnlock(&v->lock);
+	return (0);
+fail:
+	v->busy = NULL;
+	AG_MutexUnlock(&v->lock);
+	return (-1);
 }
 
-/* Append a frame from another clip into a clip. */
+/*
+ * Record a reference to frame f of vSrc at the end of the edit list of
+ * vDst. Consecutive references to evenly spaced frames extend the last
+ * run, so this does not allocate in the common case. Called from the
+ * frame clock thread.
+ */
 int
-VS_ClipCopyFrame(VS_Clip *vDst, VS_Clip *vSrc, Uint f)
+VS_ClipRecordFrame(VS_Clip *vDst, VS_Clip *vSrc, Uint f)
 {
-	VS_Frame *framesNew;
-	VS_Frame *vfDst, *vfSrc;
+	VS_ClipEdit *e, *editsNew;
+	Uint maxNew;
 
 	if (f >= vSrc->n) {
 		AG_SetError("No such frame: %u", f);
 		return (-1);
 	}
-	vfSrc = &vSrc->frames[f];
+	AG_MutexLock(&vDst->lock);
+	if (vDst->src != NULL && vDst->src != vSrc) {
+		AG_SetError(_("Clip already references another clip"));
+		goto fail;
+	}
+	if (vDst->nEdits > 0) {
+		e = &vDst->edits[vDst->nEdits - 1];
+		if (e->n == 1) {
+			e->step = (int)f - (int)e->src;
+			e->n++;
+			goto out;
+		} else if ((int)e->src + e->step*(int)e->n == (int)f) {
+			e->n++;
+			goto out;
+		}
+	}
+	if (vDst->nEdits+1 > vDst->maxEdits) {
+		maxNew = (vDst->maxEdits > 0) ? vDst->maxEdits*2 : 64;
+		if ((editsNew = TryRealloc(vDst->edits,
+		    maxNew*sizeof(VS_ClipEdit))) == NULL) {
+			goto fail;
+		}
+		vDst->edits = editsNew;
+		vDst->maxEdits = maxNew;
+	}
+	e = &vDst->edits[vDst->nEdits++];
+	e->src = f;
+	e->n = 1;
+	e->step = 0;
+out:
+	vDst->src = vSrc;
+	AG_MutexUnlock(&vDst->lock);
+
+	AG_MutexLock(&vSrc->lock);
+	vSrc->nRefs++;
+	AG_MutexUnlock(&vSrc->lock);
+	return (0);
+fail:
+	AG_MutexUnlock(&vDst->lock);
+	return (-1);
+}
+
+/*
+ * Append the frames of the uncommitted edit list to the clip. The new
+ * frames share the thumbnails of the source clip, which cannot delete
+ * them while its reference count is non-zero. This is O(frames), so
+ * takes are committed from the job thread rather than the frame clock.
+ */
+int
+VS_ClipCommitEdits(VS_Clip *v)
+{
+	VS_Clip *vSrc = v->src;
+	VS_Frame *framesNew, *vf;
+	Uint i, j, nNew = 0;
 
-	if ((framesNew = AG_TryRealloc(vDst->frames,
-	    (vDst->n+1)*sizeof(VS_Frame))) == NULL) {
+	AG_MutexLock(&v->lock);
+	if (v->nEdits == 0) {
+		AG_MutexUnlock(&v->lock);
+		return (0);
+	}
+	for (i = 0; i < v->nEdits; i++) {
+		nNew += v->edits[i].n;
+	}
+	if ((framesNew = TryRealloc(v->frames, (v->n + nNew)*sizeof(VS_Frame)))
+	    == NULL) {
+		AG_MutexUnlock(&v->lock);
 		return (-1);
 	}
+	v->frames = framesNew;
+
 	AG_MutexLock(&vSrc->lock);
-	AG_MutexLock(&vDst->lock);
-	vDst->frames = framesNew;
-	vfDst = &vDst->frames[vDst->n++];
-	vfDst->thumb = (vfSrc->thumb) ? AG_SurfaceDup(vfSrc->thumb) : NULL;
-	vfDst->f = (vDst->n-1);
-	vfDst->flags = 0;
-	vfDst->midiKey = -1;
-	vfDst->kbdKey = -1;
-	AG_MutexUnlock(&vDst->lock);
+	vf = &v->frames[v->n];
+	for (i = 0; i < v->nEdits; i++) {
+		VS_ClipEdit *e = &v->edits[i];
+
+		for (j = 0; j < e->n; j++, vf++) {
+			VS_Frame *vfSrc = &vSrc->frames[e->src + e->step*(int)j];
+
+			vf->f = vfSrc->f;
+			vf->thumb = vfSrc->thumb;
+			vf->flags = VS_FRAME_REF;
+			vf->midiKey = -1;
+			vf->kbdKey = -1;
+		}
+	}
 	AG_MutexUnlock(&vSrc->lock);
+
+	for (i = 0; i < v->nEdits; i++) {
+		VS_ClipEdit *e = &v->edits[i];
+
+		VS_JournalLog(v, VS_JOURNAL_RECORD, e->src, e->n, e->step);
+	}
+	v->n += nNew;
+	v->nEdits = 0;
+	v->gen++;
+	AG_MutexUnlock(&v->lock);
+	return (0);
+}
+
+/* Drop the uncommitted edit list and release its references. */
+void
+VS_ClipDiscardEdits(VS_Clip *v)
+{
+	Uint i, nRefs = 0;
+
+	AG_MutexLock(&v->lock);
+	for (i = 0; i < v->nEdits; i++) {
+		nRefs += v->edits[i].n;
+	}
+	v->nEdits = 0;
+	AG_MutexUnlock(&v->lock);
+
+	if (nRefs > 0) {
+		AG_MutexLock(&v->src->lock);
+		v->src->nRefs -= nRefs;
+		AG_MutexUnlock(&v->src->lock);
+	}
+}
+
+/*
+ * Move the playhead. Moves of the project's input clip are logged in the
+ * performance capture log, stamped with the arrival time t of the input
+ * (VS_ClockNow() ns, or 0 for the current time).
+ */
+void
+VS_ClipSetPosition(VS_Clip *v, Uint x, Uint64 t)
+{
+	VS_Project *vsp = v->proj;
+
+	v->x = x;
+	if (v == vsp->input)
+		VS_EventLogPush(&vsp->evlog, VS_EVENT_SEEK, x, 0.0, t);
+}
+
+/*
+ * Set the frame advance velocity (in frames per frame period). The time
+ * t is as for VS_ClipSetPosition().
+ */
+void
+VS_ClipSetVelocity(VS_Clip *v, double vel, Uint64 t)
+{
+	VS_Project *vsp = v->proj;
+
+	v->xVel = vel;
+	if (v == vsp->input) {
+		VS_EventLogPush(&vsp->evlog, VS_EVENT_VELOCITY, 0,
+		    (float)(vel*vsp->frameRate), t);
+	}
+}
+
+/*
+ * Signal a change of the keymaps or loop regions, so that the players
+ * update the frames pinned in their cue caches.
+ */
+void
+VS_ClipCuesChanged(VS_Clip *v)
+{
+	v->cueGen++;
+}
+
+/* Add an A/B loop region (frames start to end-1). */
+int
+VS_ClipAddLoop(VS_Clip *v, Uint start, Uint end)
+{
+	AG_MutexLock(&v->lock);
+	if (start >= end || end > v->n) {
+		AG_SetError(_("Bad loop region"));
+		goto fail;
+	}
+	if (v->nLoops >= VS_CLIP_MAXLOOPS) {
+		AG_SetError(_("Too many loop regions"));
+		goto fail;
+	}
+	v->loops[v->nLoops].start = start;
+	v->loops[v->nLoops].end = end;
+	v->nLoops++;
+	VS_JournalLog(v, VS_JOURNAL_LOOP, start, end, 0);
+	VS_ClipCuesChanged(v);
+	AG_MutexUnlock(&v->lock);
 	return (0);
+fail:
+	AG_MutexUnlock(&v->lock);
+	return (-1);
 }
 
-/* Return full path to image file associated with a video frame. */
 void
-VS_ClipGetFramePath(VS_Clip *v, Uint f, char *dst, size_t dstLen)
+VS_ClipClearLoops(VS_Clip *v)
 {
-	char file[AG_FILENAME_MAX];
+	AG_MutexLock(&v->lock);
+	v->nLoops = 0;
+	VS_JournalLog(v, VS_JOURNAL_CLEARLOOPS, 0, 0, 0);
+	VS_ClipCuesChanged(v);
+	AG_MutexUnlock(&v->lock);
+}
 
-	snprintf(file, sizeof(file), v->fileFmt, v->fileFirst+f);
-	Strlcpy(dst, v->dir, dstLen);
-	Strlcat(dst, AG_PATHSEP, dstLen);
-	Strlcat(dst, file, dstLen);
+/*
+ * Wrap the playhead around the loop region it was in before the last
+ * VS_ClipStep() (from xPrev). A loop at the edge of the clip also wraps
+ * when the step was clamped at the first or last frame.
+ */
+void
+VS_ClipLoopStep(VS_Clip *v, Uint xPrev)
+{
+	VS_ClipLoop *lp = NULL;
+	Uint i, len, x = v->x;
+
+	for (i = 0; i < v->nLoops; i++) {
+		if (xPrev >= v->loops[i].start && xPrev < v->loops[i].end) {
+			lp = &v->loops[i];
+			break;
+		}
+	}
+	if (lp == NULL || lp->end > v->n) {
+		return;
+	}
+	len = lp->end - lp->start;
+	if (x >= lp->end) {
+		x = lp->start + (x - lp->end) % len;
+	} else if (x < lp->start) {
+		x = lp->end - 1 - (lp->start - 1 - x) % len;
+	} else if (x == xPrev &&
+	    (v->xVel < -1.0 || v->xVel > 1.0 || v->xVelCur == 0.0) &&
+	    ((v->xVel > 0.0 && x == v->n-1 && lp->end == v->n) ||
+	     (v->xVel < 0.0 && x == 0 && lp->start == 0))) {
+		x = (v->xVel > 0.0) ? lp->start : lp->end - 1;
+	} else {
+		return;
+	}
+	VS_ClipSetPosition(v, x, 0);
+}
+
+/*
+ * Stamp the last playhead change with the arrival time t of the input
+ * that caused it. The player records the latency when it next draws.
+ */
+void
+VS_ClipTrigger(VS_Clip *v, enum vs_trigger_src src, Uint64 t)
+{
+	AG_ObjectLock(v->proj);
+	v->tTrig = t;
+	v->trigSrc = src;
+	AG_ObjectUnlock(v->proj);
+}
+
+/*
+ * Return the path to the image file of frame f, following references
+ * to frames of the source clip.
+ */
+int
+VS_ClipGetFrameSource(VS_Clip *v, Uint f, char *dst, size_t dstLen)
+{
+	AG_MutexLock(&v->lock);
+	if (f >= v->n) {
+		AG_MutexUnlock(&v->lock);
+		AG_SetError("No such frame: %u", f);
+		return (-1);
+	}
+	if (v->frames[f].flags & VS_FRAME_REF) {
+		VS_ClipGetFramePath(v->src, v->frames[f].f, dst, dstLen);
+	} else {
+		VS_ClipGetFramePath(v, v->frames[f].f, dst, dstLen);
+	}
+	AG_MutexUnlock(&v->lock);
+	return (0);
+}
+
+/*
+ * Return the full path to the image file with on-disk ID id. Use
+ * VS_ClipGetFrameSource() to look up the file of a clip position.
+ */
+void
+VS_ClipGetFramePath(VS_Clip *v, Uint id, char *dst, size_t dstLen)
+{
+	/* Format: %s,%u */
+	snprintf(dst, dstLen, v->fileFmt, v->dir, v->fileFirst+id);
 }
@@ -11,29 +11,77 @@
 struct vs_project;
 struct vs_view;
 
+#define VS_CLIP_VIZLEVELS 17		/* Waveform pyramid levels */
+
 typedef struct vs_frame {
 	AG_Surface *thumb;		/* Generated thumbnail */
-	Uint f;				/* Original frame# */
+	Uint f;				/* On-disk frame ID */
 	Uint flags;
-#define VS_FRAME_SELECTED	0x01	/* Frame is selected */
+#define VS_FRAME_REF		0x02	/* References a frame of clip->src */
 	int midiKey;			/* Assigned MIDI key */
 	int kbdKey;			/* Assigned keyboard key */
 } VS_Frame;
 
+/*
+ * Run of recorded frames in an edit list: frames src, src+step,
+ * src+2*step, ... of the source clip.
+ */
+typedef struct vs_clip_edit {
+	Uint src;			/* First source frame */
+	Uint n;				/* Length of run */
+	int step;			/* Source increment (0 = held frame) */
+} VS_ClipEdit;
+
+/*
+ * Frame table record in a saved project. The table is written as one
+ * packed little-endian array so it can be read in a single block and
+ * decoded without per-field I/O.
+ */
+typedef struct vs_frame_rec {
+	Uint32 f;			/* On-disk frame ID */
+	Uint32 flags;			/* VS_FRAME_* flags */
+	Sint16 midiKey;			/* Assigned MIDI key (or -1) */
+	Sint16 kbdKey;			/* Assigned keyboard key (or -1) */
+} VS_FrameRec;
+
+#define VS_CLIP_MAGIC	0x5653434c	/* "VSCL" */
+#define VS_CLIP_VERSION	1
+
+#define VS_CLIP_MAXLOOPS 8
+
+/* A/B loop region (frames start to end-1). */
+typedef struct vs_clip_loop {
+	Uint start, end;
+} VS_ClipLoop;
+
 typedef struct vs_clip {
 	struct vs_project *proj;	/* Back pointer to parent project */
 	AG_Mutex lock;			/* Lock on video data */
 	VS_Frame *frames;		/* Frames in memory */
 	Uint n;				/* Total number of frames */
+	Uint nIDs;			/* Next free on-disk frame ID */
+	Uint gen;			/* Incremented on frame/audio changes */
 	char *dir;			/* Directory containing video frames */
 	char *audioFile;		/* Input audio file */
 	char *fileFmt;			/* Format string for frame files */
 	int   fileFirst;		/* First frame# to load */
 	int   fileLast;			/* Last frame# to load (-1 = all) */
+	struct vs_clip *src;		/* Clip referenced by VS_FRAME_REF */
+	Uint nRefs;			/* Frames referenced by other clips */
+	const char *busy;		/* Job refusing deletions (or NULL) */
+	VS_ClipEdit *edits;		/* Uncommitted edit list (recording) */
+	Uint nEdits, maxEdits;
+	VS_Selection sel;		/* Selected frames */
+	VS_ClipLoop loops[VS_CLIP_MAXLOOPS]; /* A/B loop regions */
+	Uint nLoops;
+	int cueWindow;			/* Frames pinned around each cue */
+	Uint cueGen;			/* Incremented on cue/loop changes */
 
 	Uint   x;			/* Current frame offset */
 	double xVel;			/* Frame advance velocity */
 	double xVelCur;
+	Uint64 tTrig;			/* Pending trigger stamp (or 0) */
+	enum vs_trigger_src trigSrc;	/* Source of pending trigger */
 
 	AG_Mutex   sndLock;		/* Lock on audio data */
 	SNDFILE   *sndFile;		/* Associated audio clip */
@@ -42,6 +90,8 @@ typedef struct vs_clip {
 	float     *sndBuf;		/* Audio buffer */
 	float     *sndViz;		/* Reduced visualization buffer */
 	sf_count_t sndVizFrames;
+	float     *sndVizLvl[VS_CLIP_VIZLEVELS]; /* Pyramid (0 = sndViz) */
+	sf_count_t sndVizLvlFrames[VS_CLIP_VIZLEVELS];
 	double     sndPeakSignal;	/* Signal peak in audio stream */
 	PaStream  *sndStream;		/* For PortAudio playback */
 	int        drift;		/* Audio/video sync error */
@@ -55,11 +105,66 @@ __BEGIN_DECLS
 VS_Clip *VS_ClipNew(struct vs_project *);
 void     VS_ClipDestroy(VS_Clip *);
 void     VS_ClipSetArchivePath(void *, const char *);
-int      VS_ClipAddFrame(VS_Clip *, const char *);
-void     VS_ClipDelFrames(VS_Clip *, Uint, Uint);
-int      VS_ClipCopyFrame(VS_Clip *, VS_Clip *, Uint);
+int      VS_ClipSave(VS_Clip *, AG_DataSource *);
+int      VS_ClipLoad(VS_Clip *, VS_Clip *, AG_DataSource *);
+int      VS_ClipDelFrames(VS_Clip *, Uint, Uint);
+int      VS_ClipDelSelection(VS_Clip *);
+int      VS_ClipCompact(VS_Clip *, Uint *, Uint *);
+int      VS_ClipRecordFrame(VS_Clip *, VS_Clip *, Uint);
+int      VS_ClipCommitEdits(VS_Clip *);
+void     VS_ClipDiscardEdits(VS_Clip *);
+void     VS_ClipSetPosition(VS_Clip *, Uint, Uint64);
+void     VS_ClipSetVelocity(VS_Clip *, double, Uint64);
+void     VS_ClipTrigger(VS_Clip *, enum vs_trigger_src, Uint64);
+void     VS_ClipCuesChanged(VS_Clip *);
+int      VS_ClipAddLoop(VS_Clip *, Uint, Uint);
+void     VS_ClipClearLoops(VS_Clip *);
+void     VS_ClipLoopStep(VS_Clip *, Uint);
 void     VS_ClipGetFramePath(VS_Clip *, Uint, char *, size_t);
+int      VS_ClipGetFrameSource(VS_Clip *, Uint, char *, size_t);
+AG_Surface *VS_ClipReadFrame(VS_Clip *, Uint, int, int);
+AG_Surface *VS_ClipReadThumb(VS_Clip *, Uint);
+int      VS_ClipSetThumb(VS_Clip *, Uint, Uint, AG_Surface *);
 Uint     VS_ClipClearKeys(VS_Clip *);
+int      VS_ClipBuildViz(VS_Clip *);
+void     VS_ClipFreeViz(VS_Clip *);
+
+/*
+ * Return the offset into sndBuf of the first audio sample played along
+ * with video frame x. This is the mapping used by the playback callbacks
+ * and the offline renderer.
+ */
+static __inline__ sf_count_t
+VS_ClipFrameToSample(const VS_Clip *v, Uint x)
+{
+	return ((sf_count_t)x * v->samplesPerFrame * v->sndInfo.channels);
+}
+
+/*
+ * Advance playhead x of a clip of n frames by one frame period, at vel
+ * frames per period. Sub-frame velocities accumulate into *acc. This is
+ * the stepping used by the frame clock and by the event log renderer.
+ */
+static __inline__ Uint
+VS_ClipStep(Uint x, Uint n, double vel, double *acc)
+{
+	int delta;
+
+	if (vel < -1.0 || vel > +1.0) {			/* >=1 frame */
+		delta = (int)vel;
+		if ((x+delta) < n)
+			x += delta;
+	} else if (vel != 0.0) {			/* Sub-frame */
+		*acc += vel;
+		if (*acc <= -1.0 || *acc >= 1.0) {
+			delta = (*acc < 0) ? -1 : 1;
+			*acc = 0.0;
+			if ((x+delta) < n)
+				x += delta;
+		}
+	}
+	return (x);
+}
 __END_DECLS
 
 #endif /* _VISLAK_CLIP_H_ */
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Frame clock for the processing thread.
+ */
+
+#include <vislak.h>
+
+#include <time.h>
+#include <errno.h>
+
+#if defined(CLOCK_MONOTONIC) && defined(TIMER_ABSTIME) && !defined(__APPLE__)
+# define VS_CLOCK_ABSTIME
+#endif
+
+/* Return the monotonic time in nanoseconds. */
+Uint64
+VS_ClockNow(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((Uint64)ts.tv_sec*1000000000 + (Uint64)ts.tv_nsec);
+#else
+	return ((Uint64)AG_GetTicks()*1000000);
+#endif
+}
+
+void
+VS_ClockInit(VS_Clock *clk, Uint num, Uint den)
+{
+	clk->num = num;
+	clk->den = den;
+	clk->t0 = VS_ClockNow();
+	clk->k = 0;
+	VS_ClockResetStats(clk);
+}
+
+/* Change the frame period; the next deadline is one new period from now. */
+void
+VS_ClockSetPeriod(VS_Clock *clk, Uint num, Uint den)
+{
+	if (den == 0) {
+		den = 1;
+	}
+	clk->num = num;
+	clk->den = den;
+	clk->t0 = VS_ClockNow();
+	clk->k = 0;
+}
+
+void
+VS_ClockResetStats(VS_Clock *clk)
+{
+	clk->nFrames = 0;
+	clk->nOverruns = 0;
+	clk->jitLast = 0;
+	clk->jitAvg = 0;
+	clk->jitMax = 0;
+}
+
+/* Return the absolute deadline (ns) of frame k. */
+Uint64
+VS_ClockDeadline(const VS_Clock *clk, Uint64 k)
+{
+	return (clk->t0 + k*clk->num*1000000000/clk->den);
+}
+
+/* Sleep until the absolute time t (ns, VS_ClockNow() timebase). */
+void
+VS_ClockSleepUntil(Uint64 t)
+{
+	Uint64 tNow;
+
+	if ((tNow = VS_ClockNow()) >= t) {
+		return;
+	}
+#ifdef VS_CLOCK_ABSTIME
+	{
+		struct timespec ts;
+
+		ts.tv_sec = (time_t)(t / 1000000000);
+		ts.tv_nsec = (long)(t % 1000000000);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+		    NULL) == EINTR)
+			continue;
+	}
+#else
+	AG_Delay((Uint32)((t - tNow) / 1000000));
+#endif
+}
+
+/*
+ * Sleep until the deadline of the next frame and return the wakeup
+ * lateness in microseconds. If we fall more than VS_CLOCK_MAXLATE periods
+ * behind (e.g., after a long blocking operation), restart the epoch rather
+ * than trying to catch up on every missed frame.
+ */
+int
+VS_ClockWait(VS_Clock *clk)
+{
+	Uint64 tDeadline, tNow, period;
+	int late;
+
+	tDeadline = VS_ClockDeadline(clk, ++clk->k);
+	VS_ClockSleepUntil(tDeadline);
+	tNow = VS_ClockNow();
+
+	period = (Uint64)clk->num*1000000000/clk->den;
+	if (tNow > tDeadline + VS_CLOCK_MAXLATE*period) {
+		clk->t0 = tNow;
+		clk->k = 0;
+		clk->nOverruns++;
+	}
+	late = (tNow > tDeadline) ? (int)((tNow - tDeadline)/1000) : 0;
+
+	clk->jitLast = late;
+	clk->jitAvg += (late - clk->jitAvg)/16;
+	if (late > clk->jitMax) {
+		clk->jitMax = late;
+	}
+	clk->nFrames++;
+	return (late);
+}
@@ -0,0 +1,34 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_CLOCK_H_
+#define _VISLAK_CLOCK_H_
+
+/*
+ * Frame clock driven by absolute deadlines on the monotonic clock.
+ * The frame period is the rational num/den seconds, and the deadline of
+ * frame k is computed from the epoch (not accumulated), so it never drifts.
+ */
+typedef struct vs_clock {
+	Uint64 t0;			/* Epoch (ns) */
+	Uint64 k;			/* Frames elapsed since epoch */
+	Uint num, den;			/* Frame period (num/den seconds) */
+	Uint64 nFrames;			/* Total frames since reset */
+	Uint nOverruns;			/* Resynchronizations (>4 late) */
+	int jitLast;			/* Wakeup lateness of last frame (us) */
+	int jitAvg;			/* Average wakeup lateness (us) */
+	int jitMax;			/* Maximum wakeup lateness (us) */
+} VS_Clock;
+
+#define VS_CLOCK_MAXLATE 4		/* Periods late before resync */
+
+__BEGIN_DECLS
+Uint64 VS_ClockNow(void);
+void   VS_ClockInit(VS_Clock *, Uint, Uint);
+void   VS_ClockSetPeriod(VS_Clock *, Uint, Uint);
+void   VS_ClockResetStats(VS_Clock *);
+Uint64 VS_ClockDeadline(const VS_Clock *, Uint64);
+void   VS_ClockSleepUntil(Uint64);
+int    VS_ClockWait(VS_Clock *);
+__END_DECLS
+
+#endif /* _VISLAK_CLOCK_H_ */
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Performance capture log. While recording, every seek and velocity
+ * change of the input clip is logged with a microsecond timestamp. The
+ * log can be saved, loaded, and replayed offline into the output clip
+ * at an arbitrary frame rate.
+ */
+
+#include <vislak.h>
+
+void
+VS_EventLogInit(VS_EventLog *log)
+{
+	AG_MutexInit(&log->lock);
+	log->active = 0;
+	log->t0 = 0;
+	log->tLen = 0;
+	log->x0 = 0;
+	log->vel0 = 0.0;
+	log->ev = NULL;
+	log->n = 0;
+	log->maxEv = 0;
+}
+
+void
+VS_EventLogDestroy(VS_EventLog *log)
+{
+	Free(log->ev);
+	AG_MutexDestroy(&log->lock);
+}
+
+/* Clear the log and start capturing from the given initial state. */
+void
+VS_EventLogStart(VS_EventLog *log, Uint x0, float vel0)
+{
+	AG_MutexLock(&log->lock);
+	log->n = 0;
+	log->x0 = x0;
+	log->vel0 = vel0;
+	log->tLen = 0;
+	log->t0 = VS_ClockNow();
+	log->active = 1;
+	AG_MutexUnlock(&log->lock);
+}
+
+void
+VS_EventLogStop(VS_EventLog *log)
+{
+	AG_MutexLock(&log->lock);
+	if (log->active) {
+		log->tLen = (VS_ClockNow() - log->t0)/1000;
+		log->active = 0;
+	}
+	AG_MutexUnlock(&log->lock);
+}
+
+/*
+ * Log an event (no-op unless a capture is in progress). The event is
+ * stamped with t, the arrival time of the input that caused it, or with
+ * the current time if t is 0. Stamps are clamped so that the log stays
+ * in order when inputs are applied later than they arrive.
+ */
+void
+VS_EventLogPush(VS_EventLog *log, enum vs_event_type type, Uint x, float vel,
+    Uint64 t)
+{
+	VS_Event *ev, *evNew;
+	Uint maxNew;
+
+	AG_MutexLock(&log->lock);
+	if (!log->active) {
+		goto out;
+	}
+	if (log->n+1 > log->maxEv) {
+		maxNew = (log->maxEv > 0) ? log->maxEv*2 : 256;
+		if ((evNew = TryRealloc(log->ev, maxNew*sizeof(VS_Event)))
+		    == NULL) {
+			goto out;
+		}
+		log->ev = evNew;
+		log->maxEv = maxNew;
+	}
+	if (t == 0) {
+		t = VS_ClockNow();
+	}
+	t = (t > log->t0) ? (t - log->t0)/1000 : 0;
+	if (log->n > 0 && t < log->ev[log->n-1].t) {
+		t = log->ev[log->n-1].t;
+	}
+	ev = &log->ev[log->n++];
+	ev->t = t;
+	ev->type = type;
+	if (type == VS_EVENT_SEEK) {
+		ev->data.x = x;
+	} else {
+		ev->data.vel = vel;
+	}
+out:
+	AG_MutexUnlock(&log->lock);
+}
+
+int
+VS_EventLogSave(VS_EventLog *log, const char *path)
+{
+	AG_DataSource *ds;
+	Uint i;
+
+	if ((ds = AG_OpenFile(path, "wb")) == NULL) {
+		return (-1);
+	}
+	AG_MutexLock(&log->lock);
+	AG_WriteUint32(ds, VS_EVENTLOG_MAGIC);
+	AG_WriteUint32(ds, VS_EVENTLOG_VERSION);
+	AG_WriteUint64(ds, log->tLen);
+	AG_WriteUint32(ds, log->x0);
+	AG_WriteFloat(ds, log->vel0);
+	AG_WriteUint32(ds, log->n);
+	for (i = 0; i < log->n; i++) {
+		VS_Event *ev = &log->ev[i];
+
+		AG_WriteUint64(ds, ev->t);
+		AG_WriteUint8(ds, (Uint8)ev->type);
+		if (ev->type == VS_EVENT_SEEK) {
+			AG_WriteUint32(ds, ev->data.x);
+		} else {
+			AG_WriteFloat(ds, ev->data.vel);
+		}
+	}
+	AG_MutexUnlock(&log->lock);
+	AG_CloseFile(ds);
+	return (0);
+}
+
+int
+VS_EventLogLoad(VS_EventLog *log, const char *path)
+{
+	AG_DataSource *ds;
+	VS_Event *evNew;
+	Uint i, n;
+
+	if ((ds = AG_OpenFile(path, "rb")) == NULL) {
+		return (-1);
+	}
+	if (AG_ReadUint32(ds) != VS_EVENTLOG_MAGIC ||
+	    AG_ReadUint32(ds) != VS_EVENTLOG_VERSION) {
+		AG_SetError(_("%s: Not a performance log"), path);
+		goto fail;
+	}
+	AG_MutexLock(&log->lock);
+	if (log->active) {
+		AG_MutexUnlock(&log->lock);
+		AG_SetError(_("Capture in progress"));
+		goto fail;
+	}
+	log->tLen = AG_ReadUint64(ds);
+	log->x0 = AG_ReadUint32(ds);
+	log->vel0 = AG_ReadFloat(ds);
+	n = AG_ReadUint32(ds);
+	if ((evNew = TryRealloc(log->ev, (n+1)*sizeof(VS_Event))) == NULL) {
+		log->n = 0;
+		AG_MutexUnlock(&log->lock);
+		goto fail;
+	}
+	log->ev = evNew;
+	log->maxEv = n+1;
+	for (i = 0; i < n; i++) {
+		VS_Event *ev = &log->ev[i];
+
+		ev->t = AG_ReadUint64(ds);
+		ev->type = (enum vs_event_type)AG_ReadUint8(ds);
+		if (ev->type == VS_EVENT_SEEK) {
+			ev->data.x = AG_ReadUint32(ds);
+		} else {
+			ev->data.vel = AG_ReadFloat(ds);
+		}
+	}
+	log->n = n;
+	AG_MutexUnlock(&log->lock);
+	AG_CloseFile(ds);
+	return (0);
+fail:
+	AG_CloseFile(ds);
+	return (-1);
+}
+
+/*
+ * Replay the log at fps frames per second, appending the resulting take
+ * to the edit list of vDst (as references to frames of vSrc), and commit
+ * it. The playhead is stepped exactly as by the frame clock, with the
+ * logged velocities converted to frames per output frame.
+ */
+int
+VS_EventLogRender(VS_EventLog *log, VS_Clip *vSrc, VS_Clip *vDst, int fps)
+{
+	VS_Project *vsp = vDst->proj;
+	Uint64 k, nFrames;
+	double vel, acc = 0.0;
+	Uint i = 0, x;
+
+	if (fps <= 0) {
+		AG_SetError("Bad frame rate: %d", fps);
+		return (-1);
+	}
+	AG_MutexLock(&log->lock);
+	if (log->active) {
+		AG_SetError(_("Capture in progress"));
+		goto fail;
+	}
+	if (log->tLen == 0 || vSrc->n == 0) {
+		AG_SetError(_("Nothing to render"));
+		goto fail;
+	}
+	nFrames = log->tLen*fps/1000000;
+	x = log->x0;
+	vel = (double)log->vel0/fps;
+
+	vsp->gui.progress.min = 0;
+	vsp->gui.progress.max = (int)nFrames;
+	vsp->gui.progress.val = 0;
+
+	for (k = 0; k < nFrames; k++) {
+		Uint64 t = k*1000000/fps;
+
+		for (; i < log->n && log->ev[i].t <= t; i++) {
+			VS_Event *ev = &log->ev[i];
+
+			switch (ev->type) {
+			case VS_EVENT_SEEK:
+				if (ev->data.x < vSrc->n) {
+					x = ev->data.x;
+				}
+				break;
+			case VS_EVENT_VELOCITY:
+				vel = (double)ev->data.vel/fps;
+				break;
+			default:
+				break;
+			}
+		}
+		if (VS_ClipRecordFrame(vDst, vSrc, x) == -1) {
+			goto fail;
+		}
+		x = VS_ClipStep(x, vSrc->n, vel, &acc);
+
+		if ((k & 0xff) == 0) {
+			if (VS_ProjectCancelled(vsp)) {
+				AG_SetError(_("Cancelled"));
+				goto fail;
+			}
+			vsp->gui.progress.val = (int)k;
+		}
+	}
+	AG_MutexUnlock(&log->lock);
+
+	if (VS_ClipCommitEdits(vDst) == -1) {
+		return (-1);
+	}
+	vsp->gui.progress.val = vsp->gui.progress.max;
+	return (0);
+fail:
+	AG_MutexUnlock(&log->lock);
+	VS_ClipDiscardEdits(vDst);
+	return (-1);
+}
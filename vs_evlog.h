@@ -0,0 +1,53 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_EVLOG_H_
+#define _VISLAK_EVLOG_H_
+
+#include "vs_clip.h"
+
+/*
+ * Log of the playhead-affecting inputs of a performance, with monotonic
+ * timestamps. Velocities are logged in frames per second, so that a take
+ * can be replayed at any output frame rate.
+ */
+enum vs_event_type {
+	VS_EVENT_SEEK,			/* Jump to frame */
+	VS_EVENT_VELOCITY,		/* Set frame advance velocity */
+	VS_EVENT_LAST
+};
+
+typedef struct vs_event {
+	Uint64 t;			/* Time since start of log (us) */
+	enum vs_event_type type;
+	union {
+		Uint x;			/* Frame# (SEEK) */
+		float vel;		/* Frames per second (VELOCITY) */
+	} data;
+} VS_Event;
+
+typedef struct vs_event_log {
+	AG_Mutex lock;
+	int active;			/* Capture in progress */
+	Uint64 t0;			/* Start of capture (ns, VS_ClockNow) */
+	Uint64 tLen;			/* Length of capture (us) */
+	Uint x0;			/* Initial playhead */
+	float vel0;			/* Initial velocity (frames/s) */
+	VS_Event *ev;			/* Logged events */
+	Uint n, maxEv;
+} VS_EventLog;
+
+#define VS_EVENTLOG_MAGIC	0x56534556	/* "VSEV" */
+#define VS_EVENTLOG_VERSION	1
+
+__BEGIN_DECLS
+void VS_EventLogInit(VS_EventLog *);
+void VS_EventLogDestroy(VS_EventLog *);
+void VS_EventLogStart(VS_EventLog *, Uint, float);
+void VS_EventLogStop(VS_EventLog *);
+void VS_EventLogPush(VS_EventLog *, enum vs_event_type, Uint, float, Uint64);
+int  VS_EventLogSave(VS_EventLog *, const char *);
+int  VS_EventLogLoad(VS_EventLog *, const char *);
+int  VS_EventLogRender(VS_EventLog *, VS_Clip *, VS_Clip *, int);
+__END_DECLS
+
+#endif /* _VISLAK_EVLOG_H_ */
@@ -0,0 +1,847 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Video export. Frames are already stored as JPEG files, so the Motion
+ * JPEG exporter copies the compressed bytes straight into the container
+ * without decoding. The audio of the clip is interleaved with the video
+ * as one chunk of 16-bit PCM per frame, using the same frame-to-sample
+ * mapping as playback.
+ *
+ * The YUV4MPEG2 exporter decodes, scales and converts frames to 4:2:0
+ * in parallel on the thread pool, and streams them in order to a file,
+ * a named pipe or the standard output (for an external encoder).
+ */
+
+#include <vislak.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+
+#define VS_EXPORT_BUFSIZE	(1024*1024)
+
+typedef struct vs_export_mov {
+	FILE *f;
+	Uint n;				/* Frames to export */
+	int w, h;			/* Video dimensions */
+	int fps;			/* Frame rate */
+	int channels;			/* Audio channels (0 = no audio) */
+	int rate;			/* Audio sampling rate */
+	int spf;			/* Audio samples per frame */
+	Uint32 *vidSize;		/* Size of each JPEG */
+	Uint64 *vidOffs;		/* File offset of each JPEG */
+	Uint64 *audOffs;		/* File offset of each audio chunk */
+	Uint8 *buf;			/* Copy buffer */
+} VS_MovWriter;
+
+/*
+ * Big-endian output and atom size backpatching.
+ */
+static void
+Put8(FILE *f, Uint8 v)
+{
+	fputc(v, f);
+}
+static void
+Put16(FILE *f, Uint16 v)
+{
+	fputc(v >> 8, f);
+	fputc(v & 0xff, f);
+}
+static void
+Put32(FILE *f, Uint32 v)
+{
+	Put16(f, v >> 16);
+	Put16(f, v & 0xffff);
+}
+static void
+Put64(FILE *f, Uint64 v)
+{
+	Put32(f, (Uint32)(v >> 32));
+	Put32(f, (Uint32)(v & 0xffffffff));
+}
+static void
+PutType(FILE *f, const char *type)
+{
+	fwrite(type, 1, 4, f);
+}
+static void
+PutZero(FILE *f, int n)
+{
+	while (n-- > 0)
+		fputc(0, f);
+}
+static off_t
+BeginAtom(FILE *f, const char *type)
+{
+	off_t offs = ftello(f);
+
+	Put32(f, 0);
+	PutType(f, type);
+	return (offs);
+}
+static void
+EndAtom(FILE *f, off_t offs)
+{
+	off_t end = ftello(f);
+
+	fseeko(f, offs, SEEK_SET);
+	Put32(f, (Uint32)(end - offs));
+	fseeko(f, end, SEEK_SET);
+}
+static void
+PutMatrix(FILE *f)
+{
+	Put32(f, 0x00010000); Put32(f, 0); Put32(f, 0);
+	Put32(f, 0); Put32(f, 0x00010000); Put32(f, 0);
+	Put32(f, 0); Put32(f, 0); Put32(f, 0x40000000);
+}
+
+/* Read the dimensions of a JPEG file from its SOFn marker. */
+static int
+JPEGSize(const char *path, int *w, int *h)
+{
+	FILE *f;
+	int c, len;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	if (fgetc(f) != 0xff || fgetc(f) != 0xd8)
+		goto fail;
+
+	for (;;) {
+		while ((c = fgetc(f)) != 0xff) {
+			if (c == EOF)
+				goto fail;
+		}
+		while ((c = fgetc(f)) == 0xff)
+			;
+		if (c == EOF || c == 0xd9 || c == 0xda) {
+			goto fail;
+		}
+		if (c == 0x01 || (c >= 0xd0 && c <= 0xd7)) {
+			continue;
+		}
+		len = fgetc(f) << 8;
+		len |= fgetc(f);
+		if (c >= 0xc0 && c <= 0xcf &&
+		    c != 0xc4 && c != 0xc8 && c != 0xcc) {
+			(void)fgetc(f);			/* Precision */
+			*h = fgetc(f) << 8;
+			*h |= fgetc(f);
+			*w = fgetc(f) << 8;
+			*w |= fgetc(f);
+			fclose(f);
+			return (0);
+		}
+		if (len < 2 || fseek(f, len-2, SEEK_CUR) == -1)
+			goto fail;
+	}
+fail:
+	fclose(f);
+	AG_SetError(_("%s: Cannot find JPEG frame header"), path);
+	return (-1);
+}
+
+/* Copy the JPEG file of frame i into the output. */
+static int
+CopyFrame(VS_MovWriter *mov, VS_Clip *v, Uint i)
+{
+	char path[AG_PATHNAME_MAX];
+	FILE *fIn;
+	size_t len;
+	Uint32 size = 0;
+
+	if (VS_ClipGetFrameSource(v, i, path, sizeof(path)) == -1) {
+		return (-1);
+	}
+	if ((fIn = fopen(path, "rb")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	mov->vidOffs[i] = (Uint64)ftello(mov->f);
+	while ((len = fread(mov->buf, 1, VS_EXPORT_BUFSIZE, fIn)) > 0) {
+		if (fwrite(mov->buf, 1, len, mov->f) != len) {
+			AG_SetError("Write error: %s", strerror(errno));
+			fclose(fIn);
+			return (-1);
+		}
+		size += (Uint32)len;
+	}
+	fclose(fIn);
+	mov->vidSize[i] = size;
+	return (0);
+}
+
+/* Write the audio chunk which plays along with frame i. */
+static void
+WriteAudio(VS_MovWriter *mov, VS_Clip *v, Uint i)
+{
+	sf_count_t pos, end, j;
+	Sint16 *s = (Sint16 *)mov->buf;
+	Uint nSamples = mov->spf*mov->channels;
+
+	mov->audOffs[i] = (Uint64)ftello(mov->f);
+
+	AG_MutexLock(&v->sndLock);
+	pos = VS_ClipFrameToSample(v, i);
+	end = (v->sndBuf != NULL) ? v->sndInfo.frames*v->sndInfo.channels : 0;
+	for (j = 0; j < nSamples; j++) {
+		float sample = (pos+j < end) ? v->sndBuf[pos+j] : 0.0f;
+		Sint16 pcm;
+
+		if (sample > 1.0f) { sample = 1.0f; }
+		if (sample < -1.0f) { sample = -1.0f; }
+		pcm = (Sint16)(sample*32767.0f);
+
+		/* 'sowt' is little-endian */
+		((Uint8 *)&s[j])[0] = (Uint8)(pcm & 0xff);
+		((Uint8 *)&s[j])[1] = (Uint8)((pcm >> 8) & 0xff);
+	}
+	AG_MutexUnlock(&v->sndLock);
+
+	fwrite(s, sizeof(Sint16), nSamples, mov->f);
+}
+
+static void
+WriteTrackHeader(VS_MovWriter *mov, Uint32 id, int audio)
+{
+	FILE *f = mov->f;
+	off_t a;
+
+	a = BeginAtom(f, "tkhd");
+	Put32(f, 0x0000000f);			/* Enabled, in movie/preview */
+	Put32(f, 0);				/* Creation time */
+	Put32(f, 0);				/* Modification time */
+	Put32(f, id);
+	Put32(f, 0);
+	Put32(f, (Uint32)((Uint64)mov->n*1000/mov->fps));
+	PutZero(f, 8);
+	Put16(f, 0);				/* Layer */
+	Put16(f, 0);				/* Alternate group */
+	Put16(f, audio ? 0x0100 : 0);		/* Volume */
+	Put16(f, 0);
+	PutMatrix(f);
+	Put32(f, audio ? 0 : (Uint32)mov->w << 16);
+	Put32(f, audio ? 0 : (Uint32)mov->h << 16);
+	EndAtom(f, a);
+}
+
+static void
+WriteHandler(FILE *f, const char *compType, const char *compSubtype)
+{
+	off_t a;
+
+	a = BeginAtom(f, "hdlr");
+	Put32(f, 0);
+	PutType(f, compType);
+	PutType(f, compSubtype);
+	Put32(f, 0);				/* Manufacturer */
+	Put32(f, 0);				/* Flags */
+	Put32(f, 0);				/* Flags mask */
+	Put8(f, 0);				/* Name (empty) */
+	EndAtom(f, a);
+}
+
+static void
+WriteDataInfo(FILE *f)
+{
+	off_t a, b;
+
+	a = BeginAtom(f, "dinf");
+	b = BeginAtom(f, "dref");
+	Put32(f, 0);
+	Put32(f, 1);
+	Put32(f, 12);
+	PutType(f, "alis");
+	Put32(f, 0x00000001);			/* Data is in this file */
+	EndAtom(f, b);
+	EndAtom(f, a);
+}
+
+static void
+WriteChunkOffsets(FILE *f, const Uint64 *offs, Uint n)
+{
+	off_t a;
+	Uint i;
+
+	a = BeginAtom(f, "co64");
+	Put32(f, 0);
+	Put32(f, n);
+	for (i = 0; i < n; i++) {
+		Put64(f, offs[i]);
+	}
+	EndAtom(f, a);
+}
+
+static void
+WriteVideoTrack(VS_MovWriter *mov)
+{
+	FILE *f = mov->f;
+	off_t trak, mdia, minf, stbl, a, b;
+	Uint i;
+
+	trak = BeginAtom(f, "trak");
+	WriteTrackHeader(mov, 1, 0);
+	mdia = BeginAtom(f, "mdia");
+
+	a = BeginAtom(f, "mdhd");
+	Put32(f, 0);
+	Put32(f, 0);
+	Put32(f, 0);
+	Put32(f, (Uint32)mov->fps);		/* Time scale */
+	Put32(f, mov->n);			/* Duration */
+	Put16(f, 0);				/* Language */
+	Put16(f, 0);				/* Quality */
+	EndAtom(f, a);
+	WriteHandler(f, "mhlr", "vide");
+
+	minf = BeginAtom(f, "minf");
+	a = BeginAtom(f, "vmhd");
+	Put32(f, 0x00000001);
+	Put16(f, 0x0040);			/* Graphics mode (copy) */
+	Put16(f, 0x8000); Put16(f, 0x8000); Put16(f, 0x8000);
+	EndAtom(f, a);
+	WriteHandler(f, "dhlr", "alis");
+	WriteDataInfo(f);
+
+	stbl = BeginAtom(f, "stbl");
+	a = BeginAtom(f, "stsd");
+	Put32(f, 0);
+	Put32(f, 1);
+	b = BeginAtom(f, "jpeg");
+	PutZero(f, 6);
+	Put16(f, 1);				/* Data reference index */
+	Put16(f, 0);				/* Version */
+	Put16(f, 0);				/* Revision */
+	Put32(f, 0);				/* Vendor */
+	Put32(f, 0x00000200);			/* Temporal quality */
+	Put32(f, 0x00000200);			/* Spatial quality */
+	Put16(f, (Uint16)mov->w);
+	Put16(f, (Uint16)mov->h);
+	Put32(f, 0x00480000);			/* 72 dpi */
+	Put32(f, 0x00480000);
+	Put32(f, 0);				/* Data size */
+	Put16(f, 1);				/* Frames per sample */
+	Put8(f, 12);				/* Compressor name */
+	fwrite("Photo - JPEG", 1, 12, f);
+	PutZero(f, 31-12);
+	Put16(f, 24);				/* Depth */
+	Put16(f, 0xffff);			/* No color table */
+	EndAtom(f, b);
+	EndAtom(f, a);
+
+	a = BeginAtom(f, "stts");
+	Put32(f, 0);
+	Put32(f, 1);
+	Put32(f, mov->n);
+	Put32(f, 1);
+	EndAtom(f, a);
+
+	a = BeginAtom(f, "stsc");
+	Put32(f, 0);
+	Put32(f, 1);
+	Put32(f, 1);				/* First chunk */
+	Put32(f, 1);				/* Samples per chunk */
+	Put32(f, 1);				/* Description ID */
+	EndAtom(f, a);
+
+	a = BeginAtom(f, "stsz");
+	Put32(f, 0);
+	Put32(f, 0);				/* Sizes vary */
+	Put32(f, mov->n);
+	for (i = 0; i < mov->n; i++) {
+		Put32(f, mov->vidSize[i]);
+	}
+	EndAtom(f, a);
+
+	WriteChunkOffsets(f, mov->vidOffs, mov->n);
+	EndAtom(f, stbl);
+	EndAtom(f, minf);
+	EndAtom(f, mdia);
+	EndAtom(f, trak);
+}
+
+static void
+WriteAudioTrack(VS_MovWriter *mov)
+{
+	FILE *f = mov->f;
+	off_t trak, mdia, minf, stbl, a, b;
+
+	trak = BeginAtom(f, "trak");
+	WriteTrackHeader(mov, 2, 1);
+	mdia = BeginAtom(f, "mdia");
+
+	a = BeginAtom(f, "mdhd");
+	Put32(f, 0);
+	Put32(f, 0);
+	Put32(f, 0);
+	Put32(f, (Uint32)mov->rate);		/* Time scale */
+	Put32(f, mov->n*mov->spf);		/* Duration */
+	Put16(f, 0);
+	Put16(f, 0);
+	EndAtom(f, a);
+	WriteHandler(f, "mhlr", "soun");
+
+	minf = BeginAtom(f, "minf");
+	a = BeginAtom(f, "smhd");
+	Put32(f, 0);
+	Put16(f, 0);				/* Balance */
+	Put16(f, 0);
+	EndAtom(f, a);
+	WriteHandler(f, "dhlr", "alis");
+	WriteDataInfo(f);
+
+	stbl = BeginAtom(f, "stbl");
+	a = BeginAtom(f, "stsd");
+	Put32(f, 0);
+	Put32(f, 1);
+	b = BeginAtom(f, "sowt");
+	PutZero(f, 6);
+	Put16(f, 1);				/* Data reference index */
+	Put16(f, 0);				/* Version */
+	Put16(f, 0);				/* Revision */
+	Put32(f, 0);				/* Vendor */
+	Put16(f, (Uint16)mov->channels);
+	Put16(f, 16);				/* Sample size */
+	Put16(f, 0);				/* Compression ID */
+	Put16(f, 0);				/* Packet size */
+	Put32(f, (Uint32)mov->rate << 16);
+	EndAtom(f, b);
+	EndAtom(f, a);
+
+	a = BeginAtom(f, "stts");
+	Put32(f, 0);
+	Put32(f, 1);
+	Put32(f, mov->n*mov->spf);
+	Put32(f, 1);
+	EndAtom(f, a);
+
+	a = BeginAtom(f, "stsc");
+	Put32(f, 0);
+	Put32(f, 1);
+	Put32(f, 1);				/* First chunk */
+	Put32(f, (Uint32)mov->spf);		/* Samples per chunk */
+	Put32(f, 1);				/* Description ID */
+	EndAtom(f, a);
+
+	a = BeginAtom(f, "stsz");
+	Put32(f, 0);
+	Put32(f, 1);				/* Constant sample size */
+	Put32(f, mov->n*mov->spf);
+	EndAtom(f, a);
+
+	WriteChunkOffsets(f, mov->audOffs, mov->n);
+	EndAtom(f, stbl);
+	EndAtom(f, minf);
+	EndAtom(f, mdia);
+	EndAtom(f, trak);
+}
+
+static void
+WriteMovieHeader(VS_MovWriter *mov)
+{
+	FILE *f = mov->f;
+	off_t a;
+
+	a = BeginAtom(f, "mvhd");
+	Put32(f, 0);
+	Put32(f, 0);				/* Creation time */
+	Put32(f, 0);				/* Modification time */
+	Put32(f, 1000);				/* Time scale */
+	Put32(f, (Uint32)((Uint64)mov->n*1000/mov->fps));
+	Put32(f, 0x00010000);			/* Preferred rate */
+	Put16(f, 0x0100);			/* Preferred volume */
+	PutZero(f, 10);
+	PutMatrix(f);
+	PutZero(f, 6*4);			/* Preview, poster, selection */
+	Put32(f, mov->channels > 0 ? 3 : 2);	/* Next track ID */
+	EndAtom(f, a);
+}
+
+/*
+ * Export the frames of a clip (and its audio, if any) to a QuickTime
+ * movie, without transcoding.
+ */
+int
+VS_ExportMOV(VS_Clip *v, const char *path)
+{
+	char pathFrame[AG_PATHNAME_MAX];
+	VS_Project *vsp = v->proj;
+	VS_MovWriter mov;
+	off_t mdat, moov, end;
+	Uint i;
+
+	memset(&mov, 0, sizeof(mov));
+
+	AG_MutexLock(&v->lock);
+	mov.n = v->n;
+	AG_MutexUnlock(&v->lock);
+	if (mov.n == 0) {
+		AG_SetError(_("Nothing to export"));
+		return (-1);
+	}
+	if (VS_ClipGetFrameSource(v, 0, pathFrame, sizeof(pathFrame)) == -1 ||
+	    JPEGSize(pathFrame, &mov.w, &mov.h) == -1) {
+		return (-1);
+	}
+
+	AG_ObjectLock(vsp);
+	mov.fps = vsp->frameRate;
+	AG_ObjectUnlock(vsp);
+
+	AG_MutexLock(&v->sndLock);
+	if (v->sndBuf != NULL && v->samplesPerFrame > 0) {
+		mov.channels = v->sndInfo.channels;
+		mov.rate = v->sndInfo.samplerate;
+		mov.spf = v->samplesPerFrame;
+	}
+	AG_MutexUnlock(&v->sndLock);
+	if (mov.rate > 0xffff) {
+		AG_SetError(_("Sampling rate %d Hz not supported"), mov.rate);
+		return (-1);
+	}
+
+	if ((mov.vidSize = TryMalloc(mov.n*sizeof(Uint32))) == NULL ||
+	    (mov.vidOffs = TryMalloc(mov.n*sizeof(Uint64))) == NULL ||
+	    (mov.audOffs = TryMalloc(mov.n*sizeof(Uint64))) == NULL ||
+	    (mov.buf = TryMalloc(MAX(VS_EXPORT_BUFSIZE,
+	                             mov.spf*mov.channels*sizeof(Sint16))))
+	     == NULL) {
+		goto fail;
+	}
+	if ((mov.f = fopen(path, "wb")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		goto fail;
+	}
+	setvbuf(mov.f, NULL, _IOFBF, VS_EXPORT_BUFSIZE);
+
+	vsp->gui.progress.min = 0;
+	vsp->gui.progress.max = (int)mov.n;
+	vsp->gui.progress.val = 0;
+
+	/* File type */
+	Put32(mov.f, 20);
+	PutType(mov.f, "ftyp");
+	PutType(mov.f, "qt  ");
+	Put32(mov.f, 0x00000200);
+	PutType(mov.f, "qt  ");
+
+	/* Media data, with a 64-bit atom size. */
+	mdat = ftello(mov.f);
+	Put32(mov.f, 1);
+	PutType(mov.f, "mdat");
+	Put64(mov.f, 0);
+	for (i = 0; i < mov.n; i++) {
+		if (CopyFrame(&mov, v, i) == -1) {
+			goto fail_close;
+		}
+		if (mov.channels > 0) {
+			WriteAudio(&mov, v, i);
+		}
+		if ((i & 0xff) == 0) {
+			if (VS_ProjectCancelled(vsp)) {
+				AG_SetError(_("Cancelled"));
+				goto fail_close;
+			}
+			vsp->gui.progress.val = (int)i;
+		}
+	}
+	end = ftello(mov.f);
+	fseeko(mov.f, mdat+8, SEEK_SET);
+	Put64(mov.f, (Uint64)(end - mdat));
+	fseeko(mov.f, end, SEEK_SET);
+
+	/* Movie metadata */
+	moov = BeginAtom(mov.f, "moov");
+	WriteMovieHeader(&mov);
+	WriteVideoTrack(&mov);
+	if (mov.channels > 0) {
+		WriteAudioTrack(&mov);
+	}
+	EndAtom(mov.f, moov);
+
+	if (ferror(mov.f) || fclose(mov.f) != 0) {
+		AG_SetError("%s: Write error", path);
+		mov.f = NULL;
+		goto fail;
+	}
+	Free(mov.vidSize);
+	Free(mov.vidOffs);
+	Free(mov.audOffs);
+	Free(mov.buf);
+	vsp->gui.progress.val = vsp->gui.progress.max;
+	return (0);
+fail_close:
+	fclose(mov.f);
+	unlink(path);
+fail:
+	Free(mov.vidSize);
+	Free(mov.vidOffs);
+	Free(mov.audOffs);
+	Free(mov.buf);
+	return (-1);
+}
+
+/*
+ * YUV4MPEG2 export. A window of frames is decoded concurrently; the
+ * writer waits for the oldest frame of the window, writes it out and
+ * reuses its slot for the next frame to decode, so memory use does not
+ * depend on the length of the clip.
+ */
+enum vs_y4m_slot_state {
+	VS_Y4M_FREE,
+	VS_Y4M_PENDING,			/* Being decoded */
+	VS_Y4M_READY,			/* Ready to write */
+	VS_Y4M_FAILED			/* Decode failed */
+};
+
+struct vs_y4m;
+
+typedef struct vs_y4m_slot {
+	struct vs_y4m *y4m;		/* Back pointer to export */
+	Uint f;				/* Frame# */
+	enum vs_y4m_slot_state state;
+	Uint8 *yuv;			/* Converted frame (I420) */
+} VS_Y4MSlot;
+
+typedef struct vs_y4m {
+	VS_Clip *clip;
+	int w, h;			/* Output dimensions */
+	size_t frameSize;		/* Size of an I420 frame */
+	AG_Mutex lock;			/* Lock on slot states */
+	AG_Cond cond;			/* Signaled on frame completion */
+	VS_Y4MSlot *slots;
+	Uint nSlots;
+	VS_TaskGroup grp;		/* Outstanding decode tasks */
+} VS_Y4M;
+
+/* Convert a surface to planar 4:2:0 (BT.601, limited range). */
+static void
+ConvertI420(const AG_Surface *su, Uint8 *yuv, int w, int h)
+{
+	Uint8 *pY = yuv;
+	Uint8 *pU = &yuv[w*h];
+	Uint8 *pV = &yuv[w*h + (w/2)*(h/2)];
+	int x, y, dx, dy;
+
+	for (y = 0; y < h; y += 2) {
+		for (x = 0; x < w; x += 2) {
+			int rSum = 0, gSum = 0, bSum = 0;
+
+			for (dy = 0; dy < 2; dy++) {
+				for (dx = 0; dx < 2; dx++) {
+					Uint8 *p = (Uint8 *)su->pixels +
+					    (y+dy)*su->pitch +
+					    (x+dx)*su->format->BytesPerPixel;
+					Uint8 r, g, b;
+
+					AG_GetRGB(AG_GetPixel(su, p),
+					    su->format, &r, &g, &b);
+					pY[(y+dy)*w + x+dx] = (Uint8)
+					    (((66*r + 129*g + 25*b + 128) >> 8)
+					    + 16);
+					rSum += r;
+					gSum += g;
+					bSum += b;
+				}
+			}
+			rSum >>= 2;
+			gSum >>= 2;
+			bSum >>= 2;
+			*pU++ = (Uint8)(((-38*rSum - 74*gSum + 112*bSum + 128)
+			    >> 8) + 128);
+			*pV++ = (Uint8)(((112*rSum - 94*gSum - 18*bSum + 128)
+			    >> 8) + 128);
+		}
+	}
+}
+
+/* Decode, scale and convert one frame (pool task). */
+static void
+Y4MFrameTask(void *arg)
+{
+	VS_Y4MSlot *slot = arg;
+	VS_Y4M *y4m = slot->y4m;
+	enum vs_y4m_slot_state state = VS_Y4M_FAILED;
+	AG_Surface *su;
+
+	if (!VS_ProjectCancelled(y4m->clip->proj) &&
+	    (su = VS_ClipReadFrame(y4m->clip, slot->f, y4m->w, y4m->h))
+	    != NULL) {
+		ConvertI420(su, slot->yuv, y4m->w, y4m->h);
+		AG_SurfaceFree(su);
+		state = VS_Y4M_READY;
+	}
+	AG_MutexLock(&y4m->lock);
+	slot->state = state;
+	AG_CondBroadcast(&y4m->cond);
+	AG_MutexUnlock(&y4m->lock);
+}
+
+/*
+ * Export the frames of a clip as a YUV4MPEG2 stream of the given height
+ * (0 = original size), to a file, a named pipe or "-" (standard output).
+ */
+int
+VS_ExportY4M(VS_Clip *v, const char *path, int hOut)
+{
+	char pathFrame[AG_PATHNAME_MAX];
+	VS_Project *vsp = v->proj;
+	VS_Y4M y4m;
+	Uint8 *yuvBuf = NULL;
+	FILE *f;
+	Uint i, n, fNext = 0, fSubmit = 0;
+	int w, h, fps, rv = -1;
+#ifdef SIGPIPE
+	void (*sigPipeSave)(int);
+#endif
+
+	AG_MutexLock(&v->lock);
+	n = v->n;
+	AG_MutexUnlock(&v->lock);
+	if (n == 0) {
+		AG_SetError(_("Nothing to export"));
+		return (-1);
+	}
+	if (VS_ClipGetFrameSource(v, 0, pathFrame, sizeof(pathFrame)) == -1 ||
+	    JPEGSize(pathFrame, &w, &h) == -1) {
+		return (-1);
+	}
+	if (hOut > 0) {
+		w = w*hOut/h;
+		h = hOut;
+	}
+	w &= ~1;				/* 4:2:0 needs even sizes */
+	h &= ~1;
+	if (w <= 0 || h <= 0) {
+		AG_SetError("Bad frame size: %dx%d", w, h);
+		return (-1);
+	}
+	AG_ObjectLock(vsp);
+	fps = vsp->frameRate;
+	AG_ObjectUnlock(vsp);
+
+	y4m.clip = v;
+	y4m.w = w;
+	y4m.h = h;
+	y4m.frameSize = w*h + 2*(w/2)*(h/2);
+	y4m.nSlots = VS_PoolWorkerCount()*2;
+	if (y4m.nSlots < 2) { y4m.nSlots = 2; }
+	if ((y4m.slots = TryMalloc(y4m.nSlots*sizeof(VS_Y4MSlot))) == NULL) {
+		return (-1);
+	}
+	if ((yuvBuf = TryMalloc(y4m.nSlots*y4m.frameSize)) == NULL) {
+		Free(y4m.slots);
+		return (-1);
+	}
+	for (i = 0; i < y4m.nSlots; i++) {
+		y4m.slots[i].y4m = &y4m;
+		y4m.slots[i].state = VS_Y4M_FREE;
+		y4m.slots[i].yuv = &yuvBuf[i*y4m.frameSize];
+	}
+	AG_MutexInit(&y4m.lock);
+	AG_CondInit(&y4m.cond);
+	VS_TaskGroupInit(&y4m.grp);
+
+	if (strcmp(path, "-") == 0) {
+		f = stdout;
+	} else if ((f = fopen(path, "wb")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		goto out;
+	}
+#ifdef SIGPIPE
+	/* Report a consumer exiting early as a write error. */
+	sigPipeSave = signal(SIGPIPE, SIG_IGN);
+#endif
+	setvbuf(f, NULL, _IOFBF, VS_EXPORT_BUFSIZE);
+
+	vsp->gui.progress.min = 0;
+	vsp->gui.progress.max = (int)n;
+	vsp->gui.progress.val = 0;
+
+	fprintf(f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg "
+	           "XCOLORRANGE=LIMITED\n", w, h, fps);
+
+	while (fNext < n) {
+		VS_Y4MSlot *slot;
+
+		/* Keep the window full. */
+		for (; fSubmit < n && fSubmit < fNext + y4m.nSlots; fSubmit++) {
+			slot = &y4m.slots[fSubmit % y4m.nSlots];
+			slot->f = fSubmit;
+			slot->state = VS_Y4M_PENDING;
+			VS_PoolSubmit(VS_TASK_BACKGROUND, Y4MFrameTask, slot,
+			    &y4m.grp);
+		}
+
+		/* Write out frames in order. */
+		slot = &y4m.slots[fNext % y4m.nSlots];
+		AG_MutexLock(&y4m.lock);
+		while (slot->state == VS_Y4M_PENDING) {
+			AG_CondWait(&y4m.cond, &y4m.lock);
+		}
+		AG_MutexUnlock(&y4m.lock);
+		if (slot->state == VS_Y4M_FAILED) {
+			if (VS_ProjectCancelled(vsp)) {
+				AG_SetError(_("Cancelled"));
+			}
+			goto out_close;
+		}
+		if (fputs("FRAME\n", f) == EOF ||
+		    fwrite(slot->yuv, 1, y4m.frameSize, f) != y4m.frameSize) {
+			AG_SetError("Write error: %s", strerror(errno));
+			goto out_close;
+		}
+		slot->state = VS_Y4M_FREE;
+		fNext++;
+		vsp->gui.progress.val = (int)fNext;
+	}
+	if (fflush(f) != 0) {
+		AG_SetError("Write error: %s", strerror(errno));
+		goto out_close;
+	}
+	rv = 0;
+out_close:
+	VS_TaskGroupWait(&y4m.grp);
+	if (f != stdout) {
+		fclose(f);
+	} else {
+		fflush(f);
+	}
+#ifdef SIGPIPE
+	signal(SIGPIPE, sigPipeSave);
+#endif
+out:
+	VS_TaskGroupDestroy(&y4m.grp);
+	AG_CondDestroy(&y4m.cond);
+	AG_MutexDestroy(&y4m.lock);
+	Free(yuvBuf);
+	Free(y4m.slots);
+	return (rv);
+}
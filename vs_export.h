@@ -0,0 +1,23 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_EXPORT_H_
+#define _VISLAK_EXPORT_H_
+
+#include "vs_clip.h"
+
+enum vs_export_format {
+	VS_EXPORT_MOV,			/* QuickTime, Motion JPEG + PCM */
+	VS_EXPORT_Y4M			/* YUV4MPEG2 stream (rescaled) */
+};
+
+/* Export job argument: format and output height (0 = original size). */
+#define VS_EXPORT_ARG(fmt,h)	(((h) << 8) | (fmt))
+#define VS_EXPORT_FORMAT(arg)	((arg) & 0xff)
+#define VS_EXPORT_HEIGHT(arg)	((arg) >> 8)
+
+__BEGIN_DECLS
+int VS_ExportMOV(VS_Clip *, const char *);
+int VS_ExportY4M(VS_Clip *, const char *, int);
+__END_DECLS
+
+#endif /* _VISLAK_EXPORT_H_ */
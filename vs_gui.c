@@ -39,6 +39,20 @@ AG_Object vsVfsRoot;			/* General-purpose VFS */
 
 static int nEditorWindows = 0;
 
+/*
+ * Save an object to path (or to its archive path if NULL). Projects are
+ * saved through their journal.
+ */
+static int
+SaveObject(AG_Object *obj, const char *path)
+{
+	if (AG_OfClass(obj, "VS_Project")) {
+		return VS_ProjectSave((VS_Project *)obj, path);
+	}
+	return (path != NULL) ? AG_ObjectSaveToFile(obj, path) :
+	                        AG_ObjectSave(obj);
+}
+
 /*
  * Display "Save changes?" dialog on exit.
  */
@@ -50,10 +64,12 @@ CloseObject(AG_Event *event)
 	int save = AG_INT(3);
 
 	if (save) {
-		if (AG_ObjectSave(obj) == -1) {
+		if (SaveObject(obj, NULL) == -1) {
 			AG_TextMsgFromError();	/* TODO suggest "save as" */
 			return;
 		}
+	} else if (AG_OfClass(obj, "VS_Project")) {
+		VS_JournalDiscard((VS_Project *)obj);
 	}
 	AG_ObjectDetach(win);
 	AG_ObjectDelete(obj);
@@ -70,7 +86,8 @@ WindowClose(AG_Event *event)
 	AG_Button *bOpts[3];
 	AG_Window *wDlg;
 
-	if (!AG_ObjectChanged(obj)) {
+	if (AG_OfClass(obj, "VS_Project") ?
+	    !VS_ProjectChanged((VS_Project *)obj) : !AG_ObjectChanged(obj)) {
 		AG_EventArgs(&ev, "%p,%p,%i", win, obj, 0);
 		CloseObject(&ev);
 		return;
@@ -152,7 +169,13 @@ VS_GUI_LoadObject(AG_Event *event)
 	if ((obj = AG_ObjectNew(&vsVfsRoot, NULL, cl)) == NULL) {
 		goto fail;
 	}
-	if (AG_ObjectLoadFromFile(obj, path) == -1) {
+	if (AG_OfClass(obj, "VS_Project")) {
+		if (VS_ProjectLoad((VS_Project *)obj, path, 0) == -1) {
+			AG_SetError("%s: %s", AG_ShortFilename(path),
+			    AG_GetError());
+			goto fail;
+		}
+	} else if (AG_ObjectLoadFromFile(obj, path) == -1) {
 		AG_SetError("%s: %s", AG_ShortFilename(path), AG_GetError());
 		goto fail;
 	}
@@ -204,7 +227,7 @@ SaveNativeObject(AG_Event *event)
 	char *path = AG_STRING(2);
 	AG_Window *wEdit;
 
-	if (AG_ObjectSaveToFile(obj, path) == -1) {
+	if (SaveObject(obj, path) == -1) {
 		AG_TextError("%s: %s", AG_ShortFilename(path), AG_GetError());
 	}
 	AG_ObjectSetArchivePath(obj, path);
@@ -271,7 +294,7 @@ VS_GUI_Save(AG_Event *event)
 		VS_GUI_SaveAsDlg(event);
 		return;
 	}
-	if (AG_ObjectSave(obj) == -1) {
+	if (SaveObject(obj, NULL) == -1) {
 		AG_TextError(_("Error saving object: %s"), AG_GetError());
 	} else {
 		AG_TextTmsg(AG_MSG_INFO, 1250, _("Saved %s successfully"),
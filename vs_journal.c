@@ -0,0 +1,825 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Journaled autosave. Edits to the clips (frame deletions, key mappings,
+ * recordings and loops) are logged as fixed-size records, which are only
+ * queued in memory by the editing thread. A writer thread appends them
+ * to a journal file next to the project file, and once the journal
+ * grows past VS_JOURNAL_COMPACT records while the project is idle, it
+ * compacts it by writing a full autosave snapshot. On open, a project is
+ * recovered from the autosave (if any) and the journal of later edits.
+ *
+ * Each snapshot bumps a generation number, which is saved in the snapshot
+ * and written in the header of the journal truncated after it. A journal
+ * whose generation does not match the snapshot (the snapshot was written
+ * but the journal not yet truncated) is already included in the snapshot,
+ * and is not replayed.
+ *
+ * Lock order: fileLock, project, output clip, input clip, lock.
+ */
+
+#include <vislak.h>
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+static void
+JournalPath(const char *path, char *buf, size_t len)
+{
+	Strlcpy(buf, path, len);
+	Strlcat(buf, ".jnl", len);
+}
+
+/* Return the path of the autosave snapshot of a project file. */
+const char *
+VS_JournalAutosavePath(const char *path, char *buf, size_t len)
+{
+	Strlcpy(buf, path, len);
+	Strlcat(buf, ".autosave", len);
+	return (buf);
+}
+
+void
+VS_JournalInit(VS_Journal *j)
+{
+	AG_MutexInit(&j->lock);
+	AG_CondInit(&j->cond);
+	j->pend = NULL;
+	j->nPend = 0;
+	j->maxPend = 0;
+	j->dirty = 0;
+	j->replaying = 0;
+	j->exit = 0;
+	j->writer = 0;
+	AG_MutexInit(&j->fileLock);
+	j->path = NULL;
+	j->fd = -1;
+	j->nFile = 0;
+	j->gen = 0;
+}
+
+void
+VS_JournalDestroy(VS_Journal *j)
+{
+	if (j->fd != -1) {
+		close(j->fd);
+	}
+	Free(j->pend);
+	Free(j->path);
+	AG_MutexDestroy(&j->fileLock);
+	AG_CondDestroy(&j->cond);
+	AG_MutexDestroy(&j->lock);
+}
+
+/*
+ * Decode a journal header (hdr holds the first n bytes of the file).
+ * Returns the header size, or -1 if it is not a journal header. Version 1
+ * headers have no generation (which is then 0).
+ */
+static int
+ParseHeader(const Uint32 *hdr, size_t n, Uint32 *gen)
+{
+	if (n < 2*sizeof(Uint32) ||
+	    AG_SwapLE32(hdr[0]) != VS_JOURNAL_MAGIC) {
+		return (-1);
+	}
+	switch (AG_SwapLE32(hdr[1])) {
+	case 1:
+		*gen = 0;
+		return (2*sizeof(Uint32));
+	case 2:
+		if (n < 3*sizeof(Uint32)) {
+			return (-1);
+		}
+		*gen = AG_SwapLE32(hdr[2]);
+		return (3*sizeof(Uint32));
+	default:
+		return (-1);
+	}
+}
+
+/*
+ * Open the journal file of j->path for appending. Unless trunc is set,
+ * the existing records are kept (minus any torn record at the end), if
+ * the journal belongs to the current snapshot generation.
+ * fileLock must be held.
+ */
+static int
+OpenFile(VS_Journal *j, int trunc)
+{
+	char path[AG_PATHNAME_MAX];
+	Uint32 hdr[3], gen;
+	ssize_t nHdr;
+	off_t len;
+	int hdrLen = -1;
+
+	JournalPath(j->path, path, sizeof(path));
+	if ((j->fd = open(path, O_RDWR|O_CREAT, 0644)) == -1) {
+		AG_SetError("%s: %s", path, AG_Strerror(errno));
+		return (-1);
+	}
+	if (!trunc) {
+		if ((nHdr = pread(j->fd, hdr, sizeof(hdr), 0)) == -1) {
+			goto fail;
+		}
+		if ((hdrLen = ParseHeader(hdr, (size_t)nHdr, &gen)) == -1 ||
+		    gen != j->gen)
+			trunc = 1;
+	}
+	if ((len = lseek(j->fd, 0, SEEK_END)) == -1) {
+		goto fail;
+	}
+	if (trunc) {
+		hdr[0] = AG_SwapLE32(VS_JOURNAL_MAGIC);
+		hdr[1] = AG_SwapLE32(VS_JOURNAL_VERSION);
+		hdr[2] = AG_SwapLE32(j->gen);
+		if (ftruncate(j->fd, 0) == -1 ||
+		    lseek(j->fd, 0, SEEK_SET) == -1 ||
+		    write(j->fd, hdr, sizeof(hdr)) != sizeof(hdr)) {
+			goto fail;
+		}
+		(void)fsync(j->fd);
+		j->nFile = 0;
+	} else {
+		j->nFile = (len - hdrLen) / sizeof(VS_JournalRec);
+		len = hdrLen + j->nFile*sizeof(VS_JournalRec);
+		if (ftruncate(j->fd, len) == -1 ||
+		    lseek(j->fd, len, SEEK_SET) == -1)
+			goto fail;
+	}
+	return (0);
+fail:
+	AG_SetError("%s: %s", path, AG_Strerror(errno));
+	close(j->fd);
+	j->fd = -1;
+	return (-1);
+}
+
+/* Write len bytes to fd, retrying short writes. */
+static int
+WriteAll(int fd, const void *data, size_t len)
+{
+	const char *p;
+	ssize_t rv;
+
+	for (p = data; len > 0; p += rv, len -= rv) {
+		if ((rv = write(fd, p, len)) == -1) {
+			if (errno == EINTR) {
+				rv = 0;
+				continue;
+			}
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Append records to the journal file and free them. fileLock must be
+ * held.
+ */
+static int
+AppendRecs(VS_Journal *j, VS_JournalRec *recs, Uint n)
+{
+	if (n == 0 || j->fd == -1) {
+		Free(recs);
+		return (0);
+	}
+	if (WriteAll(j->fd, recs, n*sizeof(VS_JournalRec)) == -1) {
+		AG_SetError("Journal: %s", AG_Strerror(errno));
+		Free(recs);
+		return (-1);
+	}
+	(void)fsync(j->fd);
+	j->nFile += n;
+	Free(recs);
+	return (0);
+}
+
+/* Append the pending records to the journal file. fileLock must be held. */
+static int
+Flush(VS_Journal *j)
+{
+	VS_JournalRec *recs;
+	Uint n;
+
+	AG_MutexLock(&j->lock);
+	recs = j->pend;
+	n = j->nPend;
+	j->pend = NULL;
+	j->nPend = 0;
+	j->maxPend = 0;
+	AG_MutexUnlock(&j->lock);
+
+	return AppendRecs(j, recs, n);
+}
+
+/*
+ * Writer thread. Batches the queued records every VS_JOURNAL_DELAY ms
+ * and compacts the journal when it is large and the project is idle.
+ */
+static void *
+WriterThread(void *pProj)
+{
+	VS_Project *vsp = pProj;
+	VS_Journal *j = &vsp->journal;
+	int compact, idle;
+
+	for (;;) {
+		AG_MutexLock(&j->lock);
+		while (j->nPend == 0 && !j->exit) {
+			AG_CondWait(&j->cond, &j->lock);
+		}
+		if (j->exit) {
+			AG_MutexUnlock(&j->lock);
+			break;
+		}
+		AG_MutexUnlock(&j->lock);
+
+		AG_Delay(VS_JOURNAL_DELAY);
+
+		AG_MutexLock(&j->fileLock);
+		if (Flush(j) == -1) {
+			Verbose("%s\n", AG_GetError());
+		}
+		compact = (j->nFile >= VS_JOURNAL_COMPACT);
+		AG_MutexUnlock(&j->fileLock);
+
+		if (compact) {
+			AG_ObjectLock(vsp);
+			idle = !(vsp->flags & (VS_PROJECT_PLAYING|
+			                       VS_PROJECT_RECORDING));
+			AG_ObjectUnlock(vsp);
+			if (idle && VS_JournalCheckpoint(vsp, NULL) == -1)
+				Verbose("Autosave: %s\n", AG_GetError());
+		}
+	}
+	AG_ThreadExit(NULL);
+}
+
+static void
+StartWriter(VS_Project *vsp)
+{
+	VS_Journal *j = &vsp->journal;
+
+	if (!j->writer) {
+		j->exit = 0;
+		AG_ThreadCreate(&j->th, WriterThread, vsp);
+		j->writer = 1;
+	}
+}
+
+/*
+ * Start journaling the edits of a project opened from path, appending
+ * to its existing journal (which must have been replayed).
+ */
+int
+VS_JournalOpen(VS_Project *vsp, const char *path)
+{
+	VS_Journal *j = &vsp->journal;
+	int rv;
+
+	VS_JournalClose(vsp);
+
+	AG_MutexLock(&j->fileLock);
+	AG_MutexLock(&j->lock);
+	j->path = Strdup(path);
+	AG_MutexUnlock(&j->lock);
+	if ((rv = OpenFile(j, 0)) == 0) {
+		StartWriter(vsp);
+	}
+	AG_MutexUnlock(&j->fileLock);
+	return (rv);
+}
+
+/* Write out the pending records and stop journaling. */
+void
+VS_JournalClose(VS_Project *vsp)
+{
+	VS_Journal *j = &vsp->journal;
+
+	if (j->writer) {
+		AG_MutexLock(&j->lock);
+		j->exit = 1;
+		AG_CondSignal(&j->cond);
+		AG_MutexUnlock(&j->lock);
+		AG_ThreadJoin(j->th, NULL);
+		j->writer = 0;
+	}
+	AG_MutexLock(&j->fileLock);
+	if (Flush(j) == -1) {
+		Verbose("%s\n", AG_GetError());
+	}
+	if (j->fd != -1) {
+		close(j->fd);
+		j->fd = -1;
+	}
+	AG_MutexLock(&j->lock);
+	Free(j->path);
+	j->path = NULL;
+	AG_MutexUnlock(&j->lock);
+	AG_MutexUnlock(&j->fileLock);
+}
+
+static void
+RemoveFiles(const char *path)
+{
+	char buf[AG_PATHNAME_MAX];
+
+	JournalPath(path, buf, sizeof(buf));
+	(void)unlink(buf);
+	VS_JournalAutosavePath(path, buf, sizeof(buf));
+	(void)unlink(buf);
+}
+
+/* Stop journaling and delete the journal and autosave (unsaved edits). */
+void
+VS_JournalDiscard(VS_Project *vsp)
+{
+	char path[AG_PATHNAME_MAX];
+
+	if (vsp->journal.path == NULL) {
+		return;
+	}
+	Strlcpy(path, vsp->journal.path, sizeof(path));
+	VS_JournalClose(vsp);
+	RemoveFiles(path);
+}
+
+/* Write a serialized snapshot to a file. */
+static int
+WriteSnapshot(const char *path, const Uint8 *data, size_t len)
+{
+	int fd;
+
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1) {
+		goto fail;
+	}
+	if (WriteAll(fd, data, len) == -1 || fsync(fd) == -1) {
+		AG_SetError("%s: %s", path, AG_Strerror(errno));
+		close(fd);
+		return (-1);
+	}
+	if (close(fd) == -1) {
+		goto fail;
+	}
+	return (0);
+fail:
+	AG_SetError("%s: %s", path, AG_Strerror(errno));
+	return (-1);
+}
+
+/*
+ * Save a full snapshot of the project and truncate the journal. With a
+ * NULL path, the snapshot is the autosave next to the project file (this
+ * compacts the journal). Otherwise the project is saved to path, which
+ * becomes the journaled file, and its autosave is removed.
+ */
+int
+VS_JournalCheckpoint(VS_Project *vsp, const char *path)
+{
+	VS_Journal *j = &vsp->journal;
+	char dst[AG_PATHNAME_MAX], tmp[AG_PATHNAME_MAX];
+	AG_DataSource *ds;
+	AG_CoreSource *cs;
+	VS_JournalRec *recs;
+	Uint32 genPrev = j->gen;
+	Uint nRecs, dirty;
+	int rv = -1;
+
+	AG_MutexLock(&j->fileLock);
+	if (path == NULL) {
+		if (j->path == NULL) {			/* Never saved */
+			AG_MutexUnlock(&j->fileLock);
+			return (0);
+		}
+		VS_JournalAutosavePath(j->path, dst, sizeof(dst));
+		Strlcpy(tmp, dst, sizeof(tmp));
+		Strlcat(tmp, ".tmp", sizeof(tmp));
+	} else {
+		Strlcpy(dst, path, sizeof(dst));
+	}
+	if ((ds = AG_OpenAutoCore()) == NULL) {
+		AG_MutexUnlock(&j->fileLock);
+		return (-1);
+	}
+
+	/*
+	 * Serialize the project in memory, blocking edits (and the frame
+	 * clock) only for that long. The snapshot gets a new generation, so
+	 * the current journal is no longer replayed over it even if we crash
+	 * before truncating the journal. The records pending at this point
+	 * are included in the snapshot; they are set aside, and appended to
+	 * the journal only if the snapshot cannot be written.
+	 */
+	AG_ObjectLock(vsp);
+	AG_MutexLock(&vsp->output->lock);
+	AG_MutexLock(&vsp->input->lock);
+	j->gen++;
+	if (AG_ObjectSerialize(vsp, ds) == -1) {
+		j->gen = genPrev;
+		AG_MutexUnlock(&vsp->input->lock);
+		AG_MutexUnlock(&vsp->output->lock);
+		AG_ObjectUnlock(vsp);
+		AG_CloseAutoCore(ds);
+		AG_MutexUnlock(&j->fileLock);
+		return (-1);
+	}
+	AG_MutexLock(&j->lock);
+	recs = j->pend;
+	nRecs = j->nPend;
+	j->pend = NULL;
+	j->nPend = 0;
+	j->maxPend = 0;
+	dirty = j->dirty;
+	if (path != NULL) {
+		j->dirty = 0;
+	}
+	AG_MutexUnlock(&j->lock);
+	AG_MutexUnlock(&vsp->input->lock);
+	AG_MutexUnlock(&vsp->output->lock);
+	AG_ObjectUnlock(vsp);
+
+	/* Write the snapshot with only the journal files locked. */
+	cs = AG_CORE_SOURCE(ds);
+	if (path == NULL) {
+		if (WriteSnapshot(tmp, cs->data, cs->size) == -1) {
+			goto fail;
+		}
+		if (rename(tmp, dst) == -1) {
+			AG_SetError("%s: %s", dst, AG_Strerror(errno));
+			goto fail;
+		}
+	} else {
+		if (WriteSnapshot(dst, cs->data, cs->size) == -1)
+			goto fail;
+	}
+	AG_CloseAutoCore(ds);
+	Free(recs);
+	if (j->fd != -1) {
+		close(j->fd);
+		j->fd = -1;
+	}
+
+	if (path != NULL) {
+		if (j->path != NULL && strcmp(j->path, dst) != 0) {
+			RemoveFiles(j->path);		/* Saved as */
+		}
+		AG_MutexLock(&j->lock);
+		Free(j->path);
+		j->path = Strdup(dst);
+		AG_MutexUnlock(&j->lock);
+		VS_JournalAutosavePath(dst, tmp, sizeof(tmp));
+		(void)unlink(tmp);
+		if ((rv = OpenFile(j, 1)) == 0)
+			StartWriter(vsp);
+	} else {
+		if ((rv = OpenFile(j, 1)) == -1) {
+			Verbose("%s\n", AG_GetError());
+		}
+	}
+	AG_MutexUnlock(&j->fileLock);
+	return (rv);
+fail:
+	AG_CloseAutoCore(ds);
+	j->gen = genPrev;			/* Journal still applies */
+	if (path != NULL) {
+		AG_MutexLock(&j->lock);
+		j->dirty += dirty;
+		AG_MutexUnlock(&j->lock);
+	}
+	if (AppendRecs(j, recs, nRecs) == -1) {
+		Verbose("%s\n", AG_GetError());
+	}
+	AG_MutexUnlock(&j->fileLock);
+	return (-1);
+}
+
+/*
+ * Remove the pending MIDI keymap records of a clip, which a CLEARMIDI
+ * record supersedes. This keeps the remappings made continuously from a
+ * MIDI controller (see RepartitionMIDI()) from flooding the journal:
+ * only the last keymap of each append interval is written.
+ */
+static void
+DropMidiRecords(VS_Journal *j, Uint8 clip)
+{
+	Uint i, w;
+
+	for (i = 0, w = 0; i < j->nPend; i++) {
+		const VS_JournalRec *rec = &j->pend[i];
+
+		if (rec->clip == clip &&
+		    (rec->op == VS_JOURNAL_MIDIKEY ||
+		     rec->op == VS_JOURNAL_MIDIDEL ||
+		     rec->op == VS_JOURNAL_CLEARMIDI)) {
+			continue;
+		}
+		if (w != i) {
+			j->pend[w] = *rec;
+		}
+		w++;
+	}
+	j->nPend = w;
+}
+
+/*
+ * Queue an edit record for the journal, and count it as an unsaved
+ * change. This only touches memory, so it is safe to call from the
+ * frame clock. The clip is locked while the record is queued so that a
+ * snapshot cannot separate an edit from its record.
+ */
+void
+VS_JournalLog(VS_Clip *v, enum vs_journal_op op, Uint a, Uint b, int c)
+{
+	VS_Journal *j = &v->proj->journal;
+	VS_JournalRec *rec, *pendNew;
+	Uint8 clip = (v == v->proj->output) ? 1 : 0;
+	Uint maxNew;
+
+	AG_MutexLock(&v->lock);
+	AG_MutexLock(&j->lock);
+	if (j->replaying) {
+		goto out;
+	}
+	j->dirty++;
+	if (j->path == NULL) {			/* Saved by the first save */
+		goto out;
+	}
+	if (op == VS_JOURNAL_CLEARMIDI) {
+		DropMidiRecords(j, clip);
+	}
+	if (j->nPend+1 > j->maxPend) {
+		maxNew = (j->maxPend > 0) ? j->maxPend*2 : 64;
+		if ((pendNew = TryRealloc(j->pend,
+		    maxNew*sizeof(VS_JournalRec))) == NULL) {
+			Verbose("Journal record lost\n");
+			goto out;
+		}
+		j->pend = pendNew;
+		j->maxPend = maxNew;
+	}
+	rec = &j->pend[j->nPend++];
+	rec->op = (Uint8)op;
+	rec->clip = clip;
+	rec->pad = 0;
+	rec->a = AG_SwapLE32(a);
+	rec->b = AG_SwapLE32(b);
+	rec->c = (Sint32)AG_SwapLE32((Uint32)c);
+	if (j->nPend == 1)
+		AG_CondSignal(&j->cond);
+out:
+	AG_MutexUnlock(&j->lock);
+	AG_MutexUnlock(&v->lock);
+}
+
+/* Log the whole MIDI keymap of a clip (after a bulk remapping). */
+void
+VS_JournalLogMidiKeymap(VS_Clip *v)
+{
+	Uint key;
+	int f;
+
+	if (v->midi == NULL) {
+		return;
+	}
+	AG_MutexLock(&v->lock);
+	VS_JournalLog(v, VS_JOURNAL_CLEARMIDI, 0, 0, 0);
+	for (key = 0; key < VS_MIDI_MAXKEYS; key++) {
+		if ((f = v->midi->keymap[key]) >= 0 && (Uint)f < v->n)
+			VS_JournalLog(v, VS_JOURNAL_MIDIKEY, f, 0, key);
+	}
+	AG_MutexUnlock(&v->lock);
+}
+
+/*
+ * Frames mapped to each MIDI key of a clip during a replay, so that a
+ * MIDIKEY record does not have to scan the clip for the previous mapping
+ * of its key. Deletions renumber the frames and invalidate the index.
+ */
+typedef struct vs_journal_midi_index {
+	int valid;
+	int frame[VS_MIDI_MAXKEYS];	/* Frame (-1 = none, -2 = several) */
+} VS_JournalMidiIndex;
+
+static void
+IndexMidiKeys(VS_Clip *v, VS_JournalMidiIndex *mi)
+{
+	Uint i;
+	int key;
+
+	for (key = 0; key < VS_MIDI_MAXKEYS; key++) {
+		mi->frame[key] = -1;
+	}
+	for (i = 0; i < v->n; i++) {
+		if ((key = v->frames[i].midiKey) < 0) {
+			continue;
+		}
+		mi->frame[key] = (mi->frame[key] == -1) ? (int)i : -2;
+	}
+	mi->valid = 1;
+}
+
+/*
+ * Remove the mappings of a MIDI key. The keymap of a clip without a view
+ * is rebuilt from the frame table, so stale keys are cleared as well.
+ */
+static void
+UnmapMidiKey(VS_Clip *v, VS_JournalMidiIndex *mi, int key)
+{
+	Uint i;
+
+	if (!mi->valid) {
+		IndexMidiKeys(v, mi);
+	}
+	if (mi->frame[key] == -2) {
+		for (i = 0; i < v->n; i++) {
+			if (v->frames[i].midiKey == key)
+				v->frames[i].midiKey = -1;
+		}
+	} else if (mi->frame[key] >= 0 &&
+	           v->frames[mi->frame[key]].midiKey == key) {
+		v->frames[mi->frame[key]].midiKey = -1;	/* Not remapped */
+	}
+	mi->frame[key] = -1;
+	if (v->midi != NULL)
+		v->midi->keymap[key] = -1;
+}
+
+/* Apply an edit record read from a journal. */
+static void
+Apply(VS_Project *vsp, const VS_JournalRec *rec, VS_JournalMidiIndex *index)
+{
+	VS_Clip *v = (rec->clip == 0) ? vsp->input : vsp->output;
+	VS_JournalMidiIndex *mi = &index[rec->clip == 0 ? 0 : 1];
+	Uint a = AG_SwapLE32(rec->a);
+	Uint b = AG_SwapLE32(rec->b);
+	int c = (Sint32)AG_SwapLE32((Uint32)rec->c);
+	Uint i;
+
+	AG_MutexLock(&v->lock);
+	switch (rec->op) {
+	case VS_JOURNAL_DELETE:
+		if (a < b && b <= v->n) {
+			(void)VS_ClipDelFrames(v, a, b);
+			mi->valid = 0;
+		}
+		break;
+	case VS_JOURNAL_KBDKEY:
+		if (a < v->n && c >= 0 && c < AG_KEY_LAST) {
+			v->kbdKeymap[c] = a;
+			v->frames[a].kbdKey = c;
+		}
+		break;
+	case VS_JOURNAL_MIDIKEY:
+		if (a < v->n && c >= 0 && c < VS_MIDI_MAXKEYS) {
+			UnmapMidiKey(v, mi, c);
+			v->frames[a].midiKey = c;
+			mi->frame[c] = a;
+			if (v->midi != NULL)
+				v->midi->keymap[c] = a;
+		}
+		break;
+	case VS_JOURNAL_MIDIDEL:
+		if (c >= 0 && c < VS_MIDI_MAXKEYS) {
+			UnmapMidiKey(v, mi, c);
+		}
+		break;
+	case VS_JOURNAL_CLEARKBD:
+		(void)VS_ClipClearKeys(v);
+		break;
+	case VS_JOURNAL_CLEARMIDI:
+		for (i = 0; i < v->n; i++) {
+			v->frames[i].midiKey = -1;
+		}
+		for (i = 0; v->midi != NULL && i < VS_MIDI_MAXKEYS; i++) {
+			v->midi->keymap[i] = -1;
+		}
+		for (i = 0; i < VS_MIDI_MAXKEYS; i++) {
+			mi->frame[i] = -1;
+		}
+		mi->valid = 1;
+		break;
+	case VS_JOURNAL_RECORD:
+		for (i = 0; i < b; i++) {
+			int f = (int)a + c*(int)i;
+
+			if (f < 0 || (Uint)f >= vsp->input->n ||
+			    VS_ClipRecordFrame(v, vsp->input, (Uint)f) == -1)
+				break;
+		}
+		(void)VS_ClipCommitEdits(v);
+		break;
+	case VS_JOURNAL_LOOP:
+		(void)VS_ClipAddLoop(v, a, b);
+		break;
+	case VS_JOURNAL_CLEARLOOPS:
+		VS_ClipClearLoops(v);
+		break;
+	default:
+		break;
+	}
+	VS_ClipCuesChanged(v);
+	AG_MutexUnlock(&v->lock);
+}
+
+/*
+ * Apply the journal of the project file path to the loaded project.
+ * Returns the number of records replayed, or -1 on failure. A torn
+ * record at the end (from a crash during an append) is ignored.
+ */
+int
+VS_JournalReplay(VS_Project *vsp, const char *path)
+{
+	VS_Journal *j = &vsp->journal;
+	char jPath[AG_PATHNAME_MAX];
+	VS_JournalRec rec;
+	VS_JournalMidiIndex index[2];
+	Uint32 hdr[3], gen;
+	size_t nHdr;
+	FILE *f;
+	int n = 0, hdrLen;
+
+	JournalPath(path, jPath, sizeof(jPath));
+	if ((f = fopen(jPath, "rb")) == NULL) {
+		if (errno == ENOENT) {
+			return (0);
+		}
+		AG_SetError("%s: %s", jPath, AG_Strerror(errno));
+		return (-1);
+	}
+	if ((nHdr = fread(hdr, 1, sizeof(hdr), f)) < 2*sizeof(Uint32)) {
+		fclose(f);
+		return (0);				/* Empty */
+	}
+	if ((hdrLen = ParseHeader(hdr, nHdr, &gen)) == -1) {
+		AG_SetError(_("%s: Not a Vislak journal"), jPath);
+		fclose(f);
+		return (-1);
+	}
+	if (gen != j->gen) {
+		Verbose("%s: Journal predates the snapshot; ignored\n",
+		    AG_ShortFilename(jPath));
+		fclose(f);
+		return (0);
+	}
+	if (fseek(f, hdrLen, SEEK_SET) == -1) {
+		AG_SetError("%s: %s", jPath, AG_Strerror(errno));
+		fclose(f);
+		return (-1);
+	}
+	AG_MutexLock(&j->lock);
+	j->replaying = 1;
+	AG_MutexUnlock(&j->lock);
+
+	index[0].valid = 0;
+	index[1].valid = 0;
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		Apply(vsp, &rec, index);
+		n++;
+	}
+
+	AG_MutexLock(&j->lock);
+	j->replaying = 0;
+	AG_MutexUnlock(&j->lock);
+	fclose(f);
+	return (n);
+}
+
+/* Count an edit which is not journaled (see VS_JournalCheckpoint()). */
+void
+VS_JournalTouch(VS_Project *vsp)
+{
+	VS_Journal *j = &vsp->journal;
+
+	AG_MutexLock(&j->lock);
+	j->dirty++;
+	AG_MutexUnlock(&j->lock);
+}
@@ -0,0 +1,67 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_JOURNAL_H_
+#define _VISLAK_JOURNAL_H_
+
+struct vs_clip;
+struct vs_project;
+
+#define VS_JOURNAL_MAGIC	0x56534a4e	/* "VSJN" */
+#define VS_JOURNAL_VERSION	2
+#define VS_JOURNAL_DELAY	250		/* Append interval (ms) */
+#define VS_JOURNAL_COMPACT	65536		/* Records before compaction */
+
+enum vs_journal_op {
+	VS_JOURNAL_DELETE,		/* Delete frames [a,b) */
+	VS_JOURNAL_KBDKEY,		/* Map keyboard key c to frame a */
+	VS_JOURNAL_MIDIKEY,		/* Map MIDI key c to frame a */
+	VS_JOURNAL_MIDIDEL,		/* Unmap MIDI key c */
+	VS_JOURNAL_CLEARKBD,		/* Clear the keyboard keymap */
+	VS_JOURNAL_CLEARMIDI,		/* Clear the MIDI keymap */
+	VS_JOURNAL_RECORD,		/* Record b input frames from a, step c */
+	VS_JOURNAL_LOOP,		/* Add loop region [a,b) */
+	VS_JOURNAL_CLEARLOOPS,		/* Clear loop regions */
+	VS_JOURNAL_LAST
+};
+
+/* Edit record (packed little-endian in the journal file). */
+typedef struct vs_journal_rec {
+	Uint8 op;			/* enum vs_journal_op */
+	Uint8 clip;			/* 0 = input, 1 = output */
+	Uint16 pad;
+	Uint32 a, b;
+	Sint32 c;
+} VS_JournalRec;
+
+typedef struct vs_journal {
+	AG_Mutex lock;			/* Lock on pending records */
+	AG_Cond cond;			/* Records pending (or exit) */
+	VS_JournalRec *pend;		/* Records not yet appended */
+	Uint nPend, maxPend;
+	Uint dirty;			/* Edits since the last save */
+	int replaying;			/* Replay in progress */
+	int exit;			/* Writer thread must exit */
+	int writer;			/* Writer thread is running */
+	AG_Mutex fileLock;		/* Lock on journal and snapshots */
+	char *path;			/* Project file (NULL = no journal) */
+	int fd;				/* Journal file (or -1) */
+	Uint nFile;			/* Records in journal file */
+	Uint32 gen;			/* Snapshot generation */
+	AG_Thread th;			/* Writer thread */
+} VS_Journal;
+
+__BEGIN_DECLS
+void VS_JournalInit(VS_Journal *);
+void VS_JournalDestroy(VS_Journal *);
+int  VS_JournalOpen(struct vs_project *, const char *);
+void VS_JournalClose(struct vs_project *);
+void VS_JournalDiscard(struct vs_project *);
+int  VS_JournalReplay(struct vs_project *, const char *);
+int  VS_JournalCheckpoint(struct vs_project *, const char *);
+void VS_JournalTouch(struct vs_project *);
+void VS_JournalLog(struct vs_clip *, enum vs_journal_op, Uint, Uint, int);
+void VS_JournalLogMidiKeymap(struct vs_clip *);
+const char *VS_JournalAutosavePath(const char *, char *, size_t);
+__END_DECLS
+
+#endif /* _VISLAK_JOURNAL_H_ */
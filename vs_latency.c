@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Trigger-to-display latency statistics. Triggers are stamped with
+ * VS_ClockNow() where they enter the program (the MIDI I/O thread, or
+ * the view's key handler), the stamp follows the playhead change in
+ * the clip, and the player records the elapsed time when it blits the
+ * first frame after that change.
+ */
+
+#include <vislak.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+const char *vsTriggerNames[] = {
+	"midi",
+	"kbd"
+};
+
+void
+VS_LatencyInit(VS_Latency *lat)
+{
+	AG_MutexInit(&lat->lock);
+	VS_LatencyReset(lat);
+}
+
+void
+VS_LatencyDestroy(VS_Latency *lat)
+{
+	AG_MutexDestroy(&lat->lock);
+}
+
+void
+VS_LatencyReset(VS_Latency *lat)
+{
+	AG_MutexLock(&lat->lock);
+	lat->n = 0;
+	lat->sum = 0;
+	lat->last = 0;
+	lat->min = 0;
+	lat->max = 0;
+	lat->p50 = 0;
+	lat->p95 = 0;
+	lat->p99 = 0;
+	memset(lat->hist, 0, sizeof(lat->hist));
+	AG_MutexUnlock(&lat->lock);
+}
+
+/* Return the pct'th percentile (us). Lock must be held. */
+static int
+Percentile(const VS_Latency *lat, int pct)
+{
+	Uint64 rank, cum = 0;
+	int i;
+
+	if (lat->n == 0) {
+		return (0);
+	}
+	rank = ((Uint64)lat->n*pct + 99)/100;
+	for (i = 0; i < VS_LATENCY_NBUCKETS-1; i++) {
+		if ((cum += lat->hist[i]) >= rank)
+			return ((i+1)*VS_LATENCY_BUCKET);
+	}
+	return (lat->max);
+}
+
+/* Record a latency sample (ns). */
+void
+VS_LatencyAdd(VS_Latency *lat, Uint64 ns)
+{
+	int us = (ns/1000 > 0x7fffffff) ? 0x7fffffff : (int)(ns/1000);
+	int b = us/VS_LATENCY_BUCKET;
+
+	AG_MutexLock(&lat->lock);
+	if (lat->n == 0 || us < lat->min) { lat->min = us; }
+	if (lat->n == 0 || us > lat->max) { lat->max = us; }
+	lat->n++;
+	lat->sum += us;
+	lat->last = us;
+	lat->hist[b < VS_LATENCY_NBUCKETS ? b : VS_LATENCY_NBUCKETS-1]++;
+	lat->p50 = Percentile(lat, 50);
+	lat->p95 = Percentile(lat, 95);
+	lat->p99 = Percentile(lat, 99);
+	AG_MutexUnlock(&lat->lock);
+}
+
+int
+VS_LatencyPercentile(VS_Latency *lat, int pct)
+{
+	int rv;
+
+	AG_MutexLock(&lat->lock);
+	rv = Percentile(lat, pct);
+	AG_MutexUnlock(&lat->lock);
+	return (rv);
+}
+
+/*
+ * Write the statistics and non-empty histogram buckets of nLat
+ * distributions (one per trigger source) to a text file.
+ */
+int
+VS_LatencySave(VS_Latency *lats, int nLat, const char *path)
+{
+	FILE *f;
+	int i, b;
+
+	if ((f = fopen(path, "w")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	fprintf(f, "# Vislak trigger-to-display latency (us)\n");
+	fprintf(f, "# source n min p50 p95 p99 max mean\n");
+	for (i = 0; i < nLat; i++) {
+		VS_Latency *lat = &lats[i];
+
+		AG_MutexLock(&lat->lock);
+		fprintf(f, "%s %u %d %d %d %d %d %d\n", vsTriggerNames[i],
+		    lat->n, lat->min, lat->p50, lat->p95, lat->p99, lat->max,
+		    lat->n > 0 ? (int)(lat->sum/lat->n) : 0);
+		AG_MutexUnlock(&lat->lock);
+	}
+	fprintf(f, "# source bucket_start bucket_end count\n");
+	for (i = 0; i < nLat; i++) {
+		VS_Latency *lat = &lats[i];
+
+		AG_MutexLock(&lat->lock);
+		for (b = 0; b < VS_LATENCY_NBUCKETS; b++) {
+			if (lat->hist[b] == 0) {
+				continue;
+			}
+			fprintf(f, "%s %d %d %u\n", vsTriggerNames[i],
+			    b*VS_LATENCY_BUCKET,
+			    (b < VS_LATENCY_NBUCKETS-1) ?
+			    (b+1)*VS_LATENCY_BUCKET : -1,
+			    lat->hist[b]);
+		}
+		AG_MutexUnlock(&lat->lock);
+	}
+	if (fclose(f) != 0) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
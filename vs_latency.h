@@ -0,0 +1,41 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_LATENCY_H_
+#define _VISLAK_LATENCY_H_
+
+/*
+ * Distribution of trigger-to-display latencies: the time from a MIDI
+ * note or key press arriving until the first frame blitted after the
+ * playhead moved in response to it.
+ */
+enum vs_trigger_src {
+	VS_TRIGGER_MIDI,		/* MIDI note */
+	VS_TRIGGER_KBD,			/* Keyboard key */
+	VS_TRIGGER_LAST
+};
+
+#define VS_LATENCY_BUCKET	100	/* Histogram bucket width (us) */
+#define VS_LATENCY_NBUCKETS	500	/* Buckets (last one is overflow) */
+
+typedef struct vs_latency {
+	AG_Mutex lock;
+	Uint n;				/* Samples recorded */
+	Uint64 sum;			/* Sum of samples (us) */
+	int last;			/* Last sample (us) */
+	int min, max;			/* Extrema (us) */
+	int p50, p95, p99;		/* Percentiles (us, bucket upper edge) */
+	Uint hist[VS_LATENCY_NBUCKETS];
+} VS_Latency;
+
+__BEGIN_DECLS
+extern const char *vsTriggerNames[];
+
+void VS_LatencyInit(VS_Latency *);
+void VS_LatencyDestroy(VS_Latency *);
+void VS_LatencyReset(VS_Latency *);
+void VS_LatencyAdd(VS_Latency *, Uint64);
+int  VS_LatencyPercentile(VS_Latency *, int);
+int  VS_LatencySave(VS_Latency *, int, const char *);
+__END_DECLS
+
+#endif /* _VISLAK_LATENCY_H_ */
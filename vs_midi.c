@@ -30,22 +30,74 @@
 #include <vislak.h>
 #include "icons.h"
 
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
 #include <config/have_alsa.h>
 #ifdef HAVE_ALSA
 # include <alsa/asoundlib.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <unistd.h>
+#endif
+
+#define VS_MIDI_MAXOUTS 8		/* Output devices per clip */
+
+#ifdef HAVE_ALSA
+/* Input device serviced by the I/O thread. */
+typedef struct vs_midi_dev {
+	enum vs_midi_dev_type {
+		VS_MIDI_DEV_RAW,	/* Raw MIDI port */
+		VS_MIDI_DEV_SEQ,	/* Our sequencer client */
+		VS_MIDI_DEV_SRC		/* Sequencer port subscribed to */
+	} type;
+	char name[32];
+	VS_Midi *mid;			/* Clip receiving the events */
+	int closing;			/* Release at next poll set rebuild */
+	snd_rawmidi_t *in;		/* Raw MIDI handle */
+	snd_seq_t *seq;			/* Sequencer handle */
+	int seqPort;			/* Our sequencer port */
+	int seqQueue;			/* Timestamping queue */
+	Uint64 seqT0;			/* VS_ClockNow() at queue time 0 */
+	int client, port;		/* Subscribed sequencer address */
+	VS_MidiParser parser;		/* Input stream parser */
+	Uint8 noteMap[128];		/* Note number mapping */
+	Uint8 ctlMap[128];		/* Controller number mapping */
+	int transpose;			/* Transposition of noteMap */
+	TAILQ_ENTRY(vs_midi_dev) devs;
+} VS_MidiDev;
 #endif
 
 typedef struct vs_midi_pvt {
 #ifdef HAVE_ALSA
-	snd_rawmidi_t *in;
-	snd_rawmidi_t *out;
+	snd_rawmidi_t *out[VS_MIDI_MAXOUTS];	/* Output devices */
+	char outName[VS_MIDI_MAXOUTS][16];
+	int nOut;
+	AG_Mutex outLock;		/* Lock on output devices */
+	AG_Thread thOut;		/* Clock and feedback engine */
+	int outThread;			/* Engine is running */
+	int outExit;			/* Engine should exit */
 #else
 	int in;
 	int out;
 #endif
+	AG_Thread thReplay;		/* File replay thread */
+	int replayThread;		/* Replay thread is running */
+	int replayExit;			/* Replay thread should exit */
+	VS_MidiEvent *replay;		/* Events to replay (t from start) */
+	Uint nReplay;
+	AG_Mutex recLock;		/* Lock on capture */
+	int recording;			/* Capturing processed input */
+	Uint64 recT0;			/* Start of capture */
+	VS_MidiEvent *rec;		/* Captured events */
+	Uint nRec, maxRec;
 } VS_MidiPvt;
 
-static AG_Thread thInput, thOutput;
+static void RecordEvent(VS_MidiPvt *, const VS_MidiEvent *);
+#ifdef HAVE_ALSA
+static void CloseInputs(VS_Midi *);
+#endif
 
 VS_Midi *
 VS_MidiNew(VS_View *vv)
@@ -57,199 +109,1705 @@ VS_MidiNew(VS_View *vv)
 	mid->vv = vv;
 	mid->pvt = Malloc(sizeof(VS_MidiPvt));
 #ifdef HAVE_ALSA
-	mid->pvt->in = NULL;
-	mid->pvt->out = NULL;
+	mid->pvt->nOut = 0;
+	AG_MutexInit(&mid->pvt->outLock);
+	mid->pvt->outThread = 0;
+	mid->pvt->outExit = 0;
 #else
 	mid->pvt->in = -1;
 	mid->pvt->out = -1;
 #endif
+	mid->pvt->replayThread = 0;
+	mid->pvt->replayExit = 0;
+	mid->pvt->replay = NULL;
+	mid->pvt->nReplay = 0;
+	AG_MutexInit(&mid->pvt->recLock);
+	mid->pvt->recording = 0;
+	mid->pvt->recT0 = 0;
+	mid->pvt->rec = NULL;
+	mid->pvt->nRec = 0;
+	mid->pvt->maxRec = 0;
 	for (i = 0; i < VS_MIDI_MAXKEYS; i++) {
 		mid->keymap[i] = -1;
 	}
-	return (mid);
+	if (vv->clip != NULL) {			/* Mappings of a loaded clip */
+		VS_Clip *v = vv->clip;
+
+		for (i = 0; i < v->n; i++) {
+			if (v->frames[i].midiKey != -1)
+				mid->keymap[v->frames[i].midiKey] = i;
+		}
+	}
+	mid->flags = 0;
+	AG_MutexInit(&mid->qLock);
+	mid->qHead = 0;
+	mid->qTail = 0;
+	mid->nDropped = 0;
+	mid->bend = 0.0;
+	memset(mid->ctl, 0, sizeof(mid->ctl));
+	for (i = 0; i < 16; i++) {
+		mid->ctl[i].nrpn = -1;
+	}
+	mid->smoothing = 0;
+	mid->scrubTarget = -1;
+	mid->scrubX = 0.0;
+	mid->repStart = 0;
+	mid->repSize = 0;
+	mid->clockBPM = 120;
+	mid->outChannel = 4;
+	mid->outPulse = 0;
+	mid->outRunning = 0;
+	mid->outKey = -1;
+	mid->replaySpeed = 1;
+	mid->replayLoop = 0;
+	return (mid);
+}
+
+void
+VS_MidiDestroy(VS_Midi *mid)
+{
+#ifdef HAVE_ALSA
+	VS_MidiPvt *pvt = mid->pvt;
+	int i;
+
+	CloseInputs(mid);
+	if (pvt->outThread) {
+		AG_MutexLock(&pvt->outLock);
+		pvt->outExit = 1;
+		AG_MutexUnlock(&pvt->outLock);
+		AG_ThreadJoin(pvt->thOut, NULL);
+	}
+	for (i = 0; i < pvt->nOut; i++) {
+		snd_rawmidi_drain(pvt->out[i]);
+		snd_rawmidi_close(pvt->out[i]);
+	}
+	AG_MutexDestroy(&pvt->outLock);
+#endif
+	VS_MidiReplayStop(mid);
+	Free(mid->pvt->rec);
+	AG_MutexDestroy(&mid->pvt->recLock);
+	AG_MutexDestroy(&mid->qLock);
+	Free(mid->pvt);
+	Free(mid);
+}
+
+/* Map a MIDI key to frame vf at clip position f */
+void
+VS_MidiAddKey(VS_Midi *mid, int key, VS_Frame *vf, Uint f)
+{
+	mid->keymap[key] = f;
+	vf->midiKey = key;
+	VS_JournalLog(mid->vv->clip, VS_JOURNAL_MIDIKEY, f, 0, key);
+	VS_ClipCuesChanged(mid->vv->clip);
+}
+
+/* Remove a MIDI key->frame mapping */
+void
+VS_MidiDelKey(VS_Midi *mid, int key)
+{
+	mid->keymap[key] = -1;
+	VS_JournalLog(mid->vv->clip, VS_JOURNAL_MIDIDEL, 0, 0, key);
+	VS_ClipCuesChanged(mid->vv->clip);
+}
+
+/* Clear MIDI keymap */
+Uint
+VS_MidiClearKeys(VS_Midi *mid)
+{
+	Uint i, nCleared = 0, f;
+	VS_Clip *v = mid->vv->clip;
+
+	for (i = 0; i < VS_MIDI_MAXKEYS; i++) {
+		if ((f = mid->keymap[i]) != -1) {
+			mid->keymap[i] = -1;
+			nCleared++;
+		}
+	}
+	for (i = 0; i < v->n; i++) {
+		v->frames[i].midiKey = -1;
+	}
+	VS_JournalLog(v, VS_JOURNAL_CLEARMIDI, 0, 0, 0);
+	VS_ClipCuesChanged(v);
+	return (nCleared);
+}
+
+static void
+RepartitionMIDI(VS_View *vv, int start, int end)
+{
+	VS_Clip *v = vv->clip;
+	VS_Midi *mid = v->midi;
+	Uint i, j, key;
+	Uint div, nMapped = 0;
+
+	div = (Uint)(end - start)/60;
+	key = 36;
+	for (i = start, j = 0;
+	     i < end;
+	     i++) {
+		v->frames[i].midiKey = key;
+		if (++j > div) {
+			j = 0;
+			key++;
+		}
+		mid->keymap[key] = i;
+		nMapped++;
+	}
+	VS_JournalLogMidiKeymap(v);
+	VS_ClipCuesChanged(v);
+	VS_Status(vv, _("Mapped %u MIDI keys (%d-%d)"),
+	    nMapped, start, end);
+}
+
+void
+VS_MidiParserInit(VS_MidiParser *mp)
+{
+	mp->status = 0;
+	mp->nData = 0;
+	mp->sysex = 0;
+}
+
+/* Return the number of data bytes following a status byte. */
+static __inline__ int
+MidiDataLen(Uint8 status)
+{
+	switch (status & 0xf0) {
+	case 0xc0:					/* Program change */
+	case 0xd0:					/* Channel pressure */
+		return (1);
+	case 0xf0:
+		switch (status) {
+		case 0xf1:				/* Time code */
+		case 0xf3:				/* Song select */
+			return (1);
+		case 0xf2:				/* Song position */
+			return (2);
+		default:
+			return (0);
+		}
+	default:
+		return (2);
+	}
+}
+
+/*
+ * Feed one byte of a MIDI stream to the parser. Returns 1 and fills ev
+ * (except for the timestamp) when a message is complete. Running status
+ * is honored for channel messages, SysEx messages are skipped, and
+ * realtime bytes are returned immediately, even in the middle of another
+ * message.
+ */
+int
+VS_MidiParse(VS_MidiParser *mp, Uint8 c, VS_MidiEvent *ev)
+{
+	if (c >= 0xf8) {				/* Realtime */
+		ev->status = c;
+		ev->data[0] = 0;
+		ev->data[1] = 0;
+		return (1);
+	}
+	if (c & 0x80) {					/* Status */
+		mp->sysex = (c == 0xf0);
+		mp->nData = 0;
+		if (c >= 0xf0) {
+			/* System common messages cancel running status. */
+			mp->status = 0;
+			if (c == 0xf0 || c == 0xf7) {
+				return (0);
+			}
+			if (MidiDataLen(c) == 0) {
+				ev->status = c;
+				ev->data[0] = 0;
+				ev->data[1] = 0;
+				return (1);
+			}
+		}
+		mp->status = c;
+		return (0);
+	}
+	if (mp->sysex || mp->status == 0) {		/* Skip data */
+		return (0);
+	}
+	mp->data[mp->nData++] = c;
+	if (mp->nData < MidiDataLen(mp->status)) {
+		return (0);
+	}
+	ev->status = mp->status;
+	ev->data[0] = mp->data[0];
+	ev->data[1] = (mp->nData > 1) ? mp->data[1] : 0;
+	mp->nData = 0;
+	if (mp->status >= 0xf0) {			/* No running status */
+		mp->status = 0;
+	}
+	return (1);
+}
+
+/*
+ * Append an event to the input queue. The consumer (the frame clock)
+ * takes no lock; each side only writes its own index. Producers (the I/O
+ * thread and the file replay thread) are serialized by qLock. Returns -1
+ * if the queue is full.
+ */
+int
+VS_MidiPushEvent(VS_Midi *mid, const VS_MidiEvent *ev)
+{
+	Uint tail, head;
+
+	AG_MutexLock(&mid->qLock);
+	tail = mid->qTail;
+	head = __atomic_load_n(&mid->qHead, __ATOMIC_ACQUIRE);
+	if (tail - head >= VS_MIDI_QUEUELEN) {
+		mid->nDropped++;
+		AG_MutexUnlock(&mid->qLock);
+		VS_StatsAdd(VS_STAT_MIDI_DROPPED, 1);
+		return (-1);
+	}
+	mid->queue[tail & (VS_MIDI_QUEUELEN-1)] = *ev;
+	__atomic_store_n(&mid->qTail, tail+1, __ATOMIC_RELEASE);
+	AG_MutexUnlock(&mid->qLock);
+	return (0);
+}
+
+/*
+ * Move the playhead to x. With smoothing enabled, the playhead instead
+ * converges on x over the following frames (see SmoothScrub()), which
+ * also fills in the frames between successive controller steps. t is the
+ * arrival time of the controller message.
+ */
+static void
+Scrub(VS_Midi *mid, Uint x, Uint64 t)
+{
+	VS_Clip *v = mid->vv->clip;
+
+	if (mid->smoothing == 0) {
+		VS_ClipSetPosition(v, x, t);
+		return;
+	}
+	if (mid->scrubTarget == -1) {
+		mid->scrubX = (double)v->x;
+	}
+	mid->scrubTarget = (int)x;
+}
+
+/* Advance a smoothed scrub by one frame period. */
+static void
+SmoothScrub(VS_Midi *mid)
+{
+	VS_Clip *v = mid->vv->clip;
+	VS_Project *vsp = v->proj;
+	double alpha;
+	Uint x;
+
+	if (mid->scrubTarget == -1) {
+		return;
+	}
+	if (mid->smoothing == 0 || mid->scrubTarget >= (int)v->n) {
+		mid->scrubTarget = -1;
+		return;
+	}
+	alpha = 1.0 - exp(-1000.0/((double)vsp->frameRate*mid->smoothing));
+	mid->scrubX += ((double)mid->scrubTarget - mid->scrubX)*alpha;
+	if (fabs((double)mid->scrubTarget - mid->scrubX) < 0.5) {
+		mid->scrubX = (double)mid->scrubTarget;
+		mid->scrubTarget = -1;
+	}
+	if ((x = (Uint)(mid->scrubX + 0.5)) != v->x)
+		VS_ClipSetPosition(v, x, 0);
+}
+
+/*
+ * Apply a controller (or NRPN) with a 14-bit value. Controller 1 sets
+ * the speed bend range, 10 and 28 the keymap repartition range, and all
+ * others scrub the playhead over the whole clip. t is the arrival time
+ * of the message (0 if it was held back, see FlushControllers()).
+ */
+static void
+ApplyController(VS_Midi *mid, int num, Uint val, Uint64 t)
+{
+	VS_View *vv = mid->vv;
+	VS_Clip *v = vv->clip;
+	VS_Project *vsp = v->proj;
+	Uint x;
+
+	if (num == 0x1) {
+		vsp->bendSpeed = 1.0 +
+		    ((double)(VS_MIDI_CTLMAX - val)/VS_MIDI_CTLMAX)*
+		    vsp->bendSpeedMax;
+		VS_ClipSetVelocity(v, mid->bend/vsp->bendSpeed, t);
+		return;
+	}
+	if (v->n == 0) {
+		return;
+	}
+	x = (Uint)((Uint64)val*(v->n - 1)/VS_MIDI_CTLMAX);
+	switch (num) {
+	case 0xa:
+		mid->repStart = x;
+		RepartitionMIDI(vv, mid->repStart, mid->repSize);
+		break;
+	case 0x1c:
+		mid->repSize = x;
+		RepartitionMIDI(vv, mid->repStart, mid->repSize);
+		break;
+	default:
+		Scrub(mid, x, t);
+		break;
+	}
+}
+
+/*
+ * Process a control change. 7-bit values are scaled to 14 bits. An MSB
+ * is applied right away unless the controller is known to send an LSB,
+ * in which case it waits for the LSB (see FlushControllers()).
+ */
+static void
+ProcessController(VS_Midi *mid, int ch, int num, int val, Uint64 t)
+{
+	VS_MidiCtl *ctl = &mid->ctl[ch];
+	Uint32 bit;
+
+	switch (num) {
+	case 99:					/* NRPN MSB */
+		ctl->nrpnMSB = val;
+		ctl->nrpn = (ctl->nrpnMSB << 7) | ctl->nrpnLSB;
+		return;
+	case 98:					/* NRPN LSB */
+		ctl->nrpnLSB = val;
+		ctl->nrpn = (ctl->nrpnMSB << 7) | ctl->nrpnLSB;
+		return;
+	case 101:					/* RPN (ignored) */
+	case 100:
+		ctl->nrpn = -2;
+		return;
+	case 6:						/* Data entry MSB */
+		if (ctl->nrpn == -1) {
+			break;
+		}
+		ctl->dataMSB = val;
+		ctl->dataLSB = 0;
+		ctl->dataPending = 1;
+		return;
+	case 38:					/* Data entry LSB */
+		if (ctl->nrpn == -1) {
+			break;
+		}
+		ctl->dataLSB = val;
+		ctl->dataPending = 0;
+		if (ctl->nrpn >= 0) {
+			ApplyController(mid, ctl->nrpn,
+			    (ctl->dataMSB << 7) | ctl->dataLSB, t);
+		}
+		return;
+	case 96:					/* Data increment */
+	case 97:					/* Data decrement */
+		if (ctl->nrpn < 0) {
+			break;
+		}
+		val = (ctl->dataMSB << 7) | ctl->dataLSB;
+		val += (num == 96) ? 1 : -1;
+		val = MAX(0, MIN(val, VS_MIDI_CTLMAX));
+		ctl->dataMSB = val >> 7;
+		ctl->dataLSB = val & 0x7f;
+		ApplyController(mid, ctl->nrpn, val, t);
+		return;
+	}
+	if (num < 32) {					/* MSB */
+		bit = 1 << num;
+		ctl->msb[num] = val;
+		if (ctl->hasLSB & bit) {
+			ctl->pending |= bit;
+		} else {
+			ApplyController(mid, num, (val << 7) | val, t);
+		}
+	} else if (num < 64) {				/* LSB */
+		bit = 1 << (num - 32);
+		ctl->hasLSB |= bit;
+		ctl->pending &= ~(bit);
+		ctl->stale &= ~(bit);
+		ApplyController(mid, num-32, (ctl->msb[num-32] << 7) | val,
+		    t);
+	} else {
+		ApplyController(mid, num, (val << 7) | val, t);
+	}
+}
+
+/*
+ * Apply MSBs (and NRPN data) whose LSB did not follow within a frame
+ * period, as sent by controllers that omit an unchanged LSB.
+ */
+static void
+FlushControllers(VS_Midi *mid)
+{
+	int ch, i;
+
+	for (ch = 0; ch < 16; ch++) {
+		VS_MidiCtl *ctl = &mid->ctl[ch];
+
+		if (ctl->stale != 0) {
+			for (i = 0; i < 32; i++) {
+				if (ctl->stale & (1 << i))
+					ApplyController(mid, i,
+					    ctl->msb[i] << 7, 0);
+			}
+			ctl->pending &= ~(ctl->stale);
+		}
+		ctl->stale = ctl->pending;
+
+		if (ctl->dataPending == 2) {
+			if (ctl->nrpn >= 0) {
+				ApplyController(mid, ctl->nrpn,
+				    ctl->dataMSB << 7, 0);
+			}
+			ctl->dataPending = 0;
+		} else if (ctl->dataPending == 1) {
+			ctl->dataPending = 2;
+		}
+	}
+}
+
+/* Apply one decoded message to the clip. Project must be locked. */
+static void
+ProcessEvent(VS_Midi *mid, const VS_MidiEvent *ev)
+{
+	VS_View *vv = mid->vv;
+	VS_Clip *v = vv->clip;
+	VS_Project *vsp = v->proj;
+	int key;
+
+	switch (ev->status & 0xf0) {
+	case 0x90:					/* Note on */
+		key = (int)ev->data[0];
+		if (ev->data[1] == 0) {
+			break;
+		}
+		if (vsp->flags & VS_PROJECT_LEARNING &&
+		    vv->xSel >= 0 && vv->xSel < v->n) {
+			VS_MidiAddKey(mid, key, &v->frames[vv->xSel],
+			    vv->xSel);
+		} else {
+			if (mid->keymap[key] != -1) {
+				mid->scrubTarget = -1;
+				VS_ClipSetPosition(v, mid->keymap[key],
+				    ev->t);
+				VS_ClipTrigger(v, VS_TRIGGER_MIDI, ev->t);
+				vv->xSel = mid->keymap[key];
+			}
+		}
+		break;
+	case 0xb0:					/* Controller */
+		ProcessController(mid, ev->status & 0xf, ev->data[0],
+		    ev->data[1], ev->t);
+		break;
+	case 0xe0:					/* Pitch bend */
+		mid->bend = (double)(ev->data[1] - 64);
+		VS_ClipSetVelocity(v, mid->bend/vsp->bendSpeed, ev->t);
+		break;
+	}
+}
+
+/*
+ * Apply the queued input events timestamped up to tFrame (the deadline
+ * of the frame being processed); later events are left for the next
+ * frame. Then advance any smoothed scrub. Called by the frame clock once
+ * per frame period, with the project locked.
+ */
+void
+VS_MidiProcessInput(VS_Midi *mid, Uint64 tFrame)
+{
+	VS_MidiPvt *pvt = mid->pvt;
+	Uint head = mid->qHead;
+	Uint tail = __atomic_load_n(&mid->qTail, __ATOMIC_ACQUIRE);
+	const VS_MidiEvent *ev;
+	Uint64 t0;
+
+	AG_MutexLock(&mid->vv->clip->lock);
+	if (head != tail) {
+		t0 = VS_ClockNow();
+		AG_MutexLock(&pvt->recLock);
+		for (; head != tail; head++) {
+			ev = &mid->queue[head & (VS_MIDI_QUEUELEN-1)];
+			if (ev->t > tFrame) {
+				break;
+			}
+			ProcessEvent(mid, ev);
+			if (pvt->recording)
+				RecordEvent(pvt, ev);
+		}
+		AG_MutexUnlock(&pvt->recLock);
+		VS_StatsAdd(VS_STAT_MIDI_EVENTS, head - mid->qHead);
+		__atomic_store_n(&mid->qHead, head, __ATOMIC_RELEASE);
+		VS_StatsTime(VS_STAT_MIDI, t0);
+	}
+	FlushControllers(mid);
+	SmoothScrub(mid);
+	AG_MutexUnlock(&mid->vv->clip->lock);
+}
+
+/*
+ * Publish the playhead state to the output thread. Called by the frame
+ * clock once per frame period, with the project locked.
+ */
+void
+VS_MidiUpdateOutput(VS_Midi *mid)
+{
+	VS_Clip *v = mid->vv->clip;
+	VS_Project *vsp = v->proj;
+	Uint64 pulse;
+	int key, keyCur = -1, fCur = -1;
+
+	/* Playhead in clock pulses: x/fps seconds at bpm*PPQ/60 per second. */
+	pulse = (Uint64)v->x * mid->clockBPM * VS_MIDI_PPQ /
+	        (60*(Uint64)vsp->frameRate);
+
+	/* Light the key mapped to the current (or last passed) frame. */
+	for (key = 0; key < VS_MIDI_MAXKEYS; key++) {
+		int f = mid->keymap[key];
+
+		if (f != -1 && f <= (int)v->x && f > fCur) {
+			fCur = f;
+			keyCur = key;
+		}
+	}
+
+	__atomic_store_n(&mid->outPulse, pulse, __ATOMIC_RELAXED);
+	__atomic_store_n(&mid->outRunning, (v->xVel != 0.0), __ATOMIC_RELAXED);
+	__atomic_store_n(&mid->outKey, keyCur, __ATOMIC_RELAXED);
+}
+
+/*
+ * Standard MIDI File replay and capture. A replay thread feeds the events
+ * of a file into the input queue at their scheduled times (optionally
+ * accelerated), going through the same processing as live input, so that
+ * dense controller streams can be reproduced without MIDI hardware. Live
+ * input can be captured to a file for this purpose.
+ */
+
+#define VS_SMF_PPQ	5000		/* Capture resolution (ticks/quarter) */
+#define VS_SMF_TEMPO	500000		/* Capture tempo (us/quarter) */
+
+typedef struct vs_smf_event {
+	Uint64 tick;			/* Absolute time (ticks) */
+	Uint seq;			/* Order in file */
+	Uint32 tempo;			/* Tempo change (us/quarter) or 0 */
+	Uint8 status, data[2];
+} VS_SmfEvent;
+
+static int
+CompareSmfEvents(const void *p1, const void *p2)
+{
+	const VS_SmfEvent *e1 = p1, *e2 = p2;
+
+	if (e1->tick != e2->tick) {
+		return (e1->tick < e2->tick ? -1 : 1);
+	}
+	return (e1->seq < e2->seq ? -1 : e1->seq > e2->seq);
+}
+
+static int
+ReadVarLen(const Uint8 **p, const Uint8 *end, Uint32 *val)
+{
+	Uint32 v = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (*p >= end) {
+			return (-1);
+		}
+		v = (v << 7) | (**p & 0x7f);
+		if ((*(*p)++ & 0x80) == 0) {
+			*val = v;
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+/* Parse one MTrk chunk, appending its events to se. */
+static int
+ParseTrack(const Uint8 *p, const Uint8 *end, VS_SmfEvent **se, Uint *n,
+    Uint *maxEv)
+{
+	Uint64 tick = 0;
+	Uint8 status = 0, c;
+	Uint32 delta, len;
+	VS_SmfEvent *e, *seNew;
+
+	while (p < end) {
+		if (ReadVarLen(&p, end, &delta) == -1 || p >= end) {
+			goto trunc;
+		}
+		tick += delta;
+		if (*n+1 > *maxEv) {
+			Uint maxNew = (*maxEv > 0) ? *maxEv*2 : 1024;
+
+			if ((seNew = TryRealloc(*se, maxNew*sizeof(VS_SmfEvent)))
+			    == NULL) {
+				return (-1);
+			}
+			*se = seNew;
+			*maxEv = maxNew;
+		}
+		e = &(*se)[*n];
+		e->tick = tick;
+		e->seq = *n;
+		e->tempo = 0;
+
+		if ((c = *p) & 0x80) {
+			p++;
+		} else if (status == 0) {
+			AG_SetError("Data byte without status");
+			return (-1);
+		} else {
+			c = status;			/* Running status */
+		}
+		if (c == 0xff) {				/* Meta event */
+			Uint8 type;
+
+			if (p >= end) { goto trunc; }
+			type = *p++;
+			if (ReadVarLen(&p, end, &len) == -1 || len > end-p) {
+				goto trunc;
+			}
+			if (type == 0x51 && len == 3) {		/* Set tempo */
+				e->tempo = (p[0] << 16) | (p[1] << 8) | p[2];
+				e->status = 0xff;
+				(*n)++;
+			} else if (type == 0x2f) {		/* End of track */
+				break;
+			}
+			p += len;
+			continue;
+		}
+		if (c == 0xf0 || c == 0xf7) {			/* SysEx */
+			if (ReadVarLen(&p, end, &len) == -1 || len > end-p) {
+				goto trunc;
+			}
+			p += len;
+			continue;
+		}
+		if (c >= 0xf0) {
+			AG_SetError("Bad status byte 0x%02x", c);
+			return (-1);
+		}
+		status = c;
+		e->status = c;
+		if (p >= end) { goto trunc; }
+		e->data[0] = *p++ & 0x7f;
+		if ((c & 0xf0) == 0xc0 || (c & 0xf0) == 0xd0) {
+			e->data[1] = 0;
+		} else {
+			if (p >= end) { goto trunc; }
+			e->data[1] = *p++ & 0x7f;
+		}
+		(*n)++;
+	}
+	return (0);
+trunc:
+	AG_SetError("Truncated track");
+	return (-1);
+}
+
+/*
+ * Load a Standard MIDI File (format 0 or 1) as a list of channel
+ * messages with times in nanoseconds from the start of the file. The
+ * tracks are merged and the tempo map is applied.
+ */
+static int
+LoadSMF(const char *path, VS_MidiEvent **pEv, Uint *pn)
+{
+	FILE *f;
+	Uint8 *buf = NULL;
+	const Uint8 *p, *end;
+	long size;
+	VS_SmfEvent *se = NULL;
+	VS_MidiEvent *ev = NULL;
+	Uint nSe = 0, maxSe = 0, nEv = 0, i;
+	Uint nTracks, division, tempo = VS_SMF_TEMPO;
+	Uint64 tickLast = 0, t = 0, nsPerTick = 0;
+	Uint32 len;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	if (fseek(f, 0, SEEK_END) == -1 || (size = ftell(f)) < 14 ||
+	    fseek(f, 0, SEEK_SET) == -1 ||
+	    (buf = TryMalloc(size)) == NULL ||
+	    fread(buf, 1, size, f) != (size_t)size) {
+		AG_SetError("%s: Read error", path);
+		goto fail;
+	}
+	fclose(f);
+	f = NULL;
+
+	p = buf;
+	end = buf + size;
+	if (memcmp(p, "MThd", 4) != 0) {
+		AG_SetError("%s: Not a MIDI file", path);
+		goto fail;
+	}
+	len = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+	nTracks = (p[10] << 8) | p[11];
+	division = (p[12] << 8) | p[13];
+	if (len < 6 || len > size-8) {
+		AG_SetError("%s: Bad header", path);
+		goto fail;
+	}
+	if (division & 0x8000) {			/* SMPTE frames */
+		int fps = -(Sint8)(division >> 8);
+		Uint tpf = division & 0xff;
+
+		if (fps <= 0 || tpf == 0) {
+			AG_SetError("%s: Bad time division", path);
+			goto fail;
+		}
+		nsPerTick = (fps == 29) ? 1001000000/(30*tpf) :
+		                          1000000000/(fps*tpf);
+	} else if (division == 0) {
+		AG_SetError("%s: Bad time division", path);
+		goto fail;
+	}
+	for (p += 8+len, i = 0; i < nTracks && end-p >= 8; i++) {
+		len = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+		if (len > end-p-8) {
+			AG_SetError("%s: Truncated file", path);
+			goto fail;
+		}
+		if (memcmp(p, "MTrk", 4) == 0 &&
+		    ParseTrack(p+8, p+8+len, &se, &nSe, &maxSe) == -1) {
+			AG_SetError("%s: Track %u: %s", path, i, AG_GetError());
+			goto fail;
+		}
+		p += 8+len;
+	}
+	qsort(se, nSe, sizeof(VS_SmfEvent), CompareSmfEvents);
+
+	if ((ev = TryMalloc((nSe+1)*sizeof(VS_MidiEvent))) == NULL) {
+		goto fail;
+	}
+	for (i = 0; i < nSe; i++) {
+		VS_SmfEvent *e = &se[i];
+
+		if (nsPerTick != 0) {
+			t = e->tick*nsPerTick;
+		} else {
+			t += (e->tick - tickLast)*tempo*1000/division;
+			tickLast = e->tick;
+		}
+		if (e->status == 0xff) {
+			tempo = e->tempo;
+			continue;
+		}
+		ev[nEv].t = t;
+		ev[nEv].status = e->status;
+		ev[nEv].data[0] = e->data[0];
+		ev[nEv].data[1] = e->data[1];
+		nEv++;
+	}
+	Free(se);
+	Free(buf);
+	*pEv = ev;
+	*pn = nEv;
+	return (0);
+fail:
+	if (f != NULL) { fclose(f); }
+	Free(se);
+	Free(buf);
+	return (-1);
+}
+
+/*
+ * Replay loop. Events are stamped with their scheduled time rather than
+ * the time the thread woke up, so a replay yields the same frame for each
+ * event from run to run.
+ */
+static void *
+VS_MidiReplayThread(void *arg)
+{
+	VS_Midi *mid = arg;
+	VS_MidiPvt *pvt = mid->pvt;
+	VS_MidiEvent ev;
+	Uint64 t0, t, tLen;
+	Uint i, nLoops = 0, speed = MAX(mid->replaySpeed, 1);
+
+	tLen = pvt->replay[pvt->nReplay-1].t;
+	t0 = VS_ClockNow();
+	do {
+		for (i = 0; i < pvt->nReplay; i++) {
+			ev = pvt->replay[i];
+			ev.t = t0 + ev.t/speed;
+			for (;;) {
+				if (pvt->replayExit) {
+					goto out;
+				}
+				t = VS_ClockNow();
+				if (t >= ev.t) {
+					break;
+				}
+				VS_ClockSleepUntil(MIN(ev.t, t+100000000));
+			}
+			VS_MidiPushEvent(mid, &ev);
+		}
+		t0 += tLen/speed + 1000000;
+		nLoops++;
+	} while (mid->replayLoop && !pvt->replayExit);
+out:
+	VS_Status(mid->vv, _("MIDI replay: %u events x %u (%u dropped)"),
+	    pvt->nReplay, nLoops, mid->nDropped);
+	AG_ThreadExit(NULL);
+}
+
+/* Start replaying a Standard MIDI File into the input queue. */
+int
+VS_MidiReplayStart(VS_Midi *mid, const char *path)
+{
+	VS_MidiPvt *pvt = mid->pvt;
+	VS_MidiEvent *ev;
+	Uint n;
+
+	if (LoadSMF(path, &ev, &n) == -1) {
+		return (-1);
+	}
+	if (n == 0) {
+		AG_SetError(_("%s: No channel messages to replay"), path);
+		Free(ev);
+		return (-1);
+	}
+	VS_MidiReplayStop(mid);
+	pvt->replay = ev;
+	pvt->nReplay = n;
+	pvt->replayExit = 0;
+	pvt->replayThread = 1;
+	mid->nDropped = 0;
+	AG_ThreadCreate(&pvt->thReplay, VS_MidiReplayThread, mid);
+	return (0);
+}
+
+void
+VS_MidiReplayStop(VS_Midi *mid)
+{
+	VS_MidiPvt *pvt = mid->pvt;
+
+	if (!pvt->replayThread) {
+		return;
+	}
+	pvt->replayExit = 1;
+	AG_ThreadJoin(pvt->thReplay, NULL);
+	pvt->replayThread = 0;
+	Free(pvt->replay);
+	pvt->replay = NULL;
+	pvt->nReplay = 0;
+}
+
+/* Start capturing processed input events. */
+void
+VS_MidiRecordStart(VS_Midi *mid)
+{
+	VS_MidiPvt *pvt = mid->pvt;
+
+	AG_MutexLock(&pvt->recLock);
+	pvt->nRec = 0;
+	pvt->recT0 = VS_ClockNow();
+	pvt->recording = 1;
+	AG_MutexUnlock(&pvt->recLock);
+}
+
+static void
+WriteVarLen(FILE *f, Uint32 v)
+{
+	Uint8 buf[4];
+	int i = 0;
+
+	buf[i++] = v & 0x7f;
+	while ((v >>= 7) != 0) {
+		buf[i++] = 0x80 | (v & 0x7f);
+	}
+	while (i > 0) {
+		fputc(buf[--i], f);
+	}
+}
+
+static void
+WriteUint32BE(FILE *f, Uint32 v)
+{
+	fputc(v >> 24, f);
+	fputc((v >> 16) & 0xff, f);
+	fputc((v >> 8) & 0xff, f);
+	fputc(v & 0xff, f);
+}
+
+/*
+ * Stop capturing and save the captured events as a format 0 Standard
+ * MIDI File (at 100us per tick).
+ */
+int
+VS_MidiRecordStop(VS_Midi *mid, const char *path)
+{
+	VS_MidiPvt *pvt = mid->pvt;
+	FILE *f;
+	long lenOffs, lenEnd;
+	Uint64 tickLast = 0, tick;
+	Uint i;
+	int rv = 0;
+
+	AG_MutexLock(&pvt->recLock);
+	pvt->recording = 0;
+	if ((f = fopen(path, "wb")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		AG_MutexUnlock(&pvt->recLock);
+		return (-1);
+	}
+	fwrite("MThd", 1, 4, f);
+	WriteUint32BE(f, 6);
+	fputc(0, f); fputc(0, f);			/* Format 0 */
+	fputc(0, f); fputc(1, f);			/* 1 track */
+	fputc(VS_SMF_PPQ >> 8, f); fputc(VS_SMF_PPQ & 0xff, f);
+	fwrite("MTrk", 1, 4, f);
+	lenOffs = ftell(f);
+	WriteUint32BE(f, 0);
+
+	WriteVarLen(f, 0);				/* Set tempo */
+	fputc(0xff, f); fputc(0x51, f); fputc(3, f);
+	fputc(VS_SMF_TEMPO >> 16, f);
+	fputc((VS_SMF_TEMPO >> 8) & 0xff, f);
+	fputc(VS_SMF_TEMPO & 0xff, f);
+
+	for (i = 0; i < pvt->nRec; i++) {
+		VS_MidiEvent *ev = &pvt->rec[i];
+
+		tick = (ev->t > pvt->recT0) ? (ev->t - pvt->recT0)*VS_SMF_PPQ/
+		                              ((Uint64)VS_SMF_TEMPO*1000) : 0;
+		if (tick < tickLast) {
+			tick = tickLast;
+		}
+		WriteVarLen(f, (Uint32)(tick - tickLast));
+		tickLast = tick;
+		fputc(ev->status, f);
+		fputc(ev->data[0], f);
+		if ((ev->status & 0xf0) != 0xc0 && (ev->status & 0xf0) != 0xd0)
+			fputc(ev->data[1], f);
+	}
+	WriteVarLen(f, 0);				/* End of track */
+	fputc(0xff, f); fputc(0x2f, f); fputc(0, f);
+
+	lenEnd = ftell(f);
+	fseek(f, lenOffs, SEEK_SET);
+	WriteUint32BE(f, (Uint32)(lenEnd - lenOffs - 4));
+	if (ferror(f) || fclose(f) != 0) {
+		AG_SetError("%s: Write error", path);
+		rv = -1;
+	}
+	AG_MutexUnlock(&pvt->recLock);
+	return (rv);
+}
+
+/* Append a processed input event to the capture. Lock must be held. */
+static void
+RecordEvent(VS_MidiPvt *pvt, const VS_MidiEvent *ev)
+{
+	VS_MidiEvent *recNew;
+
+	if (ev->status >= 0xf0) {
+		return;
+	}
+	if (pvt->nRec+1 > pvt->maxRec) {
+		Uint maxNew = (pvt->maxRec > 0) ? pvt->maxRec*2 : 4096;
+
+		if ((recNew = TryRealloc(pvt->rec,
+		    maxNew*sizeof(VS_MidiEvent))) == NULL) {
+			return;
+		}
+		pvt->rec = recNew;
+		pvt->maxRec = maxNew;
+	}
+	pvt->rec[pvt->nRec++] = *ev;
+}
+
+static void
+ReplayFile(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+	char *path = AG_STRING(2);
+
+	if (VS_MidiReplayStart(mid, path) == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	VS_Status(mid->vv, _("Replaying %s (%u events, x%u)"),
+	    AG_ShortFilename(path), mid->pvt->nReplay, mid->replaySpeed);
+}
+
+static void
+StopReplay(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+
+	VS_MidiReplayStop(mid);
+}
+
+static void
+RecordStart(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+
+	VS_MidiRecordStart(mid);
+	VS_Status(mid->vv, _("Capturing MIDI input"));
+}
+
+static void
+RecordSaveFile(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+	char *path = AG_STRING(2);
+
+	if (VS_MidiRecordStop(mid, path) == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	VS_Status(mid->vv, _("Saved %u MIDI events to %s"), mid->pvt->nRec,
+	    AG_ShortFilename(path));
+}
+
+static void
+MidiFileDlg(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+	int save = AG_INT(2);
+	AG_Window *win;
+	AG_FileDlg *fd;
+
+	win = AG_WindowNew(0);
+	AG_WindowSetCaption(win, save ? _("Save MIDI capture as...") :
+	                                _("Replay MIDI file..."));
+	fd = AG_FileDlgNewMRU(win, "vislak.mru.midi",
+	    (save ? AG_FILEDLG_SAVE : AG_FILEDLG_LOAD)|AG_FILEDLG_CLOSEWIN|
+	    AG_FILEDLG_EXPAND);
+	AG_FileDlgAddType(fd, _("Standard MIDI file"), "*.mid,*.midi,*.smf",
+	    save ? RecordSaveFile : ReplayFile, "%p", mid);
+	AG_WindowShow(win);
+}
+
+static void
+SetReplaySpeed(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+	int speed = AG_INT(2);
+
+	mid->replaySpeed = (Uint)speed;
+}
+
+static void
+SetSmoothing(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+	int ms = AG_INT(2);
+
+	mid->smoothing = ms;
+}
+
+/* Menu items for controller handling. */
+static void
+MenuControllers(VS_Midi *mid, AG_MenuItem *m)
+{
+	static const int smoothings[] = { 0, 10, 30, 60, 120 };
+	AG_MenuItem *mSmooth;
+	const char *text, *mark;
+	int i;
+
+	mSmooth = AG_MenuNode(m, _("Scrub smoothing"), NULL);
+	for (i = 0; i < sizeof(smoothings)/sizeof(smoothings[0]); i++) {
+		mark = (smoothings[i] == mid->smoothing) ? " *" : "";
+		if (smoothings[i] == 0) {
+			text = AG_Printf("%s%s", _("Off"), mark);
+		} else {
+			text = AG_Printf("%d ms%s", smoothings[i], mark);
+		}
+		AG_MenuAction(mSmooth, text, NULL,
+		    SetSmoothing, "%p,%i", mid, smoothings[i]);
+	}
+}
+
+/* Menu items for file replay and capture. */
+static void
+MenuReplay(VS_Midi *mid, AG_MenuItem *m)
+{
+	static const int speeds[] = { 1, 2, 4, 8, 16 };
+	AG_MenuItem *mSpeed;
+	int i;
+
+	AG_MenuAction(m, _("Replay MIDI file..."), agIconLoad.s,
+	    MidiFileDlg, "%p,%i", mid, 0);
+	if (mid->pvt->replayThread) {
+		AG_MenuAction(m, _("Stop replay"), vsIconStop.s,
+		    StopReplay, "%p", mid);
+	}
+	mSpeed = AG_MenuNode(m, _("Replay speed"), NULL);
+	for (i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+		AG_MenuAction(mSpeed, AG_Printf("x%d%s", speeds[i],
+		    (speeds[i] == mid->replaySpeed) ? " *" : ""),
+		    NULL, SetReplaySpeed, "%p,%i", mid, speeds[i]);
+	}
+	AG_MenuIntBool(m, _("Loop replay"), NULL, &mid->replayLoop, 0);
+	if (mid->pvt->recording) {
+		AG_MenuAction(m, _("Save MIDI capture as..."), agIconSave.s,
+		    MidiFileDlg, "%p,%i", mid, 1);
+	} else {
+		AG_MenuAction(m, _("Capture MIDI input"), vsIconPlay.s,
+		    RecordStart, "%p", mid);
+	}
+}
+
+#ifdef HAVE_ALSA
+/*
+ * MIDI input devices. All input devices (raw MIDI ports and sequencer
+ * clients) are serviced by a single I/O thread that poll()s their
+ * descriptors. Devices are opened by the GUI and handed over to the I/O
+ * thread, which owns them from then on: closing a device only marks it,
+ * and the I/O thread releases it when it next rebuilds its poll set.
+ */
+static AG_Mutex    vsMidiLock;			/* Lock on device list */
+static AG_Cond     vsMidiCond;			/* Poll set was rebuilt */
+static TAILQ_HEAD(,vs_midi_dev) vsMidiDevs;
+static int         vsMidiInited = 0;
+static Uint        vsMidiGen = 0;		/* Device list generation */
+static Uint        vsMidiGenSeen = 0;		/* Generation being polled */
+static int         vsMidiWake[2] = { -1, -1 };	/* Wakes the I/O thread */
+static AG_Thread   vsMidiThread;
+
+static void *VS_MidiIOThread(void *);
+
+/* Start the I/O thread on first use. */
+static int
+InitIO(void)
+{
+	if (vsMidiInited) {
+		return (0);
+	}
+	if (pipe(vsMidiWake) == -1) {
+		AG_SetError("pipe: %s", strerror(errno));
+		return (-1);
+	}
+	fcntl(vsMidiWake[0], F_SETFL, O_NONBLOCK);
+	fcntl(vsMidiWake[1], F_SETFL, O_NONBLOCK);
+	AG_MutexInitRecursive(&vsMidiLock);
+	AG_CondInit(&vsMidiCond);
+	TAILQ_INIT(&vsMidiDevs);
+	vsMidiInited = 1;
+	AG_ThreadCreate(&vsMidiThread, VS_MidiIOThread, NULL);
+	return (0);
+}
+
+/* Signal a device list change to the I/O thread. Lock must be held. */
+static Uint
+DevicesChanged(void)
+{
+	char c = 0;
+
+	vsMidiGen++;
+	(void)write(vsMidiWake[1], &c, 1);
+	return (vsMidiGen);
+}
+
+static VS_MidiDev *
+NewDevice(VS_Midi *mid, enum vs_midi_dev_type type, const char *name)
+{
+	VS_MidiDev *dev;
+	int i;
+
+	dev = Malloc(sizeof(VS_MidiDev));
+	memset(dev, 0, sizeof(VS_MidiDev));
+	dev->type = type;
+	Strlcpy(dev->name, name, sizeof(dev->name));
+	dev->mid = mid;
+	dev->seqPort = -1;
+	dev->seqQueue = -1;
+	dev->client = -1;
+	dev->port = -1;
+	VS_MidiParserInit(&dev->parser);
+	for (i = 0; i < 128; i++) {
+		dev->noteMap[i] = (Uint8)i;
+		dev->ctlMap[i] = (Uint8)i;
+	}
+	return (dev);
+}
+
+/* Hand a newly opened device over to the I/O thread. */
+static void
+AttachDevice(VS_MidiDev *dev)
+{
+	AG_MutexLock(&vsMidiLock);
+	TAILQ_INSERT_TAIL(&vsMidiDevs, dev, devs);
+	dev->mid->flags |= VS_MIDI_INPUT;
+	DevicesChanged();
+	AG_MutexUnlock(&vsMidiLock);
+}
+
+/* Return the sequencer client device of a VS_Midi. Lock must be held. */
+static VS_MidiDev *
+FindSeq(VS_Midi *mid)
+{
+	VS_MidiDev *dev;
+
+	TAILQ_FOREACH(dev, &vsMidiDevs, devs) {
+		if (dev->mid == mid && dev->type == VS_MIDI_DEV_SEQ &&
+		    !dev->closing)
+			return (dev);
+	}
+	return (NULL);
+}
+
+/*
+ * Request that a device be closed. Closing a sequencer client also
+ * closes its subscriptions. Returns the generation to wait for.
+ */
+static Uint
+CloseDevice(VS_MidiDev *devClose)
+{
+	VS_MidiDev *dev;
+	Uint gen;
+
+	AG_MutexLock(&vsMidiLock);
+	TAILQ_FOREACH(dev, &vsMidiDevs, devs) {
+		if (dev == devClose)
+			break;
+	}
+	if (dev == NULL) {				/* Stale menu entry */
+		gen = vsMidiGen;
+		AG_MutexUnlock(&vsMidiLock);
+		return (gen);
+	}
+	dev->closing = 1;
+	if (dev->type == VS_MIDI_DEV_SEQ) {
+		TAILQ_FOREACH(dev, &vsMidiDevs, devs) {
+			if (dev->mid == devClose->mid &&
+			    dev->type == VS_MIDI_DEV_SRC)
+				dev->closing = 1;
+		}
+	}
+	gen = DevicesChanged();
+	AG_MutexUnlock(&vsMidiLock);
+	return (gen);
+}
+
+/* Release a closed device. Called from the I/O thread, lock held. */
+static void
+FreeDevice(VS_MidiDev *dev)
+{
+	VS_MidiDev *devSeq;
+
+	switch (dev->type) {
+	case VS_MIDI_DEV_RAW:
+		snd_rawmidi_close(dev->in);
+		break;
+	case VS_MIDI_DEV_SEQ:
+		snd_seq_close(dev->seq);
+		break;
+	case VS_MIDI_DEV_SRC:
+		if ((devSeq = FindSeq(dev->mid)) != NULL) {
+			snd_seq_disconnect_from(devSeq->seq, devSeq->seqPort,
+			    dev->client, dev->port);
+		}
+		break;
+	}
+	Free(dev);
 }
 
-void
-VS_MidiDestroy(VS_Midi *mid)
+/*
+ * Rebuild the poll set from the device list, releasing closed devices.
+ * pDev maps each pollfd back to its device. Lock must be held.
+ */
+static int
+RebuildPoll(struct pollfd **pPfd, VS_MidiDev ***pDev, int *nPfd,
+    VS_MidiDev ***pSnap, int *nSnap)
 {
-#ifdef HAVE_ALSA
-	if (mid->pvt->in != NULL) {
-		snd_rawmidi_drain(mid->pvt->in);
-		snd_rawmidi_close(mid->pvt->in);
+	VS_MidiDev *dev, *devNext, **devs, **snap;
+	struct pollfd *pfd;
+	int n = 1, nDevs = 0, i, cnt;
+
+	for (dev = TAILQ_FIRST(&vsMidiDevs); dev != NULL; dev = devNext) {
+		devNext = TAILQ_NEXT(dev, devs);
+		if (dev->closing) {
+			TAILQ_REMOVE(&vsMidiDevs, dev, devs);
+			FreeDevice(dev);
+			continue;
+		}
+		nDevs++;
+		if (dev->type == VS_MIDI_DEV_RAW) {
+			n += snd_rawmidi_poll_descriptors_count(dev->in);
+		} else if (dev->type == VS_MIDI_DEV_SEQ) {
+			n += snd_seq_poll_descriptors_count(dev->seq, POLLIN);
+		}
 	}
-	if (mid->pvt->out != NULL) {
-		snd_rawmidi_drain(mid->pvt->out);
-		snd_rawmidi_close(mid->pvt->out);
+	if ((pfd = TryRealloc(*pPfd, n*sizeof(struct pollfd))) == NULL) {
+		return (-1);
 	}
-#endif
-	Free(mid->pvt);
-	Free(mid);
+	*pPfd = pfd;
+	if ((devs = TryRealloc(*pDev, n*sizeof(VS_MidiDev *))) == NULL) {
+		return (-1);
+	}
+	*pDev = devs;
+	if ((snap = TryRealloc(*pSnap, (nDevs+1)*sizeof(VS_MidiDev *)))
+	    == NULL) {
+		return (-1);
+	}
+	*pSnap = snap;
+
+	pfd[0].fd = vsMidiWake[0];
+	pfd[0].events = POLLIN;
+	devs[0] = NULL;
+	i = 1;
+	nDevs = 0;
+	TAILQ_FOREACH(dev, &vsMidiDevs, devs) {
+		snap[nDevs++] = dev;
+		switch (dev->type) {
+		case VS_MIDI_DEV_RAW:
+			cnt = snd_rawmidi_poll_descriptors(dev->in, &pfd[i],
+			    n-i);
+			break;
+		case VS_MIDI_DEV_SEQ:
+			cnt = snd_seq_poll_descriptors(dev->seq, &pfd[i],
+			    n-i, POLLIN);
+			break;
+		default:
+			cnt = 0;
+			break;
+		}
+		for (; cnt > 0; cnt--) {
+			devs[i++] = dev;
+		}
+	}
+	*nPfd = i;
+	*nSnap = nDevs;
+	return (0);
 }
 
-/* Create a MIDI key->frame mapping */
-void
-VS_MidiAddKey(VS_Midi *mid, int key, VS_Frame *vf)
+/* Apply a device's note and controller mapping tables. */
+static __inline__ void
+MapEvent(const VS_MidiDev *dev, VS_MidiEvent *ev)
 {
-	mid->keymap[key] = vf->f;
-	vf->midiKey = key;
+	switch (ev->status & 0xf0) {
+	case 0x80:
+	case 0x90:
+	case 0xa0:
+		ev->data[0] = dev->noteMap[ev->data[0] & 0x7f];
+		break;
+	case 0xb0:
+		ev->data[0] = dev->ctlMap[ev->data[0] & 0x7f];
+		break;
+	}
 }
 
-/* Remove a MIDI key->frame mapping */
-void
-VS_MidiDelKey(VS_Midi *mid, int key)
+/*
+ * Convert a sequencer event to a MIDI message. Returns 0 for events
+ * that have no MIDI equivalent we care about.
+ */
+static int
+ConvertSeqEvent(const snd_seq_event_t *sev, VS_MidiEvent *ev)
 {
-	mid->keymap[key] = -1;
+	int val;
+
+	ev->data[0] = 0;
+	ev->data[1] = 0;
+	switch (sev->type) {
+	case SND_SEQ_EVENT_NOTEON:
+	case SND_SEQ_EVENT_NOTEOFF:
+	case SND_SEQ_EVENT_KEYPRESS:
+		ev->status = (sev->type == SND_SEQ_EVENT_NOTEON) ? 0x90 :
+		             (sev->type == SND_SEQ_EVENT_NOTEOFF) ? 0x80 : 0xa0;
+		ev->status |= sev->data.note.channel & 0xf;
+		ev->data[0] = sev->data.note.note & 0x7f;
+		ev->data[1] = sev->data.note.velocity & 0x7f;
+		return (1);
+	case SND_SEQ_EVENT_CONTROLLER:
+		ev->status = 0xb0 | (sev->data.control.channel & 0xf);
+		ev->data[0] = sev->data.control.param & 0x7f;
+		ev->data[1] = sev->data.control.value & 0x7f;
+		return (1);
+	case SND_SEQ_EVENT_PGMCHANGE:
+	case SND_SEQ_EVENT_CHANPRESS:
+		ev->status = (sev->type == SND_SEQ_EVENT_PGMCHANGE) ?
+		             0xc0 : 0xd0;
+		ev->status |= sev->data.control.channel & 0xf;
+		ev->data[0] = sev->data.control.value & 0x7f;
+		return (1);
+	case SND_SEQ_EVENT_PITCHBEND:
+		val = sev->data.control.value + 8192;
+		ev->status = 0xe0 | (sev->data.control.channel & 0xf);
+		ev->data[0] = val & 0x7f;
+		ev->data[1] = (val >> 7) & 0x7f;
+		return (1);
+	case SND_SEQ_EVENT_SONGPOS:
+		val = sev->data.control.value;
+		ev->status = 0xf2;
+		ev->data[0] = val & 0x7f;
+		ev->data[1] = (val >> 7) & 0x7f;
+		return (1);
+	case SND_SEQ_EVENT_CLOCK:	ev->status = 0xf8;	return (1);
+	case SND_SEQ_EVENT_START:	ev->status = 0xfa;	return (1);
+	case SND_SEQ_EVENT_CONTINUE:	ev->status = 0xfb;	return (1);
+	case SND_SEQ_EVENT_STOP:	ev->status = 0xfc;	return (1);
+	default:
+		return (0);
+	}
 }
 
-/* Clear MIDI keymap */
-Uint
-VS_MidiClearKeys(VS_Midi *mid)
+/* Drain a raw MIDI input device. */
+static void
+ReadRaw(VS_MidiDev *dev, struct pollfd *pfd, int n, Uint64 t)
 {
-	Uint i, nCleared = 0, f;
-	VS_Clip *v = mid->vv->clip;
+	Uint8 buf[256];
+	unsigned short revents;
+	VS_MidiEvent ev;
+	ssize_t i, len;
 
-	for (i = 0; i < VS_MIDI_MAXKEYS; i++) {
-		if ((f = mid->keymap[i]) != -1) {
-			mid->keymap[i] = -1;
-			nCleared++;
-		}
+	if (snd_rawmidi_poll_descriptors_revents(dev->in, pfd, n, &revents)
+	    < 0) {
+		return;
 	}
-	for (i = 0; i < v->n; i++) {
-		v->frames[i].midiKey = -1;
+	if (revents & (POLLERR|POLLHUP)) {		/* Unplugged */
+		fprintf(stderr, "%s: MIDI device lost\n", dev->name);
+		AG_MutexLock(&vsMidiLock);
+		dev->closing = 1;
+		DevicesChanged();
+		AG_MutexUnlock(&vsMidiLock);
+		return;
+	}
+	if (!(revents & POLLIN)) {
+		return;
+	}
+	ev.t = t;
+	while ((len = snd_rawmidi_read(dev->in, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < len; i++) {
+			if (!VS_MidiParse(&dev->parser, buf[i], &ev)) {
+				continue;
+			}
+			MapEvent(dev, &ev);
+			VS_MidiPushEvent(dev->mid, &ev);
+		}
 	}
-	return (nCleared);
 }
 
+/*
+ * Drain a sequencer client. The kernel stamps each event with the real
+ * time of our queue when it is delivered to our port, which we convert
+ * to the VS_ClockNow() timebase, so the frame clock sees the true
+ * arrival time rather than the time this thread was scheduled. Events
+ * are mapped with the tables of the subscription they came from.
+ */
 static void
-RepartitionMIDI(VS_View *vv, int start, int end)
+ReadSeq(VS_MidiDev *dev, VS_MidiDev **snap, int nSnap, Uint64 t)
 {
-	VS_Clip *v = vv->clip;
-	VS_Midi *mid = v->midi;
-	Uint i, j, key;
-	Uint div, nMapped = 0;
+	snd_seq_event_t *sev;
+	VS_MidiEvent ev;
+	int i;
 
-	div = (Uint)(end - start)/60;
-	key = 36;
-	for (i = start, j = 0;
-	     i < end;
-	     i++) {
-		v->frames[i].midiKey = key;
-		if (++j > div) {
-			j = 0;
-			key++;
+	while (snd_seq_event_input(dev->seq, &sev) >= 0) {
+		if (!ConvertSeqEvent(sev, &ev)) {
+			continue;
 		}
-		mid->keymap[key] = i;
-		nMapped++;
+		for (i = 0; i < nSnap; i++) {
+			VS_MidiDev *src = snap[i];
+
+			if (src->type == VS_MIDI_DEV_SRC &&
+			    src->mid == dev->mid &&
+			    src->client == sev->source.client &&
+			    src->port == sev->source.port) {
+				MapEvent(src, &ev);
+				break;
+			}
+		}
+		if (sev->flags & SND_SEQ_TIME_STAMP_REAL) {
+			ev.t = dev->seqT0 +
+			    (Uint64)sev->time.time.tv_sec*1000000000 +
+			    (Uint64)sev->time.time.tv_nsec;
+		} else {
+			ev.t = t;
+		}
+		VS_MidiPushEvent(dev->mid, &ev);
 	}
-	VS_Status(vv, _("Mapped %u MIDI keys (%d-%d)"),
-	    nMapped, start, end);
 }
 
-#ifdef HAVE_ALSA
 /*
- * MIDI input loop.
+ * MIDI input loop. Waits on the descriptors of every open input device
+ * and queues the decoded messages for the frame clock of the clip each
+ * device is attached to. The file replay thread (VS_MidiReplayThread())
+ * also produces into the input queues; producers are serialized by
+ * qLock in VS_MidiPushEvent(), while the frame clock consumes without
+ * locking.
  */
-static __inline__ void
-ReadMidi(VS_View *vv, VS_Midi *mid, void *p, size_t len)
-{
-	AG_ObjectUnlock(vv->clip->proj);
-	AG_ObjectUnlock(vv);
-	snd_rawmidi_read(mid->pvt->in, p, len);
-	AG_ObjectLock(vv);
-	AG_ObjectLock(vv->clip->proj);
-}
 static void *
-VS_MidiInputThread(void *arg)
+VS_MidiIOThread(void *arg)
 {
-	VS_Midi *mid = arg;
-	VS_View *vv = mid->vv;
-	VS_Clip *v;
-	VS_Project *vsp;
-	Uchar ch, data[2];
-	int key, vel;
-	double bend = 0.0;
-	int repStart = 0, repSize = 0;
-
-	AG_ObjectLock(vv);
-	v = vv->clip;
-	vsp = v->proj;
-	AG_ObjectLock(vsp);
+	struct pollfd *pfd = NULL;
+	VS_MidiDev **devs = NULL, **snap = NULL;
+	int nPfd = 0, nSnap = 0, i, n;
+	Uint gen = 0;
+	char c[64];
+	Uint64 t;
 
 	for (;;) {
-		ReadMidi(vv, mid, &ch, 1);
-		switch (ch) {
-		case 0x94:					/* Note */
-			ReadMidi(vv, mid, data, 2);
-			key = (int)data[0];
-			vel = (int)data[1];
-			if (vel == 0) {
-				break;
+		AG_MutexLock(&vsMidiLock);
+		if (pfd == NULL || gen != vsMidiGen) {
+			if (RebuildPoll(&pfd, &devs, &nPfd, &snap, &nSnap)
+			    == -1) {
+				AG_MutexUnlock(&vsMidiLock);
+				fprintf(stderr, "MIDI: %s\n", AG_GetError());
+				AG_Delay(100);
+				continue;
 			}
-			if (vsp->flags & VS_PROJECT_LEARNING &&
-			    vv->xSel >= 0 && vv->xSel < v->n) {
-				VS_MidiAddKey(mid, key, &v->frames[vv->xSel]);
+			gen = vsMidiGen;
+			vsMidiGenSeen = gen;
+			AG_CondBroadcast(&vsMidiCond);
+		}
+		AG_MutexUnlock(&vsMidiLock);
+
+		if (poll(pfd, nPfd, -1) <= 0) {
+			continue;
+		}
+		t = VS_ClockNow();
+		if (pfd[0].revents & POLLIN) {
+			while (read(vsMidiWake[0], c, sizeof(c)) > 0)
+				;
+		}
+		for (i = 1; i < nPfd; i += n) {
+			VS_MidiDev *dev = devs[i];
+
+			for (n = 1; i+n < nPfd && devs[i+n] == dev; n++)
+				;
+			if (dev->type == VS_MIDI_DEV_RAW) {
+				ReadRaw(dev, &pfd[i], n, t);
 			} else {
-				if (mid->keymap[key] != -1) {
-					v->x = mid->keymap[key];
-					vv->xSel = mid->keymap[key];
-				}
+				ReadSeq(dev, snap, nSnap, t);
 			}
-			break;
-		case 0xb4:					/* Controller */
-			ReadMidi(vv, mid, data, 2);
-			switch (data[0]) {
-			case 0x1:
-				vsp->bendSpeed = 1.0 +
-				    ((double)(127 - data[1])/127.0)*vsp->bendSpeedMax;
-				v->xVel = bend/vsp->bendSpeed;
-				break;
-			case 0xa:
-				repStart = data[1]*(v->n - 1)/127;
-				RepartitionMIDI(vv, repStart, repSize);
-				break;
-			case 0x1c:
-				repSize = data[1]*(v->n - 1)/127;
-				RepartitionMIDI(vv, repStart, repSize);
-				break;
-			default:
-				v->x = data[1]*(v->n - 1)/127;
-				break;
-			}
-			break;
-		case 0xe4:					/* Pitch bend */
-			ReadMidi(vv, mid, data, 2);
-			bend = (double)(data[1] - 64);
-			v->xVel = bend/vsp->bendSpeed;
-			break;
 		}
 	}
-	
-	AG_ObjectUnlock(vsp);
-	AG_ObjectUnlock(vv);
+	AG_ThreadExit(NULL);
+}
+
+/*
+ * Close all the input devices of a VS_Midi and wait until the I/O thread
+ * has released them.
+ */
+static void
+CloseInputs(VS_Midi *mid)
+{
+	VS_MidiDev *dev;
+	Uint gen;
+
+	if (!vsMidiInited) {
+		return;
+	}
+	AG_MutexLock(&vsMidiLock);
+	TAILQ_FOREACH(dev, &vsMidiDevs, devs) {
+		if (dev->mid == mid)
+			dev->closing = 1;
+	}
+	gen = DevicesChanged();
+	while (vsMidiGenSeen < gen) {
+		AG_CondWait(&vsMidiCond, &vsMidiLock);
+	}
+	AG_MutexUnlock(&vsMidiLock);
 }
 
 /*
- * MIDI output loop.
+ * MIDI output loop. Ticks on its own deadline clock at the clock pulse
+ * rate and follows the playhead published by VS_MidiUpdateOutput():
+ * pulses are sent as the playhead advances (so the external tempo
+ * follows the playback speed), and jumps are relocated with a song
+ * position pointer. Key feedback notes are sent as the playhead passes
+ * mapped frames. Each tick's messages are sent to every output device
+ * with a single write per device.
  */
 static void *
 VS_MidiOutputThread(void *arg)
 {
 	VS_Midi *mid = arg;
+	VS_MidiPvt *pvt = mid->pvt;
+	VS_Clock clk;
+	Uint8 buf[32];
+	Uint64 sent = 0, target;
+	Uint bpm = 0, spp;
+	int running = 0, moving, key, keyLit = -1, n, i;
+	Uint8 noteOn = 0x90 | (mid->outChannel & 0xf);
+	ssize_t rv;
+	size_t len;
 
 	for (;;) {
-		Uchar ch;
+		if (bpm != mid->clockBPM) {
+			/* Pulse period is 60/(bpm*PPQ) = 5/(2*bpm) seconds. */
+			bpm = mid->clockBPM;
+			VS_ClockInit(&clk, 5, 2*bpm);
+		}
+		len = 0;
+		target = __atomic_load_n(&mid->outPulse, __ATOMIC_RELAXED);
+		moving = __atomic_load_n(&mid->outRunning, __ATOMIC_RELAXED);
+
+		if (moving) {
+			if (!running || target < sent ||
+			    target > sent + VS_MIDI_MAXLAG) {
+				/* Relocate (song position is in 16ths). */
+				spp = MIN(target/(VS_MIDI_PPQ/4), 0x3fff);
+				if (running) {
+					buf[len++] = 0xfc;	/* Stop */
+				}
+				buf[len++] = 0xf2;
+				buf[len++] = spp & 0x7f;
+				buf[len++] = (spp >> 7) & 0x7f;
+				buf[len++] = 0xfb;		/* Continue */
+				sent = (Uint64)spp*(VS_MIDI_PPQ/4);
+				running = 1;
+			}
+			for (n = 0; sent < target && n < VS_MIDI_MAXBURST;
+			     n++, sent++) {
+				buf[len++] = 0xf8;		/* Clock */
+			}
+		} else if (running) {
+			buf[len++] = 0xfc;			/* Stop */
+			running = 0;
+		}
+
+		key = __atomic_load_n(&mid->outKey, __ATOMIC_RELAXED);
+		if (key != keyLit) {
+			if (keyLit != -1) {
+				buf[len++] = noteOn;
+				buf[len++] = keyLit & 0x7f;
+				buf[len++] = 0;
+			}
+			if (key != -1) {
+				buf[len++] = noteOn;
+				buf[len++] = key & 0x7f;
+				buf[len++] = 127;
+			}
+			keyLit = key;
+		}
+
+		AG_MutexLock(&pvt->outLock);
+		if (pvt->outExit) {
+			AG_MutexUnlock(&pvt->outLock);
+			break;
+		}
+		for (i = 0; len > 0 && i < pvt->nOut; i++) {
+			if ((rv = snd_rawmidi_write(pvt->out[i], buf, len))
+			    < 0) {
+				fprintf(stderr, "%s: %s\n", pvt->outName[i],
+				    snd_strerror(rv));
+			}
+		}
+		AG_MutexUnlock(&pvt->outLock);
 
-		ch = 0x90;	snd_rawmidi_write(mid->pvt->out, &ch, 1);
-		ch = 60;	snd_rawmidi_write(mid->pvt->out, &ch, 1);
-		ch = 100;	snd_rawmidi_write(mid->pvt->out, &ch, 1);
-		snd_rawmidi_drain(mid->pvt->out);
-		sleep(1);
-		ch = 0x90;	snd_rawmidi_write(mid->pvt->out, &ch, 1);
-		ch = 60;	snd_rawmidi_write(mid->pvt->out, &ch, 1);
-		ch = 0;		snd_rawmidi_write(mid->pvt->out, &ch, 1);
-		snd_rawmidi_drain(mid->pvt->out);
-		sleep(1);
+		VS_ClockWait(&clk);
 	}
+	AG_ThreadExit(NULL);
+}
+
+/* Set the tempo of the output MIDI clock. */
+static void
+SetClockTempo(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+	int bpm = AG_INT(2);
+
+	mid->clockBPM = (Uint)bpm;
+	VS_Status(mid->vv, _("MIDI clock: %d BPM"), bpm);
 }
 
 static void
@@ -270,45 +1828,345 @@ SetInputALSA(AG_Event *event)
 	int card = AG_INT(2);
 	int dev = AG_INT(3);
 	int subdev = AG_INT(4);
+	snd_rawmidi_t *in;
+	VS_MidiDev *md;
 	int rv;
 
-	if (mid->pvt->in != NULL) {
-		AG_TextError(_("MIDI input device is already open"));
+	if (InitIO() == -1) {
+		AG_TextMsgFromError();
 		return;
 	}
 	GetDeviceName(devname, sizeof(devname), card, dev, subdev);
- 	if ((rv = snd_rawmidi_open(&mid->pvt->in, NULL, devname, 0)) != 0) {
+ 	if ((rv = snd_rawmidi_open(&in, NULL, devname, SND_RAWMIDI_NONBLOCK))
+	    != 0) {
 		AG_TextError(_("ALSA: Failed to open %s: %s"),
 		    devname, snd_strerror(rv));
 		return;
 	}
-	mid->flags |= VS_MIDI_INPUT;
-/*	AG_LabelText(vsStatus, _("Opened input MIDI device: %s"), devname); */
-	AG_ThreadCreate(&thInput, VS_MidiInputThread, mid);
+	md = NewDevice(mid, VS_MIDI_DEV_RAW, devname);
+	md->in = in;
+	AttachDevice(md);
+	VS_Status(mid->vv, _("Opened MIDI input %s"), devname);
 }
+
 static void
 SetOutputALSA(AG_Event *event)
 {
 	char devname[16];
 	VS_Midi *mid = AG_PTR(1);
+	VS_MidiPvt *pvt = mid->pvt;
 	int card = AG_INT(2);
 	int dev = AG_INT(3);
 	int subdev = AG_INT(4);
+	snd_rawmidi_t *out;
 	int rv;
 
-	if (mid->pvt->out != NULL) {
-		AG_TextError(_("MIDI output device is already open"));
+	if (pvt->nOut >= VS_MIDI_MAXOUTS) {
+		AG_TextError(_("Too many MIDI output devices"));
 		return;
 	}
 	GetDeviceName(devname, sizeof(devname), card, dev, subdev);
- 	if ((rv = snd_rawmidi_open(NULL, &mid->pvt->out, devname, 0)) != 0) {
+ 	if ((rv = snd_rawmidi_open(NULL, &out, devname, 0)) != 0) {
 		AG_TextError("ALSA: Failed to open %s: %s",
 		    devname, snd_strerror(rv));
 		return;
 	}
+	AG_MutexLock(&pvt->outLock);
+	pvt->out[pvt->nOut] = out;
+	Strlcpy(pvt->outName[pvt->nOut], devname, sizeof(pvt->outName[0]));
+	pvt->nOut++;
+	AG_MutexUnlock(&pvt->outLock);
+
 	mid->flags |= VS_MIDI_OUTPUT;
-/*	AG_LabelText(vsStatus, _("Opened output MIDI device: %s"), devname); */
-	AG_ThreadCreate(&thOutput, VS_MidiOutputThread, mid);
+	if (!pvt->outThread) {
+		pvt->outExit = 0;
+		pvt->outThread = 1;
+		AG_ThreadCreate(&pvt->thOut, VS_MidiOutputThread, mid);
+	}
+	VS_Status(mid->vv, _("Opened MIDI output %s"), devname);
+}
+
+/*
+ * Open a sequencer client and create our input port, with a running
+ * queue used to timestamp incoming events. Lock must be held.
+ */
+static VS_MidiDev *
+OpenSeq(VS_Midi *mid)
+{
+	VS_MidiDev *dev;
+	snd_seq_t *seq;
+	snd_seq_port_info_t *pinfo;
+	snd_seq_queue_status_t *qs;
+	const snd_seq_real_time_t *rt;
+	int rv;
+
+	if ((rv = snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT,
+	    SND_SEQ_NONBLOCK)) < 0) {
+		AG_SetError("ALSA sequencer: %s", snd_strerror(rv));
+		return (NULL);
+	}
+	dev = NewDevice(mid, VS_MIDI_DEV_SEQ, "Sequencer");
+	dev->seq = seq;
+	snd_seq_set_client_name(seq, "Vislak");
+	if ((dev->seqQueue = snd_seq_alloc_named_queue(seq, "Vislak")) < 0) {
+		rv = dev->seqQueue;
+		goto fail;
+	}
+
+	snd_seq_port_info_alloca(&pinfo);
+	snd_seq_port_info_set_name(pinfo, "Vislak input");
+	snd_seq_port_info_set_capability(pinfo,
+	    SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+	snd_seq_port_info_set_type(pinfo,
+	    SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+	snd_seq_port_info_set_timestamping(pinfo, 1);
+	snd_seq_port_info_set_timestamp_real(pinfo, 1);
+	snd_seq_port_info_set_timestamp_queue(pinfo, dev->seqQueue);
+	if ((rv = snd_seq_create_port(seq, pinfo)) < 0) {
+		goto fail;
+	}
+	dev->seqPort = snd_seq_port_info_get_port(pinfo);
+
+	if ((rv = snd_seq_start_queue(seq, dev->seqQueue, NULL)) < 0 ||
+	    (rv = snd_seq_drain_output(seq)) < 0) {
+		goto fail;
+	}
+
+	/* Map queue time 0 onto the monotonic clock. */
+	snd_seq_queue_status_alloca(&qs);
+	if ((rv = snd_seq_get_queue_status(seq, dev->seqQueue, qs)) < 0) {
+		goto fail;
+	}
+	rt = snd_seq_queue_status_get_real_time(qs);
+	dev->seqT0 = VS_ClockNow() - ((Uint64)rt->tv_sec*1000000000 +
+	                              (Uint64)rt->tv_nsec);
+	AttachDevice(dev);
+	return (dev);
+fail:
+	AG_SetError("ALSA sequencer: %s", snd_strerror(rv));
+	snd_seq_close(seq);
+	Free(dev);
+	return (NULL);
+}
+
+/* Subscribe our input port to a sequencer client:port. */
+static void
+SetInputSeq(AG_Event *event)
+{
+	char name[32];
+	VS_Midi *mid = AG_PTR(1);
+	int client = AG_INT(2);
+	int port = AG_INT(3);
+	VS_MidiDev *dev, *src;
+	snd_seq_port_subscribe_t *sub;
+	snd_seq_addr_t sender, dest;
+	int rv;
+
+	if (InitIO() == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	AG_MutexLock(&vsMidiLock);
+	if ((dev = FindSeq(mid)) == NULL && (dev = OpenSeq(mid)) == NULL) {
+		AG_MutexUnlock(&vsMidiLock);
+		AG_TextMsgFromError();
+		return;
+	}
+	sender.client = client;
+	sender.port = port;
+	dest.client = snd_seq_client_id(dev->seq);
+	dest.port = dev->seqPort;
+
+	snd_seq_port_subscribe_alloca(&sub);
+	snd_seq_port_subscribe_set_sender(sub, &sender);
+	snd_seq_port_subscribe_set_dest(sub, &dest);
+	snd_seq_port_subscribe_set_queue(sub, dev->seqQueue);
+	snd_seq_port_subscribe_set_time_update(sub, 1);
+	snd_seq_port_subscribe_set_time_real(sub, 1);
+	if ((rv = snd_seq_subscribe_port(dev->seq, sub)) < 0) {
+		AG_MutexUnlock(&vsMidiLock);
+		AG_TextError(_("ALSA: Cannot subscribe to %d:%d: %s"),
+		    client, port, snd_strerror(rv));
+		return;
+	}
+	snprintf(name, sizeof(name), "seq:%d:%d", client, port);
+	src = NewDevice(mid, VS_MIDI_DEV_SRC, name);
+	src->client = client;
+	src->port = port;
+	AttachDevice(src);
+	AG_MutexUnlock(&vsMidiLock);
+
+	VS_Status(mid->vv, _("Subscribed to MIDI port %d:%d"), client, port);
+}
+
+/*
+ * Create the sequencer input port without subscribing it; other clients
+ * (or aconnect, or a test sender) can connect to it.
+ */
+static void
+SetInputSeqVirtual(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+	VS_MidiDev *dev;
+
+	if (InitIO() == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	AG_MutexLock(&vsMidiLock);
+	if ((dev = FindSeq(mid)) == NULL && (dev = OpenSeq(mid)) == NULL) {
+		AG_MutexUnlock(&vsMidiLock);
+		AG_TextMsgFromError();
+		return;
+	}
+	VS_Status(mid->vv, _("Opened MIDI port %d:%d"),
+	    snd_seq_client_id(dev->seq), dev->seqPort);
+	AG_MutexUnlock(&vsMidiLock);
+}
+
+static void
+CloseInputDevice(AG_Event *event)
+{
+	VS_MidiDev *dev = AG_PTR(1);
+
+	CloseDevice(dev);
+}
+
+static void
+CloseOutputDevice(AG_Event *event)
+{
+	VS_Midi *mid = AG_PTR(1);
+	int i = AG_INT(2);
+	VS_MidiPvt *pvt = mid->pvt;
+
+	AG_MutexLock(&pvt->outLock);
+	if (i < pvt->nOut) {
+		snd_rawmidi_close(pvt->out[i]);
+		if (i < pvt->nOut-1) {
+			memmove(&pvt->out[i], &pvt->out[i+1],
+			    (pvt->nOut-i-1)*sizeof(pvt->out[0]));
+			memmove(&pvt->outName[i], &pvt->outName[i+1],
+			    (pvt->nOut-i-1)*sizeof(pvt->outName[0]));
+		}
+		if (--pvt->nOut == 0)
+			mid->flags &= ~(VS_MIDI_OUTPUT);
+	}
+	AG_MutexUnlock(&pvt->outLock);
+}
+
+/* Transpose the notes of an input device (merging several controllers). */
+static void
+SetTranspose(AG_Event *event)
+{
+	VS_MidiDev *devSet = AG_PTR(1);
+	int transpose = AG_INT(2);
+	VS_MidiDev *dev;
+	int i, note;
+
+	AG_MutexLock(&vsMidiLock);
+	TAILQ_FOREACH(dev, &vsMidiDevs, devs) {
+		if (dev == devSet)
+			break;
+	}
+	if (dev != NULL) {
+		for (i = 0; i < 128; i++) {
+			note = i + transpose;
+			dev->noteMap[i] = (Uint8)(note < 0 ? 0 :
+			                          note > 127 ? 127 : note);
+		}
+		dev->transpose = transpose;
+	}
+	AG_MutexUnlock(&vsMidiLock);
+}
+
+/* List the open devices of a VS_Midi. */
+static void
+MenuOpenDevices(VS_Midi *mid, AG_MenuItem *m, Uint flags)
+{
+	static const int transposes[] = { -24, -12, 0, 12, 24 };
+	VS_MidiPvt *pvt = mid->pvt;
+	VS_MidiDev *dev;
+	AG_MenuItem *mDev, *mSub;
+	int i;
+
+	if (flags & VS_MIDI_OUTPUT) {
+		AG_MutexLock(&pvt->outLock);
+		for (i = 0; i < pvt->nOut; i++) {
+			mDev = AG_MenuNode(m, pvt->outName[i], agIconDoc.s);
+			AG_MenuAction(mDev, _("Close"), agIconClose.s,
+			    CloseOutputDevice, "%p,%i", mid, i);
+		}
+		AG_MutexUnlock(&pvt->outLock);
+		return;
+	}
+	if (!vsMidiInited) {
+		return;
+	}
+	AG_MutexLock(&vsMidiLock);
+	TAILQ_FOREACH(dev, &vsMidiDevs, devs) {
+		if (dev->mid != mid || dev->closing) {
+			continue;
+		}
+		mDev = AG_MenuNode(m, dev->name, agIconDoc.s);
+		AG_MenuAction(mDev, _("Close"), agIconClose.s,
+		    CloseInputDevice, "%p", dev);
+		if (dev->type == VS_MIDI_DEV_SEQ) {
+			continue;
+		}
+		mSub = AG_MenuNode(mDev, _("Transpose notes"), NULL);
+		for (i = 0; i < sizeof(transposes)/sizeof(transposes[0]);
+		     i++) {
+			AG_MenuAction(mSub, AG_Printf("%+d%s", transposes[i],
+			    (transposes[i] == dev->transpose) ? " *" : ""),
+			    NULL, SetTranspose, "%p,%i", dev, transposes[i]);
+		}
+	}
+	AG_MutexUnlock(&vsMidiLock);
+}
+
+/* List the readable sequencer ports of other clients. */
+static void
+MenuDevicesSeq(VS_Midi *mid, AG_MenuItem *m)
+{
+	char text[128];
+	snd_seq_t *seq;
+	snd_seq_client_info_t *cinfo;
+	snd_seq_port_info_t *pinfo;
+	Uint caps = SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+	int rv;
+
+	AG_MenuAction(m, _("Virtual sequencer port"), vsIconControls.s,
+	    SetInputSeqVirtual, "%p", mid);
+
+	if ((rv = snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, 0)) < 0) {
+		AG_MenuSection(m, "(Sequencer: %s)", snd_strerror(rv));
+		return;
+	}
+	snd_seq_client_info_alloca(&cinfo);
+	snd_seq_port_info_alloca(&pinfo);
+	snd_seq_client_info_set_client(cinfo, -1);
+	while (snd_seq_query_next_client(seq, cinfo) >= 0) {
+		int client = snd_seq_client_info_get_client(cinfo);
+
+		if (client == SND_SEQ_CLIENT_SYSTEM) {
+			continue;
+		}
+		snd_seq_port_info_set_client(pinfo, client);
+		snd_seq_port_info_set_port(pinfo, -1);
+		while (snd_seq_query_next_port(seq, pinfo) >= 0) {
+			if ((snd_seq_port_info_get_capability(pinfo) & caps)
+			    != caps) {
+				continue;
+			}
+			snprintf(text, sizeof(text), "[%d:%d] %s",
+			    client, snd_seq_port_info_get_port(pinfo),
+			    snd_seq_port_info_get_name(pinfo));
+			AG_MenuAction(m, text, vsIconControls.s,
+			    SetInputSeq, "%p,%i,%i", mid, client,
+			    snd_seq_port_info_get_port(pinfo));
+		}
+	}
+	snd_seq_close(seq);
 }
 
 static int
@@ -448,13 +2306,40 @@ MenuDevicesALSA(VS_Midi *mid, AG_MenuItem *m, snd_ctl_t *ctl, int card,
 void
 VS_MidiDevicesMenu(VS_Midi *mid, AG_MenuItem *pm, Uint flags)
 {
-#ifdef HAVE_ALSA
 	AG_MenuItem *m;
+#ifdef HAVE_ALSA
+	AG_MenuItem *mOpen;
 	int card = -1, rv;
-	
+#endif
+
 	m = AG_MenuNode(pm, (flags & VS_MIDI_INPUT) ?
 	                    _("MIDI Input") : _("MIDI Output"), NULL);
 
+	if (flags & VS_MIDI_INPUT) {
+		MenuControllers(mid, m);
+		MenuReplay(mid, m);
+		AG_MenuSeparator(m);
+	}
+#ifdef HAVE_ALSA
+	mOpen = AG_MenuNode(m, _("Open devices"), NULL);
+	MenuOpenDevices(mid, mOpen, flags);
+
+	if (flags & VS_MIDI_INPUT) {
+		MenuDevicesSeq(mid, m);
+		AG_MenuSeparator(m);
+	} else {
+		static const int tempos[] = { 90, 100, 110, 120, 128, 140 };
+		AG_MenuItem *mTempo;
+		int i;
+
+		mTempo = AG_MenuNode(m, _("Clock tempo"), NULL);
+		for (i = 0; i < sizeof(tempos)/sizeof(tempos[0]); i++) {
+			AG_MenuAction(mTempo, AG_Printf("%d BPM", tempos[i]),
+			    NULL, SetClockTempo, "%p,%i", mid, tempos[i]);
+		}
+		AG_MenuSeparator(m);
+	}
+
 	if ((rv = snd_card_next(&card)) < 0) {
 		AG_MenuSection(m, "(%s)", snd_strerror(rv));
 		return;
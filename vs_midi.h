@@ -7,6 +7,43 @@ struct vs_midi_pvt;
 struct vs_frame;
 
 #define VS_MIDI_MAXKEYS	256
+#define VS_MIDI_QUEUELEN 1024		/* Input queue size (power of 2) */
+#define VS_MIDI_PPQ	24		/* MIDI clock pulses per quarter note */
+#define VS_MIDI_MAXLAG	VS_MIDI_PPQ	/* Pulses behind before relocating */
+#define VS_MIDI_MAXBURST 4		/* Max clock pulses sent per tick */
+
+#define VS_MIDI_CTLMAX	16383		/* Maximum 14-bit controller value */
+
+/* Decoded MIDI message. */
+typedef struct vs_midi_event {
+	Uint64 t;			/* Arrival time (VS_ClockNow() ns) */
+	Uint8 status;			/* Status byte (including channel) */
+	Uint8 data[2];			/* Data bytes */
+} VS_MidiEvent;
+
+/* MIDI byte stream parser state. */
+typedef struct vs_midi_parser {
+	Uint8 status;			/* Running status (0 = none) */
+	Uint8 data[2];			/* Data bytes received */
+	int nData;			/* Number of data bytes received */
+	int sysex;			/* Skipping a SysEx message */
+} VS_MidiParser;
+
+/*
+ * Controller state of a MIDI channel. Controllers 0-31 pair with 32-63
+ * as 14-bit MSB/LSB values; NRPNs are selected with controllers 99/98
+ * and set with the data entry pair 6/38.
+ */
+typedef struct vs_midi_ctl {
+	Uint8 msb[32];			/* Last MSB of controllers 0-31 */
+	Uint32 hasLSB;			/* Controllers that send an LSB */
+	Uint32 pending;			/* MSB received, LSB not yet */
+	Uint32 stale;			/* Pending for a whole frame */
+	int nrpn;			/* Selected NRPN (-1 = none, -2 = RPN) */
+	Uint8 nrpnMSB, nrpnLSB;		/* NRPN number */
+	Uint8 dataMSB, dataLSB;		/* Data entry value */
+	int dataPending;		/* Data MSB received (2 = stale) */
+} VS_MidiCtl;
 
 typedef struct vs_midi {
 	Uint flags;
@@ -15,15 +52,42 @@ typedef struct vs_midi {
 	struct vs_midi_pvt *pvt;	/* Driver-specific data */
 	struct vs_view *vv;		/* Back pointer to VS_View */
 	int keymap[VS_MIDI_MAXKEYS];	/* Key->frame mappings */
+	VS_MidiEvent queue[VS_MIDI_QUEUELEN]; /* I/O thread -> frame clock */
+	AG_Mutex qLock;			/* Serializes queue producers */
+	Uint qHead;			/* Next event to consume */
+	Uint qTail;			/* Next free slot */
+	Uint nDropped;			/* Events lost to a full queue */
+	double bend;			/* Last pitch bend */
+	VS_MidiCtl ctl[16];		/* Per-channel controller state */
+	int smoothing;			/* Scrub smoothing time constant (ms) */
+	int scrubTarget;		/* Smoothed scrub target (or -1) */
+	double scrubX;			/* Smoothed scrub position */
+	int repStart, repSize;		/* Keymap repartition range */
+	Uint clockBPM;			/* Tempo of the output MIDI clock */
+	int outChannel;			/* Channel of key feedback notes */
+	Uint64 outPulse;		/* Playhead position (clock pulses) */
+	int outRunning;			/* Playhead is moving */
+	int outKey;			/* Key mapped to the playhead (or -1) */
+	Uint replaySpeed;		/* File replay speed factor */
+	int replayLoop;			/* Repeat file replay */
 } VS_Midi;
 
 __BEGIN_DECLS
 VS_Midi *VS_MidiNew(struct vs_view *);
 void     VS_MidiDestroy(VS_Midi *);
 void     VS_MidiDevicesMenu(VS_Midi *, AG_MenuItem *, Uint);
-void     VS_MidiAddKey(VS_Midi *, int, struct vs_frame *);
+void     VS_MidiAddKey(VS_Midi *, int, struct vs_frame *, Uint);
 void     VS_MidiDelKey(VS_Midi *, int);
 Uint     VS_MidiClearKeys(VS_Midi *);
+void     VS_MidiParserInit(VS_MidiParser *);
+int      VS_MidiParse(VS_MidiParser *, Uint8, VS_MidiEvent *);
+int      VS_MidiPushEvent(VS_Midi *, const VS_MidiEvent *);
+void     VS_MidiProcessInput(VS_Midi *, Uint64);
+void     VS_MidiUpdateOutput(VS_Midi *);
+int      VS_MidiReplayStart(VS_Midi *, const char *);
+void     VS_MidiReplayStop(VS_Midi *);
+void     VS_MidiRecordStart(VS_Midi *);
+int      VS_MidiRecordStop(VS_Midi *, const char *);
 __END_DECLS
 
 #endif /* _VISLAK_MIDI_H_ */
@@ -30,11 +30,11 @@
 #include <vislak.h>
 
 #include <stdio.h>
-#include <jpeglib.h>
-#include <setjmp.h>
 
 int vsPlayerLOD = 0;			/* Auto LOD adjustment (for slow hw) */
 int vsPlayerButtonHeight = 20;
+int vsPlayerCueCacheMB = 512;		/* Memory budget of the cue cache */
+int vsPlayerHUD = 0;			/* Show statistics overlay */
 
 VS_Player *
 VS_PlayerNew(void *parent, Uint flags, struct vs_clip *clip)
@@ -75,7 +75,7 @@ Rewind(AG_Event *event)
 	AG_ObjectLock(vp);
 	AG_ObjectLock(vp->clip->proj);
 
-	vp->clip->x = 0;
+	VS_ClipSetPosition(vp->clip, 0, 0);
 
 	AG_ObjectUnlock(vp->clip->proj);
 	AG_ObjectUnlock(vp);
@@ -92,7 +92,7 @@ Forward(AG_Event *event)
 	AG_ObjectLock(vsp);
 
 	if (vp->clip->n > 0)
-		vp->clip->x = (vp->clip->n - 1);
+		VS_ClipSetPosition(vp->clip, vp->clip->n - 1, 0);
 
 	AG_ObjectUnlock(vsp);
 	AG_ObjectUnlock(vp);
@@ -156,6 +156,7 @@ VS_Play(VS_Player *vp)
 	} else {
 		VS_Status(vsp, _("Playing (%u frames, no sound)"), v->n);
 	}
+	vp->nAdvanced = 0;
 	vp->flags |= VS_PLAYER_PLAYING;
 	vsp->flags |= VS_PROJECT_PLAYING;
 out:
@@ -216,7 +217,23 @@ Init(void *obj)
 	vp->wPre = 320;
 	vp->hPre = 240 + vsPlayerButtonHeight;
 	vp->xLast = -1;
+	vp->nAdvanced = 0;
 	vp->suScaled = -1;
+	vp->suHUD = -1;
+	vp->tHUD = 0;
+	vp->suPrefetch = NULL;
+	vp->xPrefetch = -1;
+	vp->prefetchBusy = 0;
+	AG_MutexInit(&vp->prefetchLock);
+	VS_TaskGroupInit(&vp->prefetchGrp);
+	AG_MutexInit(&vp->cueLock);
+	vp->cues = NULL;
+	vp->nCues = 0;
+	vp->cueGen = 0;
+	vp->cueClipGen = 0;
+	vp->cueW = -1;
+	vp->cueH = -1;
+	VS_TaskGroupInit(&vp->cueGrp);
 
 	vp->btn[VS_PLAYER_REW] = AG_ButtonNewFn(vp, 0, _("Rew"),
 	    Rewind, "%p", vp);
@@ -230,6 +247,30 @@ Init(void *obj)
 	    Record, "%p", vp);
 }
 
+static void
+Destroy(void *obj)
+{
+	VS_Player *vp = obj;
+	Uint i;
+
+	/* Wait for any decode still running on our behalf. */
+	VS_TaskGroupWait(&vp->prefetchGrp);
+	VS_TaskGroupDestroy(&vp->prefetchGrp);
+	if (vp->suPrefetch != NULL) {
+		AG_SurfaceFree(vp->suPrefetch);
+	}
+	AG_MutexDestroy(&vp->prefetchLock);
+
+	VS_TaskGroupWait(&vp->cueGrp);
+	VS_TaskGroupDestroy(&vp->cueGrp);
+	for (i = 0; i < vp->nCues; i++) {
+		if (vp->cues[i].su != NULL)
+			AG_SurfaceFree(vp->cues[i].su);
+	}
+	Free(vp->cues);
+	AG_MutexDestroy(&vp->cueLock);
+}
+
 static void
 SizeRequest(void *obj, AG_SizeReq *r)
 {
@@ -293,123 +334,361 @@ fail:
 }
 
 /*
- * Update video from image file.
+ * Decode the next frame ahead of time on the thread pool. The result is
+ * picked up by DrawFromJPEG() if the playhead lands on it.
  */
-struct my_error_mgr {
-	struct jpeg_error_mgr pub;
-	jmp_buf setjmp_buffer;
-};
-typedef struct my_error_mgr *my_error_ptr;
-METHODDEF(void)
-my_error_exit(j_common_ptr cinfo)
+typedef struct vs_prefetch {
+	VS_Player *vp;
+	Uint x;				/* Frame to decode */
+	int w, h;			/* Target size */
+} VS_Prefetch;
+
+static void
+PrefetchTask(void *arg)
 {
-	my_error_ptr myerr = (my_error_ptr)cinfo->err;
-	(*cinfo->err->output_message)(cinfo);
-	longjmp(myerr->setjmp_buffer, 1);
+	VS_Prefetch *pf = arg;
+	VS_Player *vp = pf->vp;
+	AG_Surface *su;
+
+	su = VS_ClipReadFrame(vp->clip, pf->x, pf->w, pf->h);
+
+	AG_MutexLock(&vp->prefetchLock);
+	if (vp->suPrefetch != NULL) {
+		AG_SurfaceFree(vp->suPrefetch);
+	}
+	vp->suPrefetch = su;
+	vp->xPrefetch = (su != NULL) ? (int)pf->x : -1;
+	vp->prefetchBusy = 0;
+	AG_MutexUnlock(&vp->prefetchLock);
+	free(pf);
 }
+
 static void
-DrawFromJPEG(VS_Player *vp, VS_Clip *v, VS_Frame *vf)
+Prefetch(VS_Player *vp, Uint x)
 {
-	char path[AG_PATHNAME_MAX];
-	FILE *f;
-	struct jpeg_decompress_struct cinfo;
-	struct my_error_mgr jerr;
-	JSAMPROW pRow[1];
-	AG_Surface *su = NULL, *suScaled;
-
-	snprintf(path, sizeof(path), v->fileFmt, v->dir, vf->f);
-	if ((f = fopen(path, "r")) == NULL)
+	VS_Prefetch *pf;
+
+	AG_MutexLock(&vp->prefetchLock);
+	if (vp->prefetchBusy || vp->xPrefetch == (int)x ||
+	    (pf = TryMalloc(sizeof(VS_Prefetch))) == NULL) {
+		AG_MutexUnlock(&vp->prefetchLock);
 		return;
+	}
+	pf->vp = vp;
+	pf->x = x;
+	pf->w = vp->rVid.w;
+	pf->h = vp->rVid.h;
+	vp->prefetchBusy = 1;
+	AG_MutexUnlock(&vp->prefetchLock);
+
+	if (VS_PoolSubmit(VS_TASK_PLAYBACK, PrefetchTask, pf,
+	    &vp->prefetchGrp) == -1) {
+		AG_MutexLock(&vp->prefetchLock);
+		vp->prefetchBusy = 0;
+		AG_MutexUnlock(&vp->prefetchLock);
+		free(pf);
+	}
+}
+
+/*
+ * Cue cache. Every frame mapped to a keyboard or MIDI key, the frames
+ * within the clip's cue window around it, and the frames of the A/B loop
+ * regions are kept decoded at the player size, so that the first hit of
+ * a cue does not wait on a disk read and decode. Frames are identified by
+ * their on-disk ID, so they survive edits that move them. The set is
+ * updated by the draw routine when the clip signals a change of keymaps
+ * or loops (VS_ClipCuesChanged()), and missing frames are decoded in the
+ * background on the thread pool.
+ */
+typedef struct vs_cue_task {
+	VS_Player *vp;
+	Uint x;				/* Frame position when submitted */
+	Uint id;			/* Frame ID */
+	int ref;
+	int w, h;			/* Target size */
+} VS_CueTask;
 
-	cinfo.err = jpeg_std_error(&jerr.pub);
-	jerr.pub.error_exit = my_error_exit;
-	if (setjmp(jerr.setjmp_buffer)) {
-		jpeg_destroy_decompress(&cinfo);
+static int
+CompareCues(const void *p1, const void *p2)
+{
+	const VS_CueFrame *c1 = p1, *c2 = p2;
+
+	if (c1->id != c2->id) {
+		return (c1->id < c2->id ? -1 : 1);
+	}
+	return (c1->ref - c2->ref);
+}
+
+static __inline__ VS_CueFrame *
+FindCue(VS_Player *vp, Uint id, int ref)
+{
+	VS_CueFrame key;
+
+	key.id = id;
+	key.ref = ref;
+	return bsearch(&key, vp->cues, vp->nCues, sizeof(VS_CueFrame),
+	    CompareCues);
+}
+
+static void
+CueTask(void *arg)
+{
+	VS_CueTask *ct = arg;
+	VS_Player *vp = ct->vp;
+	VS_Clip *v = vp->clip;
+	VS_CueFrame *cue;
+	AG_Surface *su = NULL;
+	int valid;
+
+	AG_MutexLock(&vp->cueLock);
+	valid = (ct->w == vp->cueW && ct->h == vp->cueH);
+	AG_MutexUnlock(&vp->cueLock);
+
+	AG_MutexLock(&v->lock);
+	valid = valid && (ct->x < v->n && v->frames[ct->x].f == ct->id &&
+	         ((v->frames[ct->x].flags & VS_FRAME_REF) ? 1 : 0) == ct->ref);
+	AG_MutexUnlock(&v->lock);
+	if (valid) {
+		su = VS_ClipReadFrame(v, ct->x, ct->w, ct->h);
+	}
+
+	AG_MutexLock(&vp->cueLock);
+	if ((cue = FindCue(vp, ct->id, ct->ref)) != NULL) {
+		cue->busy = 0;
+		if (cue->su == NULL && su != NULL &&
+		    ct->w == vp->cueW && ct->h == vp->cueH) {
+			cue->su = su;
+			su = NULL;
+		}
+	}
+	AG_MutexUnlock(&vp->cueLock);
+	if (su != NULL) {
+		AG_SurfaceFree(su);
+	}
+	free(ct);
+}
+
+/* Pin frame x if not already pinned. */
+static __inline__ void
+PinFrame(Uint8 *pinned, Uint *xs, Uint *nPinned, Uint nMax, Uint n, int x)
+{
+	if (x < 0 || x >= n || *nPinned >= nMax ||
+	    (pinned[x >> 3] & (1 << (x & 7)))) {
 		return;
 	}
+	pinned[x >> 3] |= (1 << (x & 7));
+	xs[(*nPinned)++] = (Uint)x;
+}
 
-	jpeg_create_decompress(&cinfo);
-	jpeg_stdio_src(&cinfo, f);
-	jpeg_read_header(&cinfo, TRUE);
-
-	/* Allocate Agar surface */
-	if (cinfo.num_components == 4) {
-		cinfo.out_color_space = JCS_CMYK;
-		cinfo.quantize_colors = FALSE;
-		jpeg_calc_output_dimensions(&cinfo);
-
-		su = AG_SurfaceRGBA(
-		    cinfo.output_width,
-		    cinfo.output_height,
-		    32,
-		    0,
-#if AG_BYTEORDER == AG_BIG_ENDIAN
-		    0x0000FF00, 0x00FF0000, 0xFF000000, 0x000000FF
-#else
-		    0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000
-#endif
-		);
-	} else {
-		cinfo.out_color_space = JCS_RGB;
-		cinfo.quantize_colors = FALSE;
-#if 1
-		/* For speed */
-		cinfo.scale_num   = 1;
-		cinfo.scale_denom = 1;
-		cinfo.dct_method = JDCT_FASTEST;
-		cinfo.do_fancy_upsampling = FALSE;
-#endif
-		jpeg_calc_output_dimensions(&cinfo);
-		su = AG_SurfaceRGB(
-		    cinfo.output_width,
-		    cinfo.output_height,
-		    24,
-		    0,
-#if AG_BYTEORDER == AG_BIG_ENDIAN
-		    0xff0000, 0x00ff00, 0x0000ff
-#else
-		    0x0000ff, 0x00ff00, 0xff0000
-#endif
-		);
+/*
+ * Update the set of pinned frames. Cue frames are pinned first, then the
+ * windows around them, then the loop regions, up to the memory budget.
+ * Project must be locked.
+ */
+static void
+UpdateCues(VS_Player *vp, VS_Clip *v)
+{
+	VS_CueFrame *cuesNew = NULL, *cue;
+	VS_CueTask *ct;
+	Uint8 *pinned = NULL;
+	Uint *xs = NULL;
+	Uint nMax, nPinned = 0, nCueKeys, nNew, i;
+	int w = vp->rVid.w, h = vp->rVid.h, d;
+	Uint64 frameSize = (Uint64)MAX(w,1)*MAX(h,1)*4;
+
+	AG_MutexLock(&v->lock);
+	vp->cueGen = v->cueGen;
+	vp->cueClipGen = v->gen;
+	nMax = (Uint)MIN((Uint64)v->n,
+	                 (Uint64)vsPlayerCueCacheMB*1024*1024/frameSize);
+	if (nMax > 0 && w > 0 && h > 0) {
+		if ((pinned = TryMalloc((v->n+7)/8)) == NULL ||
+		    (xs = TryMalloc(nMax*sizeof(Uint))) == NULL ||
+		    (cuesNew = TryMalloc(nMax*sizeof(VS_CueFrame))) == NULL) {
+			nMax = 0;
+		} else {
+			memset(pinned, 0, (v->n+7)/8);
+		}
 	}
-	if (su == NULL)
-		goto fail_free;
+	if (nMax > 0) {
+		for (i = 0; i < AG_KEY_LAST; i++) {
+			PinFrame(pinned, xs, &nPinned, nMax, v->n,
+			    v->kbdKeymap[i]);
+		}
+		if (v->midi != NULL) {
+			for (i = 0; i < VS_MIDI_MAXKEYS; i++)
+				PinFrame(pinned, xs, &nPinned, nMax, v->n,
+				    v->midi->keymap[i]);
+		}
+		nCueKeys = nPinned;
+		for (d = 1; d <= v->cueWindow; d++) {
+			for (i = 0; i < nCueKeys; i++) {
+				PinFrame(pinned, xs, &nPinned, nMax, v->n,
+				    (int)xs[i] + d);
+				PinFrame(pinned, xs, &nPinned, nMax, v->n,
+				    (int)xs[i] - d);
+			}
+		}
+		for (i = 0; i < v->nLoops; i++) {
+			VS_ClipLoop *lp = &v->loops[i];
+			Uint x;
 
-	/* Start decompression */
-	jpeg_start_decompress(&cinfo);
-	
-	while (cinfo.output_scanline < su->h) {
-		pRow[0] = (JSAMPROW)(Uint8 *)su->pixels +
-		          cinfo.output_scanline*su->pitch;
-		jpeg_read_scanlines(&cinfo, pRow, (JDIMENSION)1);
+			for (x = lp->start; x < lp->end && x < v->n; x++)
+				PinFrame(pinned, xs, &nPinned, nMax, v->n, x);
+		}
+		for (i = 0; i < nPinned; i++) {
+			VS_Frame *vf = &v->frames[xs[i]];
+
+			cuesNew[i].id = vf->f;
+			cuesNew[i].ref = (vf->flags & VS_FRAME_REF) ? 1 : 0;
+			cuesNew[i].x = xs[i];
+			cuesNew[i].su = NULL;
+			cuesNew[i].busy = 0;
+		}
+	}
+	AG_MutexUnlock(&v->lock);
+	Free(pinned);
+	Free(xs);
+
+	/* Sort by ID (recorded frames may share a source frame). */
+	qsort(cuesNew, nPinned, sizeof(VS_CueFrame), CompareCues);
+	for (i = 0, nNew = 0; i < nPinned; i++) {
+		if (nNew > 0 &&
+		    CompareCues(&cuesNew[nNew-1], &cuesNew[i]) == 0) {
+			continue;
+		}
+		cuesNew[nNew++] = cuesNew[i];
+	}
+
+	/* Keep the frames already decoded at this size. */
+	AG_MutexLock(&vp->cueLock);
+	for (i = 0; i < nNew; i++) {
+		if (vp->cueW != w || vp->cueH != h ||
+		    (cue = FindCue(vp, cuesNew[i].id, cuesNew[i].ref)) == NULL) {
+			continue;
+		}
+		cuesNew[i].su = cue->su;
+		cuesNew[i].busy = cue->busy;
+		cue->su = NULL;
 	}
+	for (i = 0; i < vp->nCues; i++) {
+		if (vp->cues[i].su != NULL)
+			AG_SurfaceFree(vp->cues[i].su);
+	}
+	Free(vp->cues);
+	vp->cues = cuesNew;
+	vp->nCues = nNew;
+	vp->cueW = w;
+	vp->cueH = h;
+
+	for (i = 0; i < nNew; i++) {
+		cue = &vp->cues[i];
+		if (cue->su != NULL || cue->busy ||
+		    (ct = TryMalloc(sizeof(VS_CueTask))) == NULL) {
+			continue;
+		}
+		ct->vp = vp;
+		ct->x = cue->x;
+		ct->id = cue->id;
+		ct->ref = cue->ref;
+		ct->w = w;
+		ct->h = h;
+		cue->busy = 1;
+		if (VS_PoolSubmit(VS_TASK_BACKGROUND, CueTask, ct,
+		    &vp->cueGrp) == -1) {
+			cue->busy = 0;
+			free(ct);
+		}
+	}
+	AG_MutexUnlock(&vp->cueLock);
+}
 
-	/*
-	 * Scale to preview size.
-	 * XXX TODO: interlacing
-	 */
-	suScaled = NULL;
-	if (AG_ScaleSurface(su, vp->rVid.w, vp->rVid.h, &suScaled) == -1) {
-		goto fail_free;
+/* Return a copy of frame x from the cue cache, or NULL if not pinned. */
+static AG_Surface *
+GetCue(VS_Player *vp, VS_Clip *v, Uint x)
+{
+	VS_Frame *vf = &v->frames[x];
+	VS_CueFrame *cue;
+	AG_Surface *su = NULL;
+
+	AG_MutexLock(&vp->cueLock);
+	if (vp->cueW == vp->rVid.w && vp->cueH == vp->rVid.h &&
+	    (cue = FindCue(vp, vf->f, (vf->flags & VS_FRAME_REF) ? 1 : 0))
+	    != NULL && cue->su != NULL) {
+		su = AG_SurfaceDup(cue->su);
 	}
+	AG_MutexUnlock(&vp->cueLock);
+	return (su);
+}
+
+static void
+MapFrame(VS_Player *vp, AG_Surface *su)
+{
 	if (vp->suScaled == -1) {
-		vp->suScaled = AG_WidgetMapSurface(vp, suScaled);
+		vp->suScaled = AG_WidgetMapSurface(vp, su);
 	} else {
-		AG_WidgetReplaceSurface(vp, vp->suScaled, suScaled);
+		AG_WidgetReplaceSurface(vp, vp->suScaled, su);
+	}
+}
+
+/* Update video from image file. */
+static void
+DrawFromJPEG(VS_Player *vp, VS_Clip *v, Uint x)
+{
+	AG_Surface *su;
+
+	if ((su = GetCue(vp, v, x)) != NULL) {
+		VS_StatsAdd(VS_STAT_CUE_HIT, 1);
+		MapFrame(vp, su);
+		goto prefetch;
+	}
+	AG_MutexLock(&vp->prefetchLock);
+	if (vp->suPrefetch != NULL && vp->xPrefetch == (int)x &&
+	    vp->suPrefetch->w == vp->rVid.w &&
+	    vp->suPrefetch->h == vp->rVid.h) {
+		su = vp->suPrefetch;
+		vp->suPrefetch = NULL;
+		vp->xPrefetch = -1;
 	}
-	AG_SurfaceFree(su);
+	AG_MutexUnlock(&vp->prefetchLock);
 
-	jpeg_finish_decompress(&cinfo);
-	jpeg_destroy_decompress(&cinfo);
-	return;
-fail_free:
-	if (vp->suScaled != -1) {
-		AG_WidgetUnmapSurface(vp, vp->suScaled);
-		vp->suScaled = -1;
+	/* XXX TODO: interlacing */
+	VS_StatsAdd((su != NULL) ? VS_STAT_PREFETCH_HIT : VS_STAT_FRAME_MISS, 1);
+	if (su == NULL &&
+	    (su = VS_ClipReadFrame(v, x, vp->rVid.w, vp->rVid.h)) == NULL) {
+		if (vp->suScaled != -1) {
+			AG_WidgetUnmapSurface(vp, vp->suScaled);
+			vp->suScaled = -1;
+		}
+		return;
+	}
+	MapFrame(vp, su);
+prefetch:
+	if ((vp->flags & VS_PLAYER_PLAYING) && x+1 < v->n)
+		Prefetch(vp, x+1);
+}
+
+/* Overlay the statistics summary (refreshed twice a second). */
+static void
+DrawHUD(VS_Player *vp)
+{
+	char text[512];
+	AG_Surface *su;
+	Uint64 t = VS_ClockNow();
+
+	if (vp->suHUD == -1 || t - vp->tHUD > 500000000) {
+		VS_StatsSummary(text, sizeof(text));
+		if ((su = AG_TextRender(text)) == NULL) {
+			return;
+		}
+		if (vp->suHUD == -1) {
+			vp->suHUD = AG_WidgetMapSurface(vp, su);
+		} else {
+			AG_WidgetReplaceSurface(vp, vp->suHUD, su);
+		}
+		vp->tHUD = t;
 	}
-	if (su != NULL) { AG_SurfaceFree(su); }
-	jpeg_finish_decompress(&cinfo);
-	jpeg_destroy_decompress(&cinfo);
+	AG_WidgetBlitSurface(vp, vp->suHUD, 4, 4);
 }
 
 static void
@@ -418,10 +697,11 @@ Draw(void *obj)
 	VS_Player *vp = obj;
 	VS_Clip *v = vp->clip;
 	VS_Project *vsp = v->proj;
+	AG_Surface *su;
 	int i;
 	
 	AG_ObjectLock(vsp);
-	if (vsp->procOp != VS_PROC_IDLE ||
+	if (vsp->procOp == VS_PROC_LOAD_VIDEO ||
 	    v->x >= v->n) {
 		AG_Color c;
 
@@ -429,27 +709,67 @@ Draw(void *obj)
 		AG_DrawBox(vp, &vp->rVid, -1, &c);
 		goto out;
 	}
+	if (v->cueGen != vp->cueGen || v->gen != vp->cueClipGen ||
+	    vp->rVid.w != vp->cueW || vp->rVid.h != vp->cueH) {
+		UpdateCues(vp, v);
+	}
 	if (vsPlayerLOD) {
 		if (vp->xLast != v->x ||
 		    vp->flags & VS_PLAYER_REFRESH) {
 			vp->xLast = v->x;
-			DrawFromThumb(vp, v->frames[v->x].thumb);
 			vp->flags &= ~(VS_PLAYER_REFRESH|VS_PLAYER_LOD);
+			if ((su = GetCue(vp, v, v->x)) != NULL) {
+				VS_StatsAdd(VS_STAT_CUE_HIT, 1);
+				MapFrame(vp, su);
+				vp->flags |= VS_PLAYER_LOD;
+			} else {
+				AG_Surface *thumb;
+
+				/* Thumbnails may still be loading. */
+				AG_MutexLock(&v->lock);
+				if ((thumb = v->frames[v->x].thumb) != NULL) {
+					DrawFromThumb(vp, thumb);
+				}
+				AG_MutexUnlock(&v->lock);
+				if (thumb == NULL) {
+					vp->flags |= VS_PLAYER_LOD;
+					DrawFromJPEG(vp, v, v->x);
+				}
+			}
 		} else {
 			if (!(vp->flags & VS_PLAYER_LOD) &&
 			    vp->lodTimeout++ > 5) {
 				vp->lodTimeout = 0;
 				vp->flags |= VS_PLAYER_LOD;
-				DrawFromJPEG(vp, v, &v->frames[v->x]);
+				DrawFromJPEG(vp, v, v->x);
 			}
 		}
 	} else {
-		DrawFromJPEG(vp, v, &v->frames[v->x]);
+		DrawFromJPEG(vp, v, v->x);
 	}
 
 	AG_PushClipRect(vp, &vp->rVid);
 	if (vp->suScaled != -1) {
+		Uint64 t0 = VS_ClockNow();
+
 		AG_WidgetBlitSurface(vp, vp->suScaled, 0, 0);
+		VS_StatsTime(VS_STAT_BLIT, t0);
+		/* Frames the clock played but which were never blitted. */
+		if (vp->nAdvanced > 1) {
+			VS_StatsAdd(VS_STAT_SKIPPED, vp->nAdvanced - 1);
+		}
+		vp->nAdvanced = 0;
+		if (v->tTrig != 0) {
+			VS_LatencyAdd(&vsp->latency[v->trigSrc],
+			    VS_ClockNow() - v->tTrig);
+			v->tTrig = 0;
+		}
+	}
+	if (vsPlayerHUD) {
+		DrawHUD(vp);
+	} else if (vp->suHUD != -1) {
+		AG_WidgetUnmapSurface(vp, vp->suHUD);
+		vp->suHUD = -1;
 	}
 	AG_PopClipRect(vp);
 out:
@@ -471,6 +791,7 @@ AudioUpdateStereo(const void *pIn, void *pOut, Ulong count,
 	VS_Player *vp = pData;
 	VS_Clip *v = vp->clip;
 	float *out = (float *)pOut;
+	Uint64 t0 = VS_ClockNow();
 	int ch;
 	Ulong i;
 
@@ -485,11 +806,13 @@ AudioUpdateStereo(const void *pIn, void *pOut, Ulong count,
 		v->sndPos+=2;
 	}
 
-	v->drift = v->sndPos - v->x*v->samplesPerFrame;
+	v->drift = v->sndPos - VS_ClipFrameToSample(v, v->x);
 	if (v->drift > v->samplesPerFrame*2 ||
-	    v->drift < v->samplesPerFrame*2) {
-		v->sndPos = v->x*v->samplesPerFrame;
+	    v->drift < -v->samplesPerFrame*2) {
+		v->sndPos = VS_ClipFrameToSample(v, v->x);
+		VS_StatsAdd(VS_STAT_AUDIO_RESYNC, 1);
 	}
+	VS_StatsTime(VS_STAT_AUDIO, t0);
 	return (paContinue);
 }
 
@@ -501,6 +824,7 @@ AudioUpdateMono(const void *pIn, void *pOut, Ulong count,
 	VS_Player *vp = pData;
 	VS_Clip *v = vp->clip;
 	float *out = (float *)pOut;
+	Uint64 t0 = VS_ClockNow();
 	Ulong i;
 	
 	for (i = 0; i < count; i++) {
@@ -512,11 +836,13 @@ AudioUpdateMono(const void *pIn, void *pOut, Ulong count,
 		v->sndPos++;
 	}
 
-	v->drift = v->sndPos - v->x*v->samplesPerFrame;
+	v->drift = v->sndPos - VS_ClipFrameToSample(v, v->x);
 	if (v->drift > v->samplesPerFrame*2 ||
-	    v->drift < v->samplesPerFrame*2) {
-		v->sndPos = v->x*v->samplesPerFrame;
+	    v->drift < -v->samplesPerFrame*2) {
+		v->sndPos = VS_ClipFrameToSample(v, v->x);
+		VS_StatsAdd(VS_STAT_AUDIO_RESYNC, 1);
 	}
+	VS_StatsTime(VS_STAT_AUDIO, t0);
 	return (paContinue);
 }
 
@@ -624,7 +950,7 @@ AG_WidgetClass vsPlayerClass = {
 		{ 0,0 },
 		Init,
 		NULL,		/* free */
-		NULL,		/* destroy */
+		Destroy,
 		NULL,		/* load */
 		NULL,		/* save */
 		NULL		/* edit */
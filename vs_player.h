@@ -6,6 +6,7 @@
 #include <agar/gui/widget.h>
 
 #include "vs_clip.h"
+#include "vs_pool.h"
 
 enum vs_player_button {
 	VS_PLAYER_REW,		/* Rewind to start of clip */
@@ -18,6 +19,15 @@ enum vs_player_button {
 
 #define VS_PLAYER_SINE_SIZE 200
 
+/* Frame pinned in the cue cache. */
+typedef struct vs_cue_frame {
+	Uint id;			/* On-disk frame ID */
+	int ref;			/* ID is in the source clip */
+	Uint x;				/* Position when pinned */
+	AG_Surface *su;			/* Decoded frame (or NULL) */
+	int busy;			/* Decode task pending */
+} VS_CueFrame;
+
 typedef struct vs_player {
 	struct ag_widget _inherit;
 
@@ -33,14 +43,29 @@ typedef struct vs_player {
 	VS_Clip *clip;		/* Associated video clip */
 	AG_Rect rVid;			/* Video area */
 	int xLast;			/* Last drawn frame */
+	Uint nAdvanced;			/* Playback advances since last blit */
 	int suScaled;			/* Scaled surface handle */
+	int suHUD;			/* Statistics overlay (or -1) */
+	Uint64 tHUD;			/* Time of last overlay update */
 	int lodTimeout;			/* Timeout before LOD increase */
+	AG_Mutex prefetchLock;		/* Lock on prefetch state */
+	AG_Surface *suPrefetch;		/* Decoded frame ahead of playhead */
+	int xPrefetch;			/* Frame in suPrefetch (or -1) */
+	int prefetchBusy;		/* Prefetch task pending */
+	VS_TaskGroup prefetchGrp;	/* For waiting on prefetch tasks */
+	AG_Mutex cueLock;		/* Lock on cue cache */
+	VS_CueFrame *cues;		/* Pinned frames (sorted by ID) */
+	Uint nCues;
+	Uint cueGen, cueClipGen;	/* Clip generations of the cue set */
+	int cueW, cueH;			/* Size of pinned frames */
+	VS_TaskGroup cueGrp;		/* For waiting on cue decode tasks */
 	AG_Button *btn[VS_PLAYER_LASTBTN]; /* Control buttons */
 	TAILQ_ENTRY(vs_player) players;	/* In project */
 } VS_Player;
 
 __BEGIN_DECLS
 extern AG_WidgetClass vsPlayerClass;
+extern int vsPlayerHUD;
 
 VS_Player *VS_PlayerNew(void *, Uint, VS_Clip *);
 void       VS_PlayerSizeHint(VS_Player *, Uint, Uint);
@@ -59,6 +84,7 @@ VS_PlayerUpdate(VS_Player *vp)
 		VS_Stop(vp);
 	} else {
 		vp->clip->x++;
+		vp->nAdvanced++;
 	}
 }
 __END_DECLS
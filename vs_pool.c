@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Process-wide work-stealing thread pool.
+ *
+ * Each worker owns one deque per priority class. Workers pop their own
+ * most recent task (LIFO) and steal the oldest task of other workers
+ * (FIFO) when their own deque is empty. Playback tasks are always taken
+ * before background tasks, and background tasks may never occupy every
+ * worker, so that a playback task never has to wait behind thumbnailing
+ * or analysis jobs.
+ *
+ * VS_TaskGroupWait() must not be called from a worker thread.
+ */
+
+#include <vislak.h>
+
+#include <unistd.h>
+
+typedef struct vs_task {
+	VS_TaskFn fn;			/* Task function */
+	void *arg;			/* User argument */
+	VS_TaskGroup *grp;		/* Group to notify (or NULL) */
+	TAILQ_ENTRY(vs_task) tasks;
+} VS_Task;
+
+TAILQ_HEAD(vs_taskq, vs_task);
+
+typedef struct vs_worker {
+	AG_Thread th;
+	int idx;			/* Index in vsWorkers[] */
+	AG_Mutex lock;			/* Lock on deques */
+	struct vs_taskq q[VS_TASK_LASTPRIO];
+} VS_Worker;
+
+static VS_Worker *vsWorkers = NULL;
+static int        vsWorkerCount = 0;
+static AG_ThreadKey vsWorkerKey;	/* VS_Worker of calling thread */
+
+static AG_Mutex vsPoolLock;		/* Lock on the counters below */
+static AG_Cond  vsPoolCond;		/* Signaled on new tasks */
+static Uint     vsPoolQueued[VS_TASK_LASTPRIO]; /* Unclaimed tasks */
+static int      vsPoolBusyBackground = 0; /* Workers on background tasks */
+static Uint     vsPoolNext = 0;		/* Round-robin for external submits */
+static int      vsPoolExit = 0;
+
+static void
+TaskGroupDone(VS_TaskGroup *grp)
+{
+	AG_MutexLock(&grp->lock);
+	if (--grp->nPending == 0) {
+		AG_CondBroadcast(&grp->cond);
+	}
+	AG_MutexUnlock(&grp->lock);
+}
+
+/*
+ * Claim a task of the given priority: our own newest task first, then
+ * the oldest task of the other workers.
+ */
+static VS_Task *
+GetTask(VS_Worker *w, enum vs_task_prio prio)
+{
+	VS_Task *t;
+	int i;
+
+	AG_MutexLock(&w->lock);
+	if ((t = TAILQ_LAST(&w->q[prio], vs_taskq)) != NULL) {
+		TAILQ_REMOVE(&w->q[prio], t, tasks);
+	}
+	AG_MutexUnlock(&w->lock);
+	if (t != NULL) {
+		return (t);
+	}
+	for (i = 1; i < vsWorkerCount; i++) {
+		VS_Worker *wVictim = &vsWorkers[(w->idx + i) % vsWorkerCount];
+
+		AG_MutexLock(&wVictim->lock);
+		if ((t = TAILQ_FIRST(&wVictim->q[prio])) != NULL) {
+			TAILQ_REMOVE(&wVictim->q[prio], t, tasks);
+		}
+		AG_MutexUnlock(&wVictim->lock);
+		if (t != NULL)
+			return (t);
+	}
+	return (NULL);
+}
+
+static void *
+WorkerThread(void *arg)
+{
+	VS_Worker *w = arg;
+	enum vs_task_prio prio;
+	VS_Task *t;
+
+	AG_ThreadKeySet(vsWorkerKey, w);
+
+	for (;;) {
+		AG_MutexLock(&vsPoolLock);
+		for (;;) {
+			if (vsPoolExit) {
+				AG_MutexUnlock(&vsPoolLock);
+				goto out;
+			}
+			if (vsPoolQueued[VS_TASK_PLAYBACK] > 0) {
+				prio = VS_TASK_PLAYBACK;
+				break;
+			}
+			if (vsPoolQueued[VS_TASK_BACKGROUND] > 0 &&
+			    vsPoolBusyBackground < vsWorkerCount-1) {
+				prio = VS_TASK_BACKGROUND;
+				vsPoolBusyBackground++;
+				break;
+			}
+			AG_CondWait(&vsPoolCond, &vsPoolLock);
+		}
+		vsPoolQueued[prio]--;
+		AG_MutexUnlock(&vsPoolLock);
+
+		/*
+		 * The counter guarantees that an unclaimed task of this
+		 * priority is sitting in one of the deques.
+		 */
+		while ((t = GetTask(w, prio)) == NULL)
+			continue;
+
+		t->fn(t->arg);
+		if (t->grp != NULL) {
+			TaskGroupDone(t->grp);
+		}
+		free(t);
+
+		if (prio == VS_TASK_BACKGROUND) {
+			AG_MutexLock(&vsPoolLock);
+			vsPoolBusyBackground--;
+			if (vsPoolQueued[VS_TASK_BACKGROUND] > 0) {
+				AG_CondSignal(&vsPoolCond);
+			}
+			AG_MutexUnlock(&vsPoolLock);
+		}
+	}
+out:
+	AG_ThreadExit(NULL);
+}
+
+/*
+ * Start the worker threads. If nWorkers is 0, use one worker per CPU.
+ * At least two workers are always created, so that one is available to
+ * playback tasks while the others process background tasks.
+ */
+int
+VS_PoolInit(int nWorkers)
+{
+	int i, prio;
+
+	if (nWorkers <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+		nWorkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+		nWorkers = 2;
+#endif
+	}
+	if (nWorkers < 2) {
+		nWorkers = 2;
+	}
+	if ((vsWorkers = TryMalloc(nWorkers*sizeof(VS_Worker))) == NULL) {
+		return (-1);
+	}
+	AG_MutexInit(&vsPoolLock);
+	AG_CondInit(&vsPoolCond);
+	AG_ThreadKeyCreate(&vsWorkerKey, NULL);
+	for (prio = 0; prio < VS_TASK_LASTPRIO; prio++) {
+		vsPoolQueued[prio] = 0;
+	}
+	vsPoolBusyBackground = 0;
+	vsPoolExit = 0;
+
+	for (i = 0; i < nWorkers; i++) {
+		VS_Worker *w = &vsWorkers[i];
+
+		w->idx = i;
+		AG_MutexInit(&w->lock);
+		for (prio = 0; prio < VS_TASK_LASTPRIO; prio++)
+			TAILQ_INIT(&w->q[prio]);
+	}
+	vsWorkerCount = nWorkers;
+	for (i = 0; i < nWorkers; i++) {
+		AG_ThreadCreate(&vsWorkers[i].th, WorkerThread, &vsWorkers[i]);
+	}
+	return (0);
+}
+
+/* Stop the worker threads. Tasks still queued are discarded. */
+void
+VS_PoolDestroy(void)
+{
+	VS_Task *t, *tNext;
+	int i, prio;
+
+	if (vsWorkerCount == 0)
+		return;
+
+	AG_MutexLock(&vsPoolLock);
+	vsPoolExit = 1;
+	AG_CondBroadcast(&vsPoolCond);
+	AG_MutexUnlock(&vsPoolLock);
+
+	for (i = 0; i < vsWorkerCount; i++) {
+		VS_Worker *w = &vsWorkers[i];
+
+		AG_ThreadJoin(w->th, NULL);
+		for (prio = 0; prio < VS_TASK_LASTPRIO; prio++) {
+			for (t = TAILQ_FIRST(&w->q[prio]);
+			     t != TAILQ_END(&w->q[prio]);
+			     t = tNext) {
+				tNext = TAILQ_NEXT(t, tasks);
+				if (t->grp != NULL) {
+					TaskGroupDone(t->grp);
+				}
+				free(t);
+			}
+		}
+		AG_MutexDestroy(&w->lock);
+	}
+	AG_CondDestroy(&vsPoolCond);
+	AG_MutexDestroy(&vsPoolLock);
+	Free(vsWorkers);
+	vsWorkers = NULL;
+	vsWorkerCount = 0;
+}
+
+/*
+ * Submit a task. If grp is not NULL, the task is accounted for in the
+ * group. Tasks submitted from a worker go to that worker's own deque;
+ * other threads distribute tasks round-robin. If the pool is not
+ * running, the task is executed immediately.
+ */
+int
+VS_PoolSubmit(enum vs_task_prio prio, VS_TaskFn fn, void *arg,
+    VS_TaskGroup *grp)
+{
+	VS_Worker *w;
+	VS_Task *t;
+
+	if (vsWorkerCount == 0) {
+		fn(arg);
+		return (0);
+	}
+	if ((t = TryMalloc(sizeof(VS_Task))) == NULL) {
+		return (-1);
+	}
+	t->fn = fn;
+	t->arg = arg;
+	t->grp = grp;
+	if (grp != NULL) {
+		AG_MutexLock(&grp->lock);
+		grp->nPending++;
+		AG_MutexUnlock(&grp->lock);
+	}
+
+	if ((w = AG_ThreadKeyGet(vsWorkerKey)) == NULL) {
+		AG_MutexLock(&vsPoolLock);
+		w = &vsWorkers[vsPoolNext++ % vsWorkerCount];
+		AG_MutexUnlock(&vsPoolLock);
+	}
+	AG_MutexLock(&w->lock);
+	TAILQ_INSERT_TAIL(&w->q[prio], t, tasks);
+	AG_MutexUnlock(&w->lock);
+
+	AG_MutexLock(&vsPoolLock);
+	vsPoolQueued[prio]++;
+	AG_CondSignal(&vsPoolCond);
+	AG_MutexUnlock(&vsPoolLock);
+	return (0);
+}
+
+int
+VS_PoolWorkerCount(void)
+{
+	return (vsWorkerCount);
+}
+
+void
+VS_TaskGroupInit(VS_TaskGroup *grp)
+{
+	AG_MutexInit(&grp->lock);
+	AG_CondInit(&grp->cond);
+	grp->nPending = 0;
+}
+
+void
+VS_TaskGroupDestroy(VS_TaskGroup *grp)
+{
+	AG_CondDestroy(&grp->cond);
+	AG_MutexDestroy(&grp->lock);
+}
+
+/* Wait until every task in the group has completed. */
+void
+VS_TaskGroupWait(VS_TaskGroup *grp)
+{
+	AG_MutexLock(&grp->lock);
+	while (grp->nPending > 0) {
+		AG_CondWait(&grp->cond, &grp->lock);
+	}
+	AG_MutexUnlock(&grp->lock);
+}
@@ -0,0 +1,33 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_POOL_H_
+#define _VISLAK_POOL_H_
+
+/* Task priority classes (in decreasing order of priority). */
+enum vs_task_prio {
+	VS_TASK_PLAYBACK,		/* Playback-critical (prefetch, decode) */
+	VS_TASK_BACKGROUND,		/* Background (thumbnails, analysis) */
+	VS_TASK_LASTPRIO
+};
+
+typedef void (*VS_TaskFn)(void *);
+
+/* Set of tasks which can be waited on as a whole. */
+typedef struct vs_task_group {
+	AG_Mutex lock;
+	AG_Cond cond;
+	Uint nPending;			/* Tasks not yet completed */
+} VS_TaskGroup;
+
+__BEGIN_DECLS
+int  VS_PoolInit(int);
+void VS_PoolDestroy(void);
+int  VS_PoolSubmit(enum vs_task_prio, VS_TaskFn, void *, VS_TaskGroup *);
+int  VS_PoolWorkerCount(void);
+
+void VS_TaskGroupInit(VS_TaskGroup *);
+void VS_TaskGroupDestroy(VS_TaskGroup *);
+void VS_TaskGroupWait(VS_TaskGroup *);
+__END_DECLS
+
+#endif /* _VISLAK_POOL_H_ */
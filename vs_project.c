@@ -34,6 +34,18 @@
 #include <unistd.h>
 #include <errno.h>
 
+/*
+ * Update the number of audio samples per video frame of a clip, after an
+ * audio load or a change of the frame rate. Project must be locked.
+ */
+static void
+UpdateSamplesPerFrame(VS_Clip *v, int fps)
+{
+	AG_MutexLock(&v->sndLock);
+	v->samplesPerFrame = (fps > 0) ? v->sndInfo.samplerate/fps : 0;
+	AG_MutexUnlock(&v->sndLock);
+}
+
 /* Load audio stream. */
 static int
 LoadAudio(VS_Clip *v)
@@ -46,8 +58,7 @@ LoadAudio(VS_Clip *v)
 	if (v->sndFile != NULL) {
 		sf_close(v->sndFile);
 		Free(v->sndBuf); v->sndBuf = NULL;
-		Free(v->sndViz); v->sndViz = NULL;
-		v->sndVizFrames = 0;
+		VS_ClipFreeViz(v);
 	}
 	memset(&v->sndInfo, 0, sizeof(v->sndInfo));
 	v->sndPos = 0;
@@ -64,7 +75,8 @@ LoadAudio(VS_Clip *v)
 	while (nReadFrames < v->sndInfo.frames) {
 		sf_count_t rv;
 
-		rv = sf_readf_float(v->sndFile, &v->sndBuf[nReadFrames], 4096);
+		rv = sf_readf_float(v->sndFile,
+		    &v->sndBuf[nReadFrames*v->sndInfo.channels], 4096);
 		if (rv == 0) {
 			break;
 		}
@@ -72,7 +84,9 @@ LoadAudio(VS_Clip *v)
 	}
 
 	/* Compute the approximate number of audio samples per video frame */
-	v->samplesPerFrame = v->sndInfo.samplerate/vsp->frameRate;
+	AG_ObjectLock(vsp);
+	UpdateSamplesPerFrame(v, vsp->frameRate);
+	AG_ObjectUnlock(vsp);
 
 	/* Compute a reduced waveform for visualization purposes. */
 	if (sf_command(v->sndFile, SFC_CALC_SIGNAL_MAX, &v->sndPeakSignal,
@@ -97,6 +111,10 @@ LoadAudio(VS_Clip *v)
 		}
 		v->sndViz[i] /= frames_px*v->sndInfo.channels;
 	}
+	if (VS_ClipBuildViz(v) == -1) {
+		goto fail;
+	}
+	v->gen++;
 
 	VS_Status(vsp,
 	    _("Audio import successful (%d-Ch, %dHz, %lu frames)"),
@@ -108,206 +126,674 @@ fail:
 	sf_close(v->sndFile);
 	v->sndFile = NULL;
 	Free(v->sndBuf);
-	Free(v->sndViz);
+	v->sndBuf = NULL;
+	VS_ClipFreeViz(v);
 	return (-1);
 }
 
-/* Load a clip's video frames. */
+/* Decode the thumbnail of an imported frame (pool task). */
+typedef struct vs_import_task {
+	VS_Clip *v;
+	Uint f;				/* Frame slot (or position when queued) */
+	Uint id;			/* On-disk frame ID */
+	int rv;				/* Result */
+} VS_ImportTask;
+
+static void
+ImportFrameTask(void *arg)
+{
+	VS_ImportTask *t = arg;
+	VS_Project *vsp = t->v->proj;
+	AG_Surface *thumb;
+
+	if (VS_ProjectCancelled(vsp) ||
+	    (thumb = VS_ClipReadThumb(t->v, t->id)) == NULL) {
+		return;
+	}
+	AG_MutexLock(&t->v->lock);
+	t->v->frames[t->f].thumb = thumb;	/* Slot is past v->n */
+	AG_MutexUnlock(&t->v->lock);
+	t->rv = 0;
+	AG_ObjectLock(vsp);
+	vsp->gui.progress.val++;
+	AG_ObjectUnlock(vsp);
+}
+
+/*
+ * Import the numbered image files of a clip. Thumbnails are generated
+ * in parallel as background tasks on the thread pool, into slots past
+ * v->n; deletions are refused until the import completes so that the
+ * slots stay in place.
+ */
 static int
 LoadVideoFrames(VS_Clip *v)
 {
 	VS_Project *vsp = v->proj;
 	char path[AG_PATHNAME_MAX];
-	AG_Dir *d;
-	Uint i;
-	int fileOk;
+	VS_ImportTask *tasks;
+	VS_TaskGroup grp;
+	VS_Frame *framesNew;
+	Uint i, nFirst, idFirst, nNew, nOk;
 	
 	vsp->gui.progress.min = 0;
 	vsp->gui.progress.max = 0;
 	vsp->gui.progress.val = 0;
 
-	AG_MutexLock(&v->lock);
+	/* Count the image files available. */
+	for (nNew = 0, i = v->fileFirst + v->nIDs;
+	     v->fileLast == -1 || i < (Uint)v->fileLast;
+	     nNew++, i++) {
+		Snprintf(path, sizeof(path), v->fileFmt, v->dir, i);
+		if (AG_FileExists(path) != 1)
+			break;
+	}
+	if (nNew == 0) {
+		AG_SetError(_("No frames found in %s"), v->dir);
+		return (-1);
+	}
+	if ((tasks = TryMalloc(nNew*sizeof(VS_ImportTask))) == NULL)
+		return (-1);
 
-	if ((d = AG_OpenDir(v->dir)) == NULL) {
+	AG_MutexLock(&v->lock);
+	if ((framesNew = TryRealloc(v->frames, (v->n + nNew)*sizeof(VS_Frame)))
+	    == NULL) {
 		AG_MutexUnlock(&v->lock);
+		Free(tasks);
 		return (-1);
 	}
-	vsp->gui.progress.val = v->fileFirst;
-	vsp->gui.progress.max = (v->fileLast != -1) ? v->fileLast : d->nents;
-	AG_CloseDir(d);
+	v->frames = framesNew;
+	nFirst = v->n;
+	idFirst = v->nIDs;
+	for (i = 0; i < nNew; i++) {
+		VS_Frame *vf = &v->frames[nFirst+i];
+
+		vf->thumb = NULL;
+		vf->f = idFirst+i;
+		vf->flags = 0;
+		vf->midiKey = -1;
+		vf->kbdKey = -1;
+	}
+	v->busy = _("import");
+	AG_MutexUnlock(&v->lock);
 
-	i = v->fileFirst;
-	do {
-		Snprintf(path, sizeof(path), v->fileFmt, v->dir, i);
+	VS_Status(vsp, _("Importing %u frames from %s"), nNew, v->dir);
+	vsp->gui.progress.max = nNew;
 
-		if (AG_FileExists(path) == -1) {
-			fileOk = 0;
-		} else {
-			AG_MutexUnlock(&v->lock);
-			VS_Status(vsp, _("Importing: %s"), path);
-			fileOk = (VS_ClipAddFrame(v, path) == 0) ? 1 : 0;
-			AG_MutexLock(&v->lock);
-		}
-		vsp->gui.progress.val++;
-		i++;
-	} while (fileOk && (v->fileLast == -1 || i < v->fileLast));
-	if (i > 0) { v->x = 1; }
+	VS_TaskGroupInit(&grp);
+	for (i = 0; i < nNew; i++) {
+		VS_ImportTask *t = &tasks[i];
+
+		t->v = v;
+		t->f = nFirst+i;
+		t->id = idFirst+i;
+		t->rv = -1;
+		VS_PoolSubmit(VS_TASK_BACKGROUND, ImportFrameTask, t, &grp);
+	}
+	VS_TaskGroupWait(&grp);
+	VS_TaskGroupDestroy(&grp);
+
+	/* Keep the frames up to the first failure (or cancellation). */
+	for (nOk = 0; nOk < nNew && tasks[nOk].rv == 0; nOk++)
+		;
+	AG_MutexLock(&v->lock);
+	for (i = nOk; i < nNew; i++) {
+		VS_Frame *vf = &v->frames[nFirst+i];
+
+		if (vf->thumb != NULL)
+			AG_SurfaceFree(vf->thumb);
+	}
+	v->n = nFirst + nOk;
+	v->nIDs = idFirst + nOk;
+	v->busy = NULL;
+	v->gen++;
+	if (nOk > 0) { v->x = 1; }
 
 	VS_Status(vsp, _("Loaded %u video frames"), v->n);
 	vsp->gui.progress.val = vsp->gui.progress.max;
-	
 	AG_MutexUnlock(&v->lock);
+
+	Free(tasks);
 	return (0);
 }
 
-void
-VS_ProjectRunOperation(VS_Project *vsp, VS_ProcOp op)
+/*
+ * Load the thumbnail of a frame of an opened project (pool task). The
+ * clip may have been edited since the task was queued, so the frame is
+ * looked up again by its ID.
+ */
+static void
+LoadThumbTask(void *arg)
 {
+	VS_ImportTask *t = arg;
+	VS_Project *vsp = t->v->proj;
+	AG_Surface *thumb;
+
+	if (VS_ProjectCancelled(vsp) ||
+	    (thumb = VS_ClipReadThumb(t->v, t->id)) == NULL) {
+		return;
+	}
+	(void)VS_ClipSetThumb(t->v, t->id, t->f, thumb);
+	t->rv = 0;
 	AG_ObjectLock(vsp);
-	vsp->procOp = op;
+	vsp->gui.progress.val++;
 	AG_ObjectUnlock(vsp);
 }
 
-/* Process one output frame while in recording mode. */
-static void
-ProcessRecording(VS_Project *vsp)
+/*
+ * Queue thumbnail loads for up to nMax frames of v which own their image
+ * file, starting from the playhead. Returns the number of tasks queued.
+ */
+static Uint
+QueueThumbs(VS_Clip *v, VS_ImportTask *tasks, Uint nMax, VS_TaskGroup *grp)
+{
+	Uint i, x, nTasks = 0;
+
+	AG_MutexLock(&v->lock);
+	for (i = 0; i < v->n && nTasks < nMax; i++) {
+		VS_Frame *vf;
+
+		x = (v->x + i) % v->n;
+		vf = &v->frames[x];
+		if ((vf->flags & VS_FRAME_REF) || vf->thumb != NULL) {
+			continue;
+		}
+		tasks[nTasks].v = v;
+		tasks[nTasks].f = x;
+		tasks[nTasks].id = vf->f;
+		tasks[nTasks].rv = -1;
+		nTasks++;
+	}
+	AG_MutexUnlock(&v->lock);
+
+	for (i = 0; i < nTasks; i++) {
+		VS_PoolSubmit(VS_TASK_BACKGROUND, LoadThumbTask, &tasks[i],
+		    grp);
+	}
+	return (nTasks);
+}
+
+/*
+ * Load the thumbnails of the clips of a project opened from file, and
+ * share the input thumbnails with the recorded frames of the output clip.
+ */
+static int
+LoadThumbs(VS_Project *vsp)
 {
-	char pathIn[AG_PATHNAME_MAX];
-	char pathOut[AG_PATHNAME_MAX];
 	VS_Clip *vIn = vsp->input;
 	VS_Clip *vOut = vsp->output;
-	Uint i;
+	VS_ImportTask *tasks;
+	VS_TaskGroup grp;
+	int *idx;
+	Uint i, n, nIn, nOk;
 
-	AG_MutexLock(&vOut->lock);
 	AG_MutexLock(&vIn->lock);
-	if (VS_ClipCopyFrame(vOut, vIn, vIn->x) == -1) {
-		goto stop;
-	}
-	/* Format: %s,%u */
-	snprintf(pathIn, sizeof(pathIn), vIn->fileFmt,
-	    vIn->dir, (vIn->x + 1));
-	snprintf(pathOut, sizeof(pathOut), vOut->fileFmt,
-	    vOut->dir, (vOut->n - 1));
-relink:
-	if (link(pathIn, pathOut) == -1) {
-		if (errno == EEXIST) {
-			unlink(pathOut);
-			goto relink;
-		}
-		AG_SetError("link(%s -> %s): %s", pathIn, pathOut,
-		    AG_Strerror(errno));
-		goto stop;
-	}
+	nIn = vIn->n;
 	AG_MutexUnlock(&vIn->lock);
+	AG_MutexLock(&vOut->lock);
+	n = nIn + vOut->n;
 	AG_MutexUnlock(&vOut->lock);
-	return;
-stop:
-	VS_Status(vsp, _("Recording interrupted: %s"), AG_GetError());
-	vsp->flags &= ~(VS_PROJECT_RECORDING);
-	AG_MutexUnlock(&vIn->lock);
+	if (n == 0) {
+		return (0);
+	}
+	if ((tasks = TryMalloc(n*sizeof(VS_ImportTask))) == NULL)
+		return (-1);
+
+	vsp->gui.progress.min = 0;
+	vsp->gui.progress.max = n;
+	vsp->gui.progress.val = 0;
+	VS_Status(vsp, _("Loading %u thumbnails"), n);
+
+	VS_TaskGroupInit(&grp);
+	nIn = QueueThumbs(vIn, tasks, n, &grp);
+	n = nIn + QueueThumbs(vOut, &tasks[nIn], n-nIn, &grp);
+	vsp->gui.progress.max = n;
+	VS_TaskGroupWait(&grp);
+	VS_TaskGroupDestroy(&grp);
+	for (i = 0, nOk = 0; i < n; i++) {
+		if (tasks[i].rv == 0)
+			nOk++;
+	}
+	Free(tasks);
+
+	AG_MutexLock(&vOut->lock);
+	if (vOut->src == vIn &&
+	    (idx = TryMalloc((vIn->nIDs+1)*sizeof(int))) != NULL) {
+		AG_MutexLock(&vIn->lock);
+		for (i = 0; i < vIn->nIDs; i++) {
+			idx[i] = -1;
+		}
+		for (i = 0; i < vIn->n; i++) {
+			if (vIn->frames[i].f < vIn->nIDs)
+				idx[vIn->frames[i].f] = i;
+		}
+		for (i = 0; i < vOut->n; i++) {
+			VS_Frame *vf = &vOut->frames[i];
+
+			if ((vf->flags & VS_FRAME_REF) && vf->thumb == NULL &&
+			    vf->f < vIn->nIDs && idx[vf->f] != -1)
+				vf->thumb = vIn->frames[idx[vf->f]].thumb;
+		}
+		AG_MutexUnlock(&vIn->lock);
+		vOut->gen++;
+		Free(idx);
+	}
 	AG_MutexUnlock(&vOut->lock);
+
+	vsp->gui.progress.val = vsp->gui.progress.max;
+	if (nOk < n) {
+		AG_SetError(_("%u of %u frames could not be decoded"),
+		    n-nOk, n);
+		return (-1);
+	}
+	VS_Status(vsp, _("Loaded %u thumbnails"), n);
+	return (0);
 }
 
 /*
- * Processing thread for asynchronous per-project operations.
+ * Queue an operation for execution by the project's job thread.
+ * Returns a job ID which can be passed to VS_ProjectCancelOperation(),
+ * or 0 on failure.
+ */
+Uint
+VS_ProjectRunOperation(VS_Project *vsp, VS_ProcOp op, const char *path,
+    int arg)
+{
+	VS_ProcJob *job;
+	Uint id;
+
+	if ((job = TryMalloc(sizeof(VS_ProcJob))) == NULL) {
+		return (0);
+	}
+	job->op = op;
+	job->path = (path != NULL) ? Strdup(path) : NULL;
+	job->arg = arg;
+
+	AG_MutexLock(&vsp->jobLock);
+	id = job->id = ++vsp->jobLastID;
+	TAILQ_INSERT_TAIL(&vsp->jobs, job, jobs);
+	AG_CondSignal(&vsp->jobCond);
+	AG_MutexUnlock(&vsp->jobLock);
+	return (id);
+}
+
+/*
+ * Cancel a queued or running operation (or all operations if id is 0).
+ * Running operations are interrupted at their next VS_ProjectCancelled()
+ * check.
+ */
+void
+VS_ProjectCancelOperation(VS_Project *vsp, Uint id)
+{
+	VS_ProcJob *job, *jobNext;
+
+	AG_MutexLock(&vsp->jobLock);
+	for (job = TAILQ_FIRST(&vsp->jobs);
+	     job != TAILQ_END(&vsp->jobs);
+	     job = jobNext) {
+		jobNext = TAILQ_NEXT(job, jobs);
+		if (id == 0 || job->id == id) {
+			TAILQ_REMOVE(&vsp->jobs, job, jobs);
+			Free(job->path);
+			free(job);
+		}
+	}
+	if (vsp->jobCur != NULL &&
+	    (id == 0 || vsp->jobCur->id == id)) {
+		vsp->jobCancel = 1;
+	}
+	AG_MutexUnlock(&vsp->jobLock);
+}
+
+/*
+ * Wait until all queued operations have completed. Returns the number
+ * of operations which failed since the last call.
+ */
+Uint
+VS_ProjectWaitOperations(VS_Project *vsp)
+{
+	Uint nFailed;
+
+	AG_MutexLock(&vsp->jobLock);
+	while (!TAILQ_EMPTY(&vsp->jobs) || vsp->jobCur != NULL) {
+		AG_CondWait(&vsp->jobDone, &vsp->jobLock);
+	}
+	nFailed = vsp->jobFailed;
+	vsp->jobFailed = 0;
+	AG_MutexUnlock(&vsp->jobLock);
+	return (nFailed);
+}
+
+/* Return 1 if the running operation has been cancelled. */
+int
+VS_ProjectCancelled(VS_Project *vsp)
+{
+	int rv;
+
+	AG_MutexLock(&vsp->jobLock);
+	rv = vsp->jobCancel;
+	AG_MutexUnlock(&vsp->jobLock);
+	return (rv);
+}
+
+/*
+ * Process one output frame while in recording mode. The output playhead
+ * advances with the take, so that the audio callbacks stay in sync with
+ * the frames being recorded.
+ */
+static void
+ProcessRecording(VS_Project *vsp)
+{
+	if (VS_ClipRecordFrame(vsp->output, vsp->input, vsp->input->x) == -1) {
+		VS_Status(vsp, _("Recording interrupted: %s"), AG_GetError());
+		vsp->flags &= ~(VS_PROJECT_RECORDING);
+		return;
+	}
+	vsp->output->x++;
+}
+
+/*
+ * Advance the playheads by one frame period. Project must be locked.
+ */
+static void
+ProcessFrame(VS_Project *vsp)
+{
+	VS_Clip *vIn = vsp->input;
+	VS_Clip *vOut = vsp->output;
+	Uint64 tFrame;
+	Uint xPrev;
+
+	if (vsp->flags & VS_PROJECT_RECORDING) {
+		if (vsp->procOp == VS_PROC_RENDER_TAKE) {
+			VS_Status(vsp, _("Cannot record during a render"));
+			vsp->flags &= ~(VS_PROJECT_RECORDING);
+			return;
+		}
+		if (!vsp->evlog.active) {
+			VS_EventLogStart(&vsp->evlog, vIn->x,
+			    (float)(vIn->xVel*vsp->frameRate));
+		}
+		ProcessRecording(vsp);
+	} else if (vsp->evlog.active) {
+		/*
+		 * Recording was stopped. Expanding the take into frames is
+		 * left to the job thread, so the clip is not locked here
+		 * for the length of the take.
+		 */
+		VS_EventLogStop(&vsp->evlog);
+		VS_ProjectRunOperation(vsp, VS_PROC_COMMIT_TAKE, NULL, 0);
+	}
+
+	/* Apply the MIDI input received up to this frame's deadline. */
+	tFrame = VS_ClockDeadline(&vsp->clock, vsp->clock.k);
+	if (vIn->midi != NULL)
+		VS_MidiProcessInput(vIn->midi, tFrame);
+	if (vOut->midi != NULL)
+		VS_MidiProcessInput(vOut->midi, tFrame);
+	if (vIn->midi != NULL && (vIn->midi->flags & VS_MIDI_OUTPUT))
+		VS_MidiUpdateOutput(vIn->midi);
+
+	/* Process frame movement */
+	xPrev = vIn->x;
+	vIn->x = VS_ClipStep(vIn->x, vIn->n, vIn->xVel, &vIn->xVelCur);
+	if (vIn->nLoops > 0)
+		VS_ClipLoopStep(vIn, xPrev);
+
+	if (vsp->gui.playerIn != NULL)
+		VS_PlayerUpdate(vsp->gui.playerIn);
+	if (vsp->gui.playerOut != NULL)
+		VS_PlayerUpdate(vsp->gui.playerOut);
+}
+
+/*
+ * Frame clock thread. Sleeps until the absolute deadline of the next
+ * frame (see vs_clock.c) and then advances the playheads. Frame updates
+ * are suspended only while video frames are being imported.
  */
 static void *
 ProcessThread(void *pProj)
 {
 	VS_Project *vsp = pProj;
-	Uint32 t1, t2 = 0;
-	int rCur = 0, delta;
+	VS_Clock *clk = &vsp->clock;
+	Uint64 t0;
+	int late, period;
 	
-	t1 = AG_GetTicks();
-	for (;;) {
-		VS_Clip *vIn, *vOut;
+	AG_ObjectLock(vsp);
+	VS_ClockInit(clk, 1, vsp->frameRate);
+	AG_ObjectUnlock(vsp);
 
-		t2 = AG_GetTicks();
+	for (;;) {
 		AG_ObjectLock(vsp);
-		vIn = vsp->input;
-		vOut = vsp->output;
+		if (vsp->procExit) {
+			AG_ObjectUnlock(vsp);
+			break;
+		}
+		if (vsp->procOp != VS_PROC_LOAD_VIDEO) {
+			if (clk->num != 1 || clk->den != (Uint)vsp->frameRate) {
+				VS_ClockSetPeriod(clk, 1, vsp->frameRate);
+				UpdateSamplesPerFrame(vsp->output,
+				    vsp->frameRate);
+			}
+			t0 = VS_ClockNow();
+			ProcessFrame(vsp);
+			VS_StatsTime(VS_STAT_FRAME, t0);
+		}
+		AG_ObjectUnlock(vsp);
 
-		if (vsp->procOp == VS_PROC_IDLE &&	     /* Video update */
-		    (t2 - t1) >= (1000/vsp->frameRate)) {
+		/* Count the frame periods missed by a late wakeup. */
+		period = (int)((Uint64)clk->num*1000000/clk->den);
+		if ((late = VS_ClockWait(clk)) >= period && period > 0)
+			VS_StatsAdd(VS_STAT_LATE, late/period);
+	}
+	AG_ThreadExit(NULL);
+}
 
-			if (vsp->flags & VS_PROJECT_RECORDING) {
-				ProcessRecording(vsp);
-			}
-			vOut->samplesPerFrame = vOut->sndInfo.samplerate /
-			                        vsp->frameRate;
-
-			/* Process frame movement */
-			if (vIn->xVel < -1.0 ||
-			    vIn->xVel > +1.0) {		/* >=1 frame */
-				delta = (int)vIn->xVel;
-				if ((vIn->x+delta) < vIn->n) {
-					vIn->x += (int)vIn->xVel;
-				}
-			} else if (vIn->xVel != 0.0) {	/* Sub-frame */
-				vIn->xVelCur += vIn->xVel;
-				if (vIn->xVelCur <= -1.0 ||
-				    vIn->xVelCur >= 1.0) {
-					delta = (vIn->xVelCur < 0) ? -1 : 1;
-					vIn->xVelCur = 0.0;
-					if ((vIn->x+delta) < vIn->n)
-						vIn->x += delta;
-				}
-			}
+/* Snapshot the project after an edit which is not journaled. */
+static void
+Checkpoint(VS_Project *vsp)
+{
+	VS_JournalTouch(vsp);
+	if (VS_JournalCheckpoint(vsp, NULL) == -1)
+		VS_Status(vsp, _("Autosave failed: %s"), AG_GetError());
+}
 
-			VS_PlayerUpdate(vsp->gui.playerIn);
-			VS_PlayerUpdate(vsp->gui.playerOut);
+/* Execute a queued operation. */
+static int
+RunJob(VS_Project *vsp, VS_ProcJob *job)
+{
+	VS_Clip *vIn = vsp->input;
+	VS_Clip *vOut = vsp->output;
+	Uint nMoved, nRemoved;
+	int rv;
+
+	switch (job->op) {
+	case VS_PROC_LOAD_VIDEO:
+		if (LoadVideoFrames(vIn) == -1) {
+			VS_Status(vsp, _("Video import failed: %s"),
+			    AG_GetError());
+			return (-1);
+		}
+		if (vIn->audioFile != NULL) {
+			VS_ProjectRunOperation(vsp, VS_PROC_LOAD_AUDIO, NULL, 0);
+		}
+		Checkpoint(vsp);
+		break;
+	case VS_PROC_LOAD_AUDIO:
+		if (vsp->gui.playerOut != NULL) {
+			VS_Stop(vsp->gui.playerOut);
+		}
+		if (LoadAudio(vOut) == -1) {
+			VS_Status(vsp, _("Audio import failed: %s"),
+			    AG_GetError());
+			return (-1);
+		}
+		if (job->arg == 0)			/* Not a reload */
+			Checkpoint(vsp);
+		break;
+	case VS_PROC_RENDER_AUDIO:
+		if (VS_RenderAudio(vOut, job->path, job->arg) == -1) {
+			VS_Status(vsp, _("Audio render failed: %s"),
+			    AG_GetError());
+			return (-1);
+		}
+		VS_Status(vsp, _("Rendered audio for %u frames to %s"),
+		    vOut->n, AG_ShortFilename(job->path));
+		break;
+	case VS_PROC_EXPORT_VIDEO:
+		switch (VS_EXPORT_FORMAT(job->arg)) {
+		case VS_EXPORT_MOV:
+			rv = VS_ExportMOV(vOut, job->path);
+			break;
+		case VS_EXPORT_Y4M:
+			rv = VS_ExportY4M(vOut, job->path,
+			    VS_EXPORT_HEIGHT(job->arg));
+			break;
+		default:
+			AG_SetError("Bad export format: %d", job->arg);
+			rv = -1;
+			break;
+		}
+		if (rv == -1) {
+			VS_Status(vsp, _("Export failed: %s"), AG_GetError());
+			return (-1);
+		}
+		VS_Status(vsp, _("Exported %u frames to %s"),
+		    vOut->n, AG_ShortFilename(job->path));
+		break;
+	case VS_PROC_RENDER_TAKE:
+		if (VS_EventLogRender(&vsp->evlog, vIn, vOut, job->arg) == -1) {
+			VS_Status(vsp, _("Render failed: %s"), AG_GetError());
+			return (-1);
+		}
+		VS_Status(vsp, _("Rendered performance at %d fps (%u frames)"),
+		    job->arg, vOut->n);
+		break;
+	case VS_PROC_COMPACT:
+		if (VS_ClipCompact(vIn, &nMoved, &nRemoved) == -1) {
+			VS_Status(vsp, _("Compaction failed: %s"),
+			    AG_GetError());
+			return (-1);
+		}
+		VS_Status(vsp, _("Compacted frame files (%u renamed, %u removed)"),
+		    nMoved, nRemoved);
+		Checkpoint(vsp);
+		break;
+	case VS_PROC_LOAD_THUMBS:
+		if (LoadThumbs(vsp) == -1) {
+			VS_Status(vsp, _("Thumbnail load failed: %s"),
+			    AG_GetError());
+			return (-1);
+		}
+		break;
+	case VS_PROC_COMMIT_TAKE:
+		if (VS_ClipCommitEdits(vOut) == -1) {
+			VS_Status(vsp, _("Recording lost: %s"), AG_GetError());
+			return (-1);
+		}
+		AG_ObjectLock(vsp);
+		if (vOut->n > 0 && !(vsp->flags & VS_PROJECT_RECORDING)) {
+			vOut->x = vOut->n - 1;
+		}
+		AG_ObjectUnlock(vsp);
+		break;
+	default:
+		AG_SetError("Bad operation: %d", (int)job->op);
+		return (-1);
+	}
+	return (0);
+}
 
-			if (vsp->flags & VS_PROJECT_RECORDING) {
-				if (vOut->n > 1)
-					vOut->x++;
-			}
+/*
+ * Job thread. Waits on jobCond for queued operations and executes them
+ * in order, concurrently with the frame clock. Completed operations are
+ * queued on jobsDone, for ReportProcDone() to announce from the GUI.
+ */
+static void *
+JobThread(void *pProj)
+{
+	VS_Project *vsp = pProj;
+	VS_ProcJob *job;
+	int rv;
 
-			/* Update the effective refresh rate */
-			t1 = AG_GetTicks();
-			rCur = (1000/vsp->frameRate) - (t1-t2);
-			if (rCur < 1) { rCur = 1; }
-		} else {
-			switch (vsp->procOp) {
-			case VS_PROC_LOAD_VIDEO:
-				AG_ObjectUnlock(vsp);
-				if (LoadVideoFrames(vIn) == -1) {
-					VS_Status(vsp,
-					    _("Video import failed: %s"),
-					    AG_GetError());
-				}
-				AG_ObjectLock(vsp);
-				vsp->procOp = (vIn->audioFile != NULL) ?
-				    VS_PROC_LOAD_AUDIO :
-				    VS_PROC_IDLE;
-				break;
-			case VS_PROC_LOAD_AUDIO:
-				AG_ObjectUnlock(vsp);
-				if (LoadAudio(vOut) == -1) {
-					VS_Status(vsp,
-					    _("Audio import failed: %s"),
-					    AG_GetError());
-				}
-				AG_ObjectLock(vsp);
-				vsp->procOp = VS_PROC_IDLE;
-				break;
-			case VS_PROC_TERMINATE:
-				VS_Status(vsp, _("Terminating"));
-				vsp->procOp = VS_PROC_INIT;
-				AG_ObjectUnlock(vsp);
-				goto out;
-			default:
-				AG_ObjectUnlock(vsp);
-				AG_Delay(1);
-				AG_ObjectLock(vsp);
-				break;
-			}
+	for (;;) {
+		AG_MutexLock(&vsp->jobLock);
+		while ((job = TAILQ_FIRST(&vsp->jobs)) == NULL &&
+		       !vsp->procExit) {
+			AG_CondWait(&vsp->jobCond, &vsp->jobLock);
+		}
+		if (vsp->procExit) {
+			AG_MutexUnlock(&vsp->jobLock);
+			break;
 		}
+		TAILQ_REMOVE(&vsp->jobs, job, jobs);
+		vsp->jobCur = job;
+		vsp->jobCancel = 0;
+		AG_MutexUnlock(&vsp->jobLock);
+
+		AG_ObjectLock(vsp);
+		vsp->procOp = job->op;
 		AG_ObjectUnlock(vsp);
+
+		rv = RunJob(vsp, job);
+
+		AG_ObjectLock(vsp);
+		vsp->procOp = VS_PROC_IDLE;
+		AG_ObjectUnlock(vsp);
+
+		AG_MutexLock(&vsp->jobLock);
+		vsp->jobCur = NULL;
+		job->rv = rv;
+		job->cancelled = vsp->jobCancel;
+		if (rv == -1) {
+			vsp->jobFailed++;
+		}
+		TAILQ_INSERT_TAIL(&vsp->jobsDone, job, jobs);
+		AG_CondBroadcast(&vsp->jobDone);
+		AG_MutexUnlock(&vsp->jobLock);
 	}
-out:
 	AG_ThreadExit(NULL);
 }
 
+static void
+FreeJobs(VS_Project *vsp)
+{
+	VS_ProcJob *job;
+
+	while ((job = TAILQ_FIRST(&vsp->jobsDone)) != NULL) {
+		TAILQ_REMOVE(&vsp->jobsDone, job, jobs);
+		Free(job->path);
+		free(job);
+	}
+}
+
+/*
+ * Post a "proc-done" event for each operation completed by the job
+ * thread. This runs from the event loop (as a timer of the project
+ * window), so the handlers can safely update the GUI. Without an editor
+ * (in batch mode), completed jobs are only freed with the project.
+ */
+static Uint32
+ReportProcDone(AG_Timer *to, AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	VS_ProcJob *job;
+
+	for (;;) {
+		AG_MutexLock(&vsp->jobLock);
+		if ((job = TAILQ_FIRST(&vsp->jobsDone)) != NULL) {
+			TAILQ_REMOVE(&vsp->jobsDone, job, jobs);
+		}
+		AG_MutexUnlock(&vsp->jobLock);
+		if (job == NULL) {
+			break;
+		}
+		AG_PostEvent(vsp, "proc-done", "%i,%u,%i,%i",
+		    (int)job->op, job->id, job->rv, job->cancelled);
+		Free(job->path);
+		free(job);
+	}
+	return (to->ival);
+}
+
 /*
  * Load video stream.
  */
@@ -324,7 +810,7 @@ LoadVideoJPEG(AG_Event *event)
 	if ((s = strrchr(v->dir, PATHSEPC)) != NULL) {
 		*s = '\0';
 	}
-	VS_ProjectRunOperation(v->proj, VS_PROC_LOAD_VIDEO);
+	VS_ProjectRunOperation(v->proj, VS_PROC_LOAD_VIDEO, NULL, 0);
 	AG_MutexUnlock(&v->lock);
 }
 static void
@@ -357,7 +843,7 @@ LoadAudioFile(AG_Event *event)
 	AG_MutexLock(&v->lock);
 	Free(v->audioFile);
 	v->audioFile = Strdup(path);
-	VS_ProjectRunOperation(v->proj, VS_PROC_LOAD_AUDIO);
+	VS_ProjectRunOperation(v->proj, VS_PROC_LOAD_AUDIO, NULL, 0);
 	AG_MutexUnlock(&v->lock);
 }
 static void
@@ -395,14 +881,201 @@ LoadAudioDlg(AG_Event *event)
 	AG_WindowShow(win);
 }
 
+/*
+ * Render the audio of the recorded performance.
+ */
+static void
+RenderAudioFile(AG_Event *event)
+{
+	VS_Clip *v = AG_PTR(1);
+	int fmt = AG_INT(2);
+	char *path = AG_STRING(3);
+
+	VS_ProjectRunOperation(v->proj, VS_PROC_RENDER_AUDIO, path, fmt);
+}
+static void
+RenderAudioDlg(AG_Event *event)
+{
+	VS_Clip *v = AG_PTR(1);
+	AG_Window *win;
+	AG_FileDlg *fd;
+
+	win = AG_WindowNew(0);
+	AG_WindowSetCaption(win, _("Render audio as..."));
+	fd = AG_FileDlgNewMRU(win, "vislak.mru.audio",
+	    AG_FILEDLG_SAVE|AG_FILEDLG_CLOSEWIN|AG_FILEDLG_EXPAND);
+
+	AG_FileDlgAddType(fd, _("WAV (32-bit float)"), "*.wav",
+	    RenderAudioFile, "%p,%i", v, SF_FORMAT_WAV|SF_FORMAT_FLOAT);
+	AG_FileDlgAddType(fd, _("WAV (16-bit PCM)"), "*.wav",
+	    RenderAudioFile, "%p,%i", v, SF_FORMAT_WAV|SF_FORMAT_PCM_16);
+	AG_FileDlgAddType(fd, _("FLAC (24-bit)"), "*.flac",
+	    RenderAudioFile, "%p,%i", v, SF_FORMAT_FLAC|SF_FORMAT_PCM_24);
+
+	AG_WindowShow(win);
+}
+
+/*
+ * Save, load and replay the performance capture log.
+ */
+static void
+SaveEventLogFile(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	char *path = AG_STRING(2);
+
+	if (VS_EventLogSave(&vsp->evlog, path) == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	VS_Status(vsp, _("Saved %u events to %s"), vsp->evlog.n,
+	    AG_ShortFilename(path));
+}
+static void
+LoadEventLogFile(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	char *path = AG_STRING(2);
+
+	if (VS_EventLogLoad(&vsp->evlog, path) == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	VS_Status(vsp, _("Loaded %u events from %s"), vsp->evlog.n,
+	    AG_ShortFilename(path));
+}
+static void
+EventLogDlg(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	int save = AG_INT(2);
+	AG_Window *win;
+	AG_FileDlg *fd;
+
+	win = AG_WindowNew(0);
+	AG_WindowSetCaption(win, save ? _("Save performance log as...") :
+	                                _("Load performance log..."));
+	fd = AG_FileDlgNewMRU(win, "vislak.mru.evlog",
+	    (save ? AG_FILEDLG_SAVE : AG_FILEDLG_LOAD)|AG_FILEDLG_CLOSEWIN|
+	    AG_FILEDLG_EXPAND);
+	AG_FileDlgAddType(fd, _("Vislak performance log"), "*.vsev",
+	    save ? SaveEventLogFile : LoadEventLogFile, "%p", vsp);
+	AG_WindowShow(win);
+}
+
+/*
+ * Save or reset the trigger-to-display latency statistics.
+ */
+static void
+SaveLatencyFile(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	char *path = AG_STRING(2);
+
+	if (VS_LatencySave(vsp->latency, VS_TRIGGER_LAST, path) == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	VS_Status(vsp, _("Saved latency report to %s"),
+	    AG_ShortFilename(path));
+}
+static void
+SaveLatencyDlg(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	AG_Window *win;
+	AG_FileDlg *fd;
+
+	win = AG_WindowNew(0);
+	AG_WindowSetCaption(win, _("Save latency report as..."));
+	fd = AG_FileDlgNewMRU(win, "vislak.mru.latency",
+	    AG_FILEDLG_SAVE|AG_FILEDLG_CLOSEWIN|AG_FILEDLG_EXPAND);
+	AG_FileDlgAddType(fd, _("Latency report"), "*.txt",
+	    SaveLatencyFile, "%p", vsp);
+	AG_WindowShow(win);
+}
+static void
+ResetLatency(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	int i;
+
+	for (i = 0; i < VS_TRIGGER_LAST; i++) {
+		VS_LatencyReset(&vsp->latency[i]);
+	}
+	VS_Status(vsp, _("Latency statistics reset"));
+}
+
+/*
+ * Show, save or reset the performance counters (see vs_stats.c).
+ */
+static void
+ShowStats(AG_Event *event)
+{
+	VS_StatsWindow();
+}
+static void
+SaveStatsFile(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	char *path = AG_STRING(2);
+
+	if (VS_StatsSaveJSON(path) == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	VS_Status(vsp, _("Saved statistics to %s"), AG_ShortFilename(path));
+}
+static void
+SaveStatsDlg(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	AG_Window *win;
+	AG_FileDlg *fd;
+
+	win = AG_WindowNew(0);
+	AG_WindowSetCaption(win, _("Save statistics as..."));
+	fd = AG_FileDlgNewMRU(win, "vislak.mru.stats",
+	    AG_FILEDLG_SAVE|AG_FILEDLG_CLOSEWIN|AG_FILEDLG_EXPAND);
+	AG_FileDlgAddType(fd, _("JSON statistics"), "*.json",
+	    SaveStatsFile, "%p", vsp);
+	AG_WindowShow(win);
+}
 static void
-SaveToMPEG4(AG_Event *event)
+ResetStats(AG_Event *event)
 {
-//	VS_Clip *v = AG_PTR(1);
-//	char *path = AG_STRING(2);
+	VS_Project *vsp = AG_PTR(1);
 
-	/* TODO */
-	/* VS_ClipSetArchivePath(v, path); */
+	VS_StatsReset();
+	VS_Status(vsp, _("Performance statistics reset"));
+}
+
+static void
+RenderTake(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+	int fps = AG_INT(2);
+
+	VS_ProjectRunOperation(vsp, VS_PROC_RENDER_TAKE, NULL, fps);
+}
+
+static void
+ExportVideoFile(AG_Event *event)
+{
+	VS_Clip *v = AG_PTR(1);
+	int fmt = AG_INT(2);
+	char *path = AG_STRING(3);
+
+	VS_ProjectRunOperation(v->proj, VS_PROC_EXPORT_VIDEO, path, fmt);
+}
+
+static void
+StreamVideo(AG_Event *event)
+{
+	VS_Clip *v = AG_PTR(1);
+
+	VS_ProjectRunOperation(v->proj, VS_PROC_EXPORT_VIDEO, "-",
+	    VS_EXPORT_ARG(VS_EXPORT_Y4M, 0));
 }
 
 static void
@@ -418,11 +1091,52 @@ SaveVideoDlg(AG_Event *event)
 	    AG_FILEDLG_SAVE|AG_FILEDLG_CLOSEWIN|AG_FILEDLG_EXPAND);
 	AG_FileDlgSetOptionContainer(fd, AG_BoxNewVert(win, AG_BOX_HFILL));
 
-	AG_FileDlgAddType(fd, _("MPEG-4"), "*.mpeg", SaveToMPEG4, "%p", v);
+	AG_FileDlgAddType(fd, _("QuickTime (Motion JPEG)"), "*.mov",
+	    ExportVideoFile, "%p,%i", v, VS_EXPORT_MOV);
+	AG_FileDlgAddType(fd, _("YUV4MPEG2 (original size)"), "*.y4m",
+	    ExportVideoFile, "%p,%i", v, VS_EXPORT_ARG(VS_EXPORT_Y4M, 0));
+	AG_FileDlgAddType(fd, _("YUV4MPEG2 (720p)"), "*.y4m",
+	    ExportVideoFile, "%p,%i", v, VS_EXPORT_ARG(VS_EXPORT_Y4M, 720));
+	AG_FileDlgAddType(fd, _("YUV4MPEG2 (480p)"), "*.y4m",
+	    ExportVideoFile, "%p,%i", v, VS_EXPORT_ARG(VS_EXPORT_Y4M, 480));
+	AG_FileDlgAddType(fd, _("YUV4MPEG2 (360p)"), "*.y4m",
+	    ExportVideoFile, "%p,%i", v, VS_EXPORT_ARG(VS_EXPORT_Y4M, 360));
 
 	AG_WindowShow(win);
 }
 
+/*
+ * Renumber the input clip's image files to follow the frame order and
+ * remove the files of deleted frames.
+ */
+static void
+CompactFrames(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+
+	VS_ProjectRunOperation(vsp, VS_PROC_COMPACT, NULL, 0);
+}
+
+/*
+ * Project parameters are not journaled; count their edits so that the
+ * project is saved (or the user prompted) before it is closed.
+ */
+static void
+ParamChanged(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+
+	VS_JournalTouch(vsp);
+}
+
+static void
+CancelOperation(AG_Event *event)
+{
+	VS_Project *vsp = AG_PTR(1);
+
+	VS_ProjectCancelOperation(vsp, 0);
+}
+
 VS_Project *
 VS_ProjectNew(void *parent, const char *name)
 {
@@ -443,6 +1157,76 @@ fail:
 	return (NULL);
 }
 
+/*
+ * Open a project file. If an autosave exists next to it (the project was
+ * not closed cleanly), the unsaved edits are recovered from the autosave
+ * and the journal. Unless VS_PROJECT_LOAD_DEFER is given, thumbnails and
+ * audio are then reloaded in background.
+ */
+int
+VS_ProjectLoad(VS_Project *vsp, const char *path, Uint flags)
+{
+	char pathAuto[AG_PATHNAME_MAX];
+	int fromAuto, nReplayed;
+
+	VS_JournalAutosavePath(path, pathAuto, sizeof(pathAuto));
+	fromAuto = (AG_FileExists(pathAuto) == 1);
+	if (AG_ObjectLoadFromFile(vsp, fromAuto ? pathAuto : path) == -1) {
+		return (-1);
+	}
+	AG_ObjectSetArchivePath(vsp, path);
+	if ((nReplayed = VS_JournalReplay(vsp, path)) == -1 ||
+	    VS_JournalOpen(vsp, path) == -1) {
+		return (-1);
+	}
+	if (fromAuto || nReplayed > 0) {
+		Verbose("%s: Recovered %d unsaved edits\n",
+		    AG_ShortFilename(path), nReplayed);
+		vsp->journal.dirty = fromAuto + nReplayed;
+	}
+	if (flags & VS_PROJECT_LOAD_DEFER) {
+		return (0);
+	}
+	if (vsp->input->n > 0 || vsp->output->n > 0) {
+		VS_ProjectRunOperation(vsp, VS_PROC_LOAD_THUMBS, NULL, 0);
+	}
+	if (vsp->output->audioFile != NULL) {
+		VS_ProjectRunOperation(vsp, VS_PROC_LOAD_AUDIO, NULL, 1);
+	}
+	return (0);
+}
+
+/*
+ * Save a project to path (or to its archive path if NULL), and truncate
+ * its journal.
+ */
+int
+VS_ProjectSave(VS_Project *vsp, const char *path)
+{
+	char pathArch[AG_PATHNAME_MAX];
+
+	if (path == NULL) {
+		if (!AG_Defined(vsp, "archive-path")) {
+			AG_SetError(_("No archive path"));
+			return (-1);
+		}
+		AG_GetString(vsp, "archive-path", pathArch, sizeof(pathArch));
+		path = pathArch;
+	}
+	if (VS_JournalCheckpoint(vsp, path) == -1) {
+		return (-1);
+	}
+	AG_ObjectSetArchivePath(vsp, path);
+	return (0);
+}
+
+/* Return 1 if the project has unsaved edits. */
+int
+VS_ProjectChanged(VS_Project *vsp)
+{
+	return (vsp->journal.dirty != 0);
+}
+
 void
 VS_Status(void *obj, const char *fmt, ...)
 {
@@ -460,7 +1244,11 @@ VS_Status(void *obj, const char *fmt, ...)
 	va_start(ap, fmt);
 	Vasprintf(&s, fmt, ap);
 	va_end(ap);
-	AG_LabelTextS(lbl, s);
+	if (lbl != NULL) {
+		AG_LabelTextS(lbl, s);
+	} else {				/* No editor (or batch mode) */
+		Verbose("%s\n", s);
+	}
 	free(s);
 }
 
@@ -469,7 +1257,10 @@ OnAttach(AG_Event *event)
 {
 	VS_Project *vsp = AG_SELF();
 
+	vsp->procExit = 0;
+	vsp->procOp = VS_PROC_IDLE;
 	AG_ThreadCreate(&vsp->procTh, ProcessThread, vsp);
+	AG_ThreadCreate(&vsp->jobTh, JobThread, vsp);
 }
 
 static void
@@ -477,18 +1268,41 @@ OnDetach(AG_Event *event)
 {
 	VS_Project *vsp = AG_SELF();
 
-	vsp->procOp = VS_PROC_TERMINATE;
-	while (vsp->procOp != VS_PROC_INIT) {
-		AG_ObjectUnlock(vsp);
-		AG_Delay(10);
-		AG_ObjectLock(vsp);
+	VS_ProjectCancelOperation(vsp, 0);
+
+	AG_MutexLock(&vsp->jobLock);
+	vsp->procExit = 1;
+	AG_CondBroadcast(&vsp->jobCond);
+	AG_MutexUnlock(&vsp->jobLock);
+
+	AG_ObjectUnlock(vsp);
+	AG_ThreadJoin(vsp->procTh, NULL);
+	AG_ThreadJoin(vsp->jobTh, NULL);
+	VS_JournalClose(vsp);
+	AG_ObjectLock(vsp);
+
+	vsp->procOp = VS_PROC_INIT;
+}
+
+/* An operation has completed (posted by ReportProcDone()). */
+static void
+OnProcDone(AG_Event *event)
+{
+	VS_Project *vsp = AG_SELF();
+	Uint id = AG_UINT(2);
+	int cancelled = AG_INT(4);
+
+	if (cancelled) {
+		VS_Status(vsp, _("Operation #%u cancelled"), id);
 	}
+	vsp->gui.progress.val = vsp->gui.progress.max;
 }
 
 static void
 Init(void *obj)
 {
 	VS_Project *vsp = obj;
+	int i;
 
 	vsp->flags = 0;
 	vsp->thumbSz = 128;
@@ -499,6 +1313,8 @@ Init(void *obj)
 	vsp->input = NULL;
 	vsp->output = NULL;
 	vsp->procOp = VS_PROC_INIT;
+	vsp->procExit = 0;
+	VS_ClockInit(&vsp->clock, 1, vsp->frameRate);
 
 	vsp->gui.progress.val = 0;
 	vsp->gui.progress.min = 0;
@@ -507,19 +1323,44 @@ Init(void *obj)
 	vsp->gui.playerOut = NULL;
 	vsp->gui.status = NULL;
 
+	AG_MutexInit(&vsp->jobLock);
+	AG_CondInit(&vsp->jobCond);
+	AG_CondInit(&vsp->jobDone);
+	vsp->jobFailed = 0;
+	TAILQ_INIT(&vsp->jobs);
+	TAILQ_INIT(&vsp->jobsDone);
+	vsp->jobCur = NULL;
+	vsp->jobCancel = 0;
+	vsp->jobLastID = 0;
+	VS_EventLogInit(&vsp->evlog);
+	for (i = 0; i < VS_TRIGGER_LAST; i++)
+		VS_LatencyInit(&vsp->latency[i]);
+	VS_JournalInit(&vsp->journal);
+
 	AG_SetEvent(vsp, "attached", OnAttach, NULL);
 	AG_SetEvent(vsp, "detached", OnDetach, NULL);
+	AG_SetEvent(vsp, "proc-done", OnProcDone, NULL);
 }
 
 static void
 Destroy(void *obj)
 {
 	VS_Project *vsp = obj;
+	int i;
 
 	if (vsp->input != NULL)
 		VS_ClipDestroy(vsp->input);
 	if (vsp->output != NULL)
 		VS_ClipDestroy(vsp->output);
+
+	FreeJobs(vsp);
+	AG_CondDestroy(&vsp->jobCond);
+	AG_CondDestroy(&vsp->jobDone);
+	AG_MutexDestroy(&vsp->jobLock);
+	VS_EventLogDestroy(&vsp->evlog);
+	for (i = 0; i < VS_TRIGGER_LAST; i++)
+		VS_LatencyDestroy(&vsp->latency[i]);
+	VS_JournalDestroy(&vsp->journal);
 }
 
 static int
@@ -534,6 +1375,17 @@ Load(void *obj, AG_DataSource *ds, const AG_Version *ver)
 	vsp->frameRate = (int)AG_ReadUint8(ds);
 	vsp->bendSpeed = AG_ReadDouble(ds);
 	vsp->bendSpeedMax = AG_ReadDouble(ds);
+	vsp->journal.gen = 0;
+	if (ver->minor < 1) {			/* No clip sections */
+		return (0);
+	}
+	if (VS_ClipLoad(vsp->input, NULL, ds) == -1 ||
+	    VS_ClipLoad(vsp->output, vsp->input, ds) == -1) {
+		return (-1);
+	}
+	if (ver->minor >= 2) {
+		vsp->journal.gen = AG_ReadUint32(ds);
+	}
 	return (0);
 }
 
@@ -548,6 +1400,11 @@ Save(void *obj, AG_DataSource *ds)
 	AG_WriteUint8(ds, (Uint8)vsp->frameRate);
 	AG_WriteDouble(ds, vsp->bendSpeed);
 	AG_WriteDouble(ds, vsp->bendSpeedMax);
+	if (VS_ClipSave(vsp->input, ds) == -1 ||
+	    VS_ClipSave(vsp->output, ds) == -1) {
+		return (-1);
+	}
+	AG_WriteUint32(ds, vsp->journal.gen);
 	return (0);
 }
 
@@ -575,6 +1432,7 @@ Edit(void *obj)
 		return (NULL);
 	}
 	AG_WindowSetCaption(win, _("Vislak <%s>"), OBJECT(vsp)->name);
+	AG_AddTimer(win, &vsp->gui.toProcDone, 100, ReportProcDone, "%p", vsp);
 	menu = AG_MenuNew(win, AG_MENU_HFILL);
 	paHoriz = AG_PaneNewHoriz(win, AG_PANE_EXPAND);
 	pa = AG_PaneNewVert(paHoriz->div[0], AG_PANE_EXPAND);
@@ -603,19 +1461,44 @@ Edit(void *obj)
 	
 		boxParams = AG_BoxNewVert(boxStatus, AG_BOX_VFILL);
 		{
-			AG_NumericalNewDblR(boxParams, 0, NULL,
+			num = AG_NumericalNewDblR(boxParams, 0, NULL,
 			    _("Bend: "), &vsp->bendSpeed, 1.0, vsp->bendSpeedMax);
-			AG_NumericalNewIntR(boxParams, 0, NULL,
+			AG_SetEvent(num, "numerical-changed",
+			    ParamChanged, "%p", vsp);
+			num = AG_NumericalNewIntR(boxParams, 0, NULL,
 			    _("FPS: "), &vsp->frameRate, 1, 60);
+			AG_SetEvent(num, "numerical-changed",
+			    ParamChanged, "%p", vsp);
 		}
 		
 		AG_SeparatorNewVert(boxStatus);
 
 		lbl = AG_LabelNewPolled(boxStatus, 0,
 		    "FPS=%i\n"
-		    "Drift=%i\n",
-		    &vsp->frameRate, &vOut->drift);
-		AG_LabelSizeHint(lbl, 2, "<Drift: XXXXX>");
+		    "Drift=%i\n"
+		    "Jitter=%ius (max %ius)\n"
+		    "Overruns=%u\n",
+		    &vsp->frameRate, &vOut->drift,
+		    &vsp->clock.jitAvg, &vsp->clock.jitMax,
+		    &vsp->clock.nOverruns);
+		AG_LabelSizeHint(lbl, 4, "<Jitter=XXXXXus (max XXXXXus)>");
+
+		AG_SeparatorNewVert(boxStatus);
+
+		lbl = AG_LabelNewPolled(boxStatus, 0,
+		    "MIDI latency=%ius (p95 %ius, max %ius)\n"
+		    "Key latency=%ius (p95 %ius, max %ius)\n"
+		    "Samples=%u/%u\n",
+		    &vsp->latency[VS_TRIGGER_MIDI].p50,
+		    &vsp->latency[VS_TRIGGER_MIDI].p95,
+		    &vsp->latency[VS_TRIGGER_MIDI].max,
+		    &vsp->latency[VS_TRIGGER_KBD].p50,
+		    &vsp->latency[VS_TRIGGER_KBD].p95,
+		    &vsp->latency[VS_TRIGGER_KBD].max,
+		    &vsp->latency[VS_TRIGGER_MIDI].n,
+		    &vsp->latency[VS_TRIGGER_KBD].n);
+		AG_LabelSizeHint(lbl, 3,
+		    "<MIDI latency=XXXXXus (p95 XXXXXus, max XXXXXus)>");
 		
 		AG_SeparatorNewVert(boxStatus);
 
@@ -626,6 +1509,9 @@ Edit(void *obj)
 		AG_BindInt(pb, "max", &vsp->gui.progress.max);
 		AG_ProgressBarSetWidth(pb, agTextFontHeight*2);
 		AG_ProgressBarSetLength(pb, 200);
+
+		AG_ButtonNewFn(boxStatus, 0, _("Cancel"),
+		    CancelOperation, "%p", vsp);
 	}
 
 	/*
@@ -640,11 +1526,54 @@ Edit(void *obj)
 		AG_MenuSeparator(m);
 		AG_MenuAction(m, _("Save video as..."), agIconSave.s,
 		    SaveVideoDlg, "%p", vOut);
+		AG_MenuAction(m, _("Stream video to stdout (Y4M)"), NULL,
+		    StreamVideo, "%p", vOut);
+		AG_MenuAction(m, _("Render audio as..."), agIconSave.s,
+		    RenderAudioDlg, "%p", vOut);
+		AG_MenuSeparator(m);
+		AG_MenuAction(m, _("Load performance log..."), agIconLoad.s,
+		    EventLogDlg, "%p,%i", vsp, 0);
+		AG_MenuAction(m, _("Save performance log as..."), agIconSave.s,
+		    EventLogDlg, "%p,%i", vsp, 1);
+		mNode = AG_MenuNode(m, _("Render performance at"), NULL);
+		{
+			AG_MenuAction(mNode, _("24 fps"), NULL,
+			    RenderTake, "%p,%i", vsp, 24);
+			AG_MenuAction(mNode, _("25 fps"), NULL,
+			    RenderTake, "%p,%i", vsp, 25);
+			AG_MenuAction(mNode, _("30 fps"), NULL,
+			    RenderTake, "%p,%i", vsp, 30);
+			AG_MenuAction(mNode, _("50 fps"), NULL,
+			    RenderTake, "%p,%i", vsp, 50);
+			AG_MenuAction(mNode, _("60 fps"), NULL,
+			    RenderTake, "%p,%i", vsp, 60);
+		}
+		AG_MenuSeparator(m);
+		AG_MenuAction(m, _("Save latency report as..."), agIconSave.s,
+		    SaveLatencyDlg, "%p", vsp);
+		AG_MenuAction(m, _("Save statistics as JSON..."), agIconSave.s,
+		    SaveStatsDlg, "%p", vsp);
 	}
 	m = AG_MenuNode(menu->root, _("Edit"), NULL);
 	{
 		AG_MenuUintFlagsMp(m, _("Key learn mode"), vsIconControls.s,
 		    &vsp->flags, VS_PROJECT_LEARNING, 0, &OBJECT(vsp)->lock);
+		AG_MenuSeparator(m);
+		AG_MenuAction(m, _("Compact frame files"), NULL,
+		    CompactFrames, "%p", vsp);
+		AG_MenuAction(m, _("Reset latency statistics"), NULL,
+		    ResetLatency, "%p", vsp);
+		AG_MenuAction(m, _("Reset performance statistics"), NULL,
+		    ResetStats, "%p", vsp);
+		AG_MenuAction(m, _("Cancel operations"), agIconTrash.s,
+		    CancelOperation, "%p", vsp);
+	}
+	m = AG_MenuNode(menu->root, _("View"), NULL);
+	{
+		AG_MenuAction(m, _("Performance statistics..."), NULL,
+		    ShowStats, NULL);
+		AG_MenuIntBool(m, _("Statistics overlay"), NULL,
+		    &vsPlayerHUD, 0);
 	}
 	m = AG_MenuNode(menu->root, _("MIDI"), NULL);
 	{
@@ -660,7 +1589,7 @@ Edit(void *obj)
 AG_ObjectClass vsProjectClass = {
 	"VS_Project",
 	sizeof(VS_Project),
-	{ 0,0 },
+	{ 0,2 },
 	Init,
 	NULL,			/* freeData */
 	Destroy,
@@ -5,9 +5,24 @@ typedef enum vs_proc_op {
 	VS_PROC_IDLE,			/* Idle */
 	VS_PROC_LOAD_VIDEO,		/* Importing video data */
 	VS_PROC_LOAD_AUDIO,		/* Importing audio data */
-	VS_PROC_TERMINATE		/* Exiting */
+	VS_PROC_RENDER_AUDIO,		/* Rendering audio offline */
+	VS_PROC_RENDER_TAKE,		/* Replaying the event log */
+	VS_PROC_EXPORT_VIDEO,		/* Exporting video */
+	VS_PROC_COMPACT,		/* Renumbering frame files */
+	VS_PROC_LOAD_THUMBS,		/* Loading thumbnails of opened project */
+	VS_PROC_COMMIT_TAKE		/* Appending a recorded take */
 } VS_ProcOp;
 
+typedef struct vs_proc_job {
+	VS_ProcOp op;			/* Operation to perform */
+	Uint id;			/* Job identifier */
+	char *path;			/* File argument (or NULL) */
+	int arg;			/* Operation-specific argument */
+	int rv;				/* Result (completed jobs) */
+	int cancelled;			/* Was cancelled (completed jobs) */
+	TAILQ_ENTRY(vs_proc_job) jobs;
+} VS_ProcJob;
+
 typedef struct vs_project {
 	struct ag_object _inherit;
 	Uint flags;
@@ -22,8 +37,23 @@ typedef struct vs_project {
 	double bendSpeedMax;		 /* Speed bend max */
 	VS_Clip *input;		 	 /* Input video streams */
 	VS_Clip *output;		 /* Rendered output stream */
-	VS_ProcOp procOp;		 /* Status of processing thread */
-	AG_Thread procTh;		 /* Processing thread */
+	VS_ProcOp procOp;		 /* Operation in progress */
+	int procExit;			 /* Processing threads must exit */
+	AG_Thread procTh;		 /* Frame clock thread */
+	VS_Clock clock;			 /* Frame clock */
+	AG_Thread jobTh;		 /* Job thread */
+	AG_Mutex jobLock;		 /* Lock on job queue */
+	AG_Cond jobCond;		 /* Signaled on new jobs */
+	AG_Cond jobDone;		 /* Signaled on completed jobs */
+	Uint jobFailed;			 /* Failed jobs (see WaitOperations) */
+	TAILQ_HEAD(,vs_proc_job) jobs;	 /* Queued operations */
+	TAILQ_HEAD(,vs_proc_job) jobsDone; /* Completed, not yet reported */
+	VS_ProcJob *jobCur;		 /* Running operation */
+	int jobCancel;			 /* Cancel running operation */
+	Uint jobLastID;
+	VS_EventLog evlog;		 /* Performance capture log */
+	VS_Latency latency[VS_TRIGGER_LAST]; /* Trigger-to-display latency */
+	VS_Journal journal;		 /* Journaled autosave */
 	struct {
 		struct {
 			int val;	 /* Progress value */
@@ -32,6 +62,7 @@ typedef struct vs_project {
 		VS_Player *playerIn;	 /* Playback widget for input */
 		VS_Player *playerOut;	 /* Playback widget for output */
 		AG_Label *status;
+		AG_Timer toProcDone;	 /* Reports completed jobs */
 	} gui;
 } VS_Project;
 
@@ -39,6 +70,14 @@ __BEGIN_DECLS
 extern AG_ObjectClass vsProjectClass;
 
 VS_Project *VS_ProjectNew(void *, const char *);
+int         VS_ProjectLoad(VS_Project *, const char *, Uint);
+#define VS_PROJECT_LOAD_DEFER	0x01	 /* Don't reload thumbnails/audio */
+int         VS_ProjectSave(VS_Project *, const char *);
+int         VS_ProjectChanged(VS_Project *);
 void        VS_Status(void *, const char *, ...);
-void        VS_ProjectRunOperation(VS_Project *, VS_ProcOp);
+Uint        VS_ProjectRunOperation(VS_Project *, VS_ProcOp, const char *,
+                                   int);
+void        VS_ProjectCancelOperation(VS_Project *, Uint);
+Uint        VS_ProjectWaitOperations(VS_Project *);
+int         VS_ProjectCancelled(VS_Project *);
 __END_DECLS
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Offline rendering of recorded performances.
+ */
+
+#include <vislak.h>
+
+#include <string.h>
+
+/*
+ * Render the audio matching the frame timeline of a clip to a sound file
+ * (format is a libsndfile SF_FORMAT_* mask). Each frame is mapped to its
+ * audio exactly as in playback (see VS_ClipFrameToSample()), but nothing
+ * is routed through PortAudio, so we run as fast as the disk allows.
+ * The audio is locked only while each frame is copied out (as in
+ * WriteAudio() of the exporter), so playback is not blocked.
+ */
+int
+VS_RenderAudio(VS_Clip *v, const char *path, int format)
+{
+	VS_Project *vsp = v->proj;
+	SF_INFO sfi;
+	SNDFILE *sf;
+	float *buf = NULL;
+	sf_count_t nSamples, pos, len;
+	Uint i, n;
+	int spf;
+
+	AG_MutexLock(&v->sndLock);
+	if (v->sndBuf == NULL) {
+		AG_SetError("Clip has no audio");
+		AG_MutexUnlock(&v->sndLock);
+		return (-1);
+	}
+	memset(&sfi, 0, sizeof(sfi));
+	sfi.samplerate = v->sndInfo.samplerate;
+	sfi.channels = v->sndInfo.channels;
+	sfi.format = format;
+	spf = v->samplesPerFrame;
+	AG_MutexUnlock(&v->sndLock);
+
+	AG_MutexLock(&v->lock);
+	n = v->n;
+	AG_MutexUnlock(&v->lock);
+	if (n == 0) {
+		AG_SetError("Clip has no frames");
+		return (-1);
+	}
+	if (spf <= 0) {
+		AG_SetError("Bad samples per frame (%d)", spf);
+		return (-1);
+	}
+	if (!sf_format_check(&sfi)) {
+		AG_SetError("%s: Unsupported format for %d-Ch, %dHz audio",
+		    path, sfi.channels, sfi.samplerate);
+		return (-1);
+	}
+	if ((sf = sf_open(path, SFM_WRITE, &sfi)) == NULL) {
+		AG_SetError("%s: %s", path, sf_strerror(NULL));
+		return (-1);
+	}
+	sf_command(sf, SFC_SET_CLIPPING, NULL, SF_TRUE);
+
+	len = (sf_count_t)spf * sfi.channels;
+	if ((buf = AG_TryMalloc(len*sizeof(float))) == NULL) {
+		goto fail;
+	}
+
+	vsp->gui.progress.min = 0;
+	vsp->gui.progress.max = (int)n;
+	vsp->gui.progress.val = 0;
+
+	for (i = 0; i < n; i++) {
+		if ((i & 0xff) == 0 && VS_ProjectCancelled(vsp)) {
+			AG_SetError(_("Cancelled"));
+			goto fail;
+		}
+
+		AG_MutexLock(&v->sndLock);
+		if (v->sndBuf == NULL || v->sndInfo.channels != sfi.channels) {
+			AG_MutexUnlock(&v->sndLock);
+			AG_SetError(_("Audio changed during the render"));
+			goto fail;
+		}
+		nSamples = v->sndInfo.frames * v->sndInfo.channels;
+		pos = VS_ClipFrameToSample(v, i);
+		if (pos + len <= nSamples) {
+			memcpy(buf, &v->sndBuf[pos], len*sizeof(float));
+		} else {
+			/* Past the end of the stream; pad with silence. */
+			memset(buf, 0, len*sizeof(float));
+			if (pos < nSamples) {
+				memcpy(buf, &v->sndBuf[pos],
+				    (nSamples - pos)*sizeof(float));
+			}
+		}
+		AG_MutexUnlock(&v->sndLock);
+
+		if (sf_writef_float(sf, buf, spf) != spf) {
+			AG_SetError("%s: %s", path, sf_strerror(sf));
+			goto fail;
+		}
+		vsp->gui.progress.val++;
+	}
+
+	Free(buf);
+	if (sf_close(sf) != 0) {
+		AG_SetError("%s: %s", path, sf_strerror(NULL));
+		return (-1);
+	}
+	return (0);
+fail:
+	Free(buf);
+	sf_close(sf);
+	return (-1);
+}
@@ -0,0 +1,12 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_RENDER_H_
+#define _VISLAK_RENDER_H_
+
+#include "vs_clip.h"
+
+__BEGIN_DECLS
+int VS_RenderAudio(VS_Clip *, const char *, int);
+__END_DECLS
+
+#endif /* _VISLAK_RENDER_H_ */
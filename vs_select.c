@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Frame selection as an interval set. Select all, clear and range
+ * selections cost O(runs) rather than O(frames), membership tests are
+ * a binary search, and deletions can walk the runs in one pass.
+ */
+
+#include <vislak.h>
+
+void
+VS_SelInit(VS_Selection *sel)
+{
+	sel->runs = NULL;
+	sel->nRuns = 0;
+	sel->maxRuns = 0;
+}
+
+void
+VS_SelDestroy(VS_Selection *sel)
+{
+	Free(sel->runs);
+	sel->runs = NULL;
+	sel->nRuns = 0;
+	sel->maxRuns = 0;
+}
+
+void
+VS_SelClear(VS_Selection *sel)
+{
+	sel->nRuns = 0;
+}
+
+/* Return the index of the first run with end >= f. */
+static Uint
+FindRun(const VS_Selection *sel, Uint f)
+{
+	Uint lo = 0, hi = sel->nRuns;
+
+	while (lo < hi) {
+		Uint mid = (lo+hi)/2;
+
+		if (sel->runs[mid].end < f) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo);
+}
+
+static int
+Grow(VS_Selection *sel, Uint nRuns)
+{
+	VS_SelRun *runsNew;
+	Uint maxNew;
+
+	if (nRuns <= sel->maxRuns) {
+		return (0);
+	}
+	maxNew = (sel->maxRuns > 0) ? sel->maxRuns*2 : 16;
+	if (maxNew < nRuns) {
+		maxNew = nRuns;
+	}
+	if ((runsNew = TryRealloc(sel->runs, maxNew*sizeof(VS_SelRun)))
+	    == NULL) {
+		return (-1);
+	}
+	sel->runs = runsNew;
+	sel->maxRuns = maxNew;
+	return (0);
+}
+
+/* Add frames [start,end) to the selection. */
+int
+VS_SelAdd(VS_Selection *sel, Uint start, Uint end)
+{
+	Uint i, j;
+
+	if (start >= end) {
+		return (0);
+	}
+	/* Runs i..j-1 overlap or touch [start,end) and are merged. */
+	i = FindRun(sel, start);
+	for (j = i; j < sel->nRuns && sel->runs[j].start <= end; j++) {
+		if (sel->runs[j].start < start) { start = sel->runs[j].start; }
+		if (sel->runs[j].end > end) { end = sel->runs[j].end; }
+	}
+	if (j == i) {
+		if (Grow(sel, sel->nRuns+1) == -1) {
+			return (-1);
+		}
+		memmove(&sel->runs[i+1], &sel->runs[i],
+		    (sel->nRuns - i)*sizeof(VS_SelRun));
+		sel->nRuns++;
+	} else if (j > i+1) {
+		memmove(&sel->runs[i+1], &sel->runs[j],
+		    (sel->nRuns - j)*sizeof(VS_SelRun));
+		sel->nRuns -= (j - i - 1);
+	}
+	sel->runs[i].start = start;
+	sel->runs[i].end = end;
+	return (0);
+}
+
+/* Remove frames [start,end) from the selection. */
+int
+VS_SelRemove(VS_Selection *sel, Uint start, Uint end)
+{
+	Uint i, j;
+
+	if (start >= end) {
+		return (0);
+	}
+	i = FindRun(sel, start+1);
+	if (i < sel->nRuns &&
+	    sel->runs[i].start < start && sel->runs[i].end > end) {
+		/* Split a run in two. */
+		if (Grow(sel, sel->nRuns+1) == -1) {
+			return (-1);
+		}
+		memmove(&sel->runs[i+1], &sel->runs[i],
+		    (sel->nRuns - i)*sizeof(VS_SelRun));
+		sel->nRuns++;
+		sel->runs[i].end = start;
+		sel->runs[i+1].start = end;
+		return (0);
+	}
+	if (i < sel->nRuns && sel->runs[i].start < start) {
+		sel->runs[i].end = start;			/* Trim tail */
+		i++;
+	}
+	for (j = i; j < sel->nRuns && sel->runs[j].end <= end; j++)
+		;						/* Covered */
+	if (j < sel->nRuns && sel->runs[j].start < end) {
+		sel->runs[j].start = end;			/* Trim head */
+	}
+	if (j > i) {
+		memmove(&sel->runs[i], &sel->runs[j],
+		    (sel->nRuns - j)*sizeof(VS_SelRun));
+		sel->nRuns -= (j - i);
+	}
+	return (0);
+}
+
+/* Test whether any frame in [start,end) is selected. */
+int
+VS_SelIntersects(const VS_Selection *sel, Uint start, Uint end)
+{
+	Uint i = FindRun(sel, start+1);
+
+	return (i < sel->nRuns && sel->runs[i].start < end);
+}
+
+Uint
+VS_SelCount(const VS_Selection *sel)
+{
+	Uint i, n = 0;
+
+	for (i = 0; i < sel->nRuns; i++) {
+		n += sel->runs[i].end - sel->runs[i].start;
+	}
+	return (n);
+}
+
+/* Return the first selected frame, or -1 if the selection is empty. */
+int
+VS_SelFirst(const VS_Selection *sel)
+{
+	return (sel->nRuns > 0) ? (int)sel->runs[0].start : -1;
+}
@@ -0,0 +1,31 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_SELECT_H_
+#define _VISLAK_SELECT_H_
+
+/*
+ * Set of selected frames, stored as a sorted array of disjoint,
+ * non-adjacent intervals [start,end).
+ */
+typedef struct vs_sel_run {
+	Uint start;			/* First frame */
+	Uint end;			/* Last frame + 1 */
+} VS_SelRun;
+
+typedef struct vs_selection {
+	VS_SelRun *runs;		/* Sorted intervals */
+	Uint nRuns, maxRuns;
+} VS_Selection;
+
+__BEGIN_DECLS
+void VS_SelInit(VS_Selection *);
+void VS_SelDestroy(VS_Selection *);
+void VS_SelClear(VS_Selection *);
+int  VS_SelAdd(VS_Selection *, Uint, Uint);
+int  VS_SelRemove(VS_Selection *, Uint, Uint);
+int  VS_SelIntersects(const VS_Selection *, Uint, Uint);
+Uint VS_SelCount(const VS_Selection *);
+int  VS_SelFirst(const VS_Selection *);
+__END_DECLS
+
+#endif /* _VISLAK_SELECT_H_ */
@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2013 Hypertriton, Inc. <http://hypertriton.com/>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Performance counters. Every thread which updates a statistic gets its
+ * own slot (found through a thread key), and only that thread ever writes
+ * to it, so updates take no lock. Readers sum the slots under the lock on
+ * the slot list, which is only contended when a thread first registers.
+ * Slots of exited threads are reused by new threads, keeping their counts.
+ * The registry is never freed, since project threads may still be
+ * updating it while the program exits.
+ *
+ * VS_StatsReset() only bumps a generation number; each writer clears its
+ * own slot on its next update, and readers skip slots of an older
+ * generation.
+ *
+ * Durations are binned in a log-linear histogram: VS_STATS_SUB buckets
+ * per octave of microseconds (exact below VS_STATS_SUB us).
+ */
+
+#include <vislak.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+typedef struct vs_stats_slot {
+	Uint gen;				/* Reset generation of counts */
+	int inUse;				/* Owned by a live thread */
+	Uint64 n[VS_STAT_LAST];			/* Samples or counts */
+	Uint64 sum[VS_STAT_NTIMERS];		/* Sum of durations (ns) */
+	Uint64 max[VS_STAT_NTIMERS];		/* Longest duration (ns) */
+	Uint32 hist[VS_STAT_NTIMERS][VS_STATS_NBUCKETS];
+	struct vs_stats_slot *next;
+} VS_StatsSlot;
+
+static AG_Mutex vsStatsLock;		/* Lock on the slot list */
+static VS_StatsSlot *vsStatsSlots = NULL;
+static AG_ThreadKey vsStatsKey;		/* VS_StatsSlot of calling thread */
+static Uint vsStatsGen = 0;		/* Reset generation */
+static Uint64 vsStatsT0 = 0;		/* Time of last reset (ns) */
+static int vsStatsInited = 0;
+
+static char vsStatsText[4096];		/* Contents of the stats window */
+static AG_Timer vsStatsTimer;
+
+const VS_StatInfo vsStatInfo[] = {
+	{ "decode",		N_("JPEG decode") },
+	{ "scale",		N_("Scaling") },
+	{ "import",		N_("Thumbnail import") },
+	{ "blit",		N_("Player blit") },
+	{ "audio",		N_("Audio callback") },
+	{ "midi",		N_("MIDI input") },
+	{ "frame",		N_("Frame processing") },
+	{ "cue_hit",		N_("Cue cache hits") },
+	{ "prefetch_hit",	N_("Prefetch hits") },
+	{ "frame_miss",		N_("Frames decoded on demand") },
+	{ "skipped",		N_("Frames skipped by players") },
+	{ "late",		N_("Frame periods missed") },
+	{ "audio_resync",	N_("Audio resyncs") },
+	{ "midi_events",	N_("MIDI events") },
+	{ "midi_dropped",	N_("MIDI events dropped") }
+};
+
+#define STORE(p,v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+
+/* Histogram bucket of a duration in us (VS_STATS_SUB must be 8). */
+static __inline__ int
+Bucket(Uint64 us)
+{
+	int e, b;
+
+	if (us < VS_STATS_SUB) {
+		return (int)us;
+	}
+	e = 63 - __builtin_clzll(us);
+	b = (e-2)*VS_STATS_SUB + (int)((us >> (e-3)) & (VS_STATS_SUB-1));
+	return (b < VS_STATS_NBUCKETS ? b : VS_STATS_NBUCKETS-1);
+}
+
+/* Lower edge of bucket b (us). */
+static Uint64
+BucketStart(int b)
+{
+	int e;
+
+	if (b < VS_STATS_SUB) {
+		return (Uint64)b;
+	}
+	e = b/VS_STATS_SUB + 2;
+	return (Uint64)(VS_STATS_SUB + b%VS_STATS_SUB) << (e-3);
+}
+
+static void
+ClearSlot(VS_StatsSlot *s)
+{
+	memset(s->n, 0, sizeof(s->n));
+	memset(s->sum, 0, sizeof(s->sum));
+	memset(s->max, 0, sizeof(s->max));
+	memset(s->hist, 0, sizeof(s->hist));
+}
+
+/* Thread key destructor. */
+static void
+ReleaseSlot(void *p)
+{
+	VS_StatsSlot *s = p;
+
+	AG_MutexLock(&vsStatsLock);
+	s->inUse = 0;
+	AG_MutexUnlock(&vsStatsLock);
+}
+
+/* Register the calling thread, reusing the slot of an exited thread. */
+static VS_StatsSlot *
+NewSlot(void)
+{
+	VS_StatsSlot *s;
+
+	AG_MutexLock(&vsStatsLock);
+	for (s = vsStatsSlots; s != NULL; s = s->next) {
+		if (!s->inUse)
+			break;
+	}
+	if (s == NULL) {
+		if ((s = TryMalloc(sizeof(VS_StatsSlot))) == NULL) {
+			AG_MutexUnlock(&vsStatsLock);
+			return (NULL);
+		}
+		ClearSlot(s);
+		s->gen = vsStatsGen;
+		s->next = vsStatsSlots;
+		vsStatsSlots = s;
+	}
+	s->inUse = 1;
+	AG_MutexUnlock(&vsStatsLock);
+
+	AG_ThreadKeySet(vsStatsKey, s);
+	return (s);
+}
+
+/* Return the slot of the calling thread (or NULL). */
+static __inline__ VS_StatsSlot *
+GetSlot(void)
+{
+	VS_StatsSlot *s;
+	Uint gen;
+
+	if (!vsStatsInited) {
+		return (NULL);
+	}
+	if ((s = AG_ThreadKeyGet(vsStatsKey)) == NULL &&
+	    (s = NewSlot()) == NULL) {
+		return (NULL);
+	}
+	gen = __atomic_load_n(&vsStatsGen, __ATOMIC_ACQUIRE);
+	if (s->gen != gen) {
+		ClearSlot(s);
+		__atomic_store_n(&s->gen, gen, __ATOMIC_RELEASE);
+	}
+	return (s);
+}
+
+void
+VS_StatsInit(void)
+{
+	AG_MutexInit(&vsStatsLock);
+	AG_ThreadKeyCreate(&vsStatsKey, ReleaseSlot);
+	vsStatsSlots = NULL;
+	vsStatsGen = 0;
+	vsStatsT0 = VS_ClockNow();
+	vsStatsInited = 1;
+}
+
+void
+VS_StatsReset(void)
+{
+	if (!vsStatsInited) {
+		return;
+	}
+	AG_MutexLock(&vsStatsLock);
+	vsStatsT0 = VS_ClockNow();
+	__atomic_add_fetch(&vsStatsGen, 1, __ATOMIC_RELEASE);
+	AG_MutexUnlock(&vsStatsLock);
+}
+
+/* Increment a counter. */
+void
+VS_StatsAdd(enum vs_stat st, Uint n)
+{
+	VS_StatsSlot *s;
+
+	if ((s = GetSlot()) != NULL)
+		STORE(&s->n[st], s->n[st] + n);
+}
+
+/* Record the time elapsed since t0 (a VS_ClockNow() stamp) in a timer. */
+void
+VS_StatsTime(enum vs_stat st, Uint64 t0)
+{
+	Uint64 ns = VS_ClockNow() - t0;
+	VS_StatsSlot *s;
+	int b;
+
+	if ((s = GetSlot()) == NULL) {
+		return;
+	}
+	b = Bucket(ns/1000);
+	STORE(&s->n[st], s->n[st] + 1);
+	STORE(&s->sum[st], s->sum[st] + ns);
+	if (ns > s->max[st]) {
+		STORE(&s->max[st], ns);
+	}
+	STORE(&s->hist[st][b], s->hist[st][b] + 1);
+}
+
+/*
+ * Sum the slots into vals (VS_STAT_LAST entries). Returns the time
+ * elapsed since the last reset (ns).
+ */
+Uint64
+VS_StatsGet(VS_StatValue *vals)
+{
+	VS_StatsSlot *s;
+	Uint64 t;
+	Uint gen;
+	int i, b;
+
+	memset(vals, 0, VS_STAT_LAST*sizeof(VS_StatValue));
+	if (!vsStatsInited) {
+		return (0);
+	}
+	AG_MutexLock(&vsStatsLock);
+	gen = __atomic_load_n(&vsStatsGen, __ATOMIC_ACQUIRE);
+	for (s = vsStatsSlots; s != NULL; s = s->next) {
+		if (__atomic_load_n(&s->gen, __ATOMIC_ACQUIRE) != gen) {
+			continue;
+		}
+		for (i = 0; i < VS_STAT_LAST; i++) {
+			VS_StatValue *val = &vals[i];
+
+			val->n += LOAD(&s->n[i]);
+			if (i >= VS_STAT_NTIMERS) {
+				continue;
+			}
+			val->sum += LOAD(&s->sum[i]);
+			val->max = MAX(val->max, LOAD(&s->max[i]));
+			for (b = 0; b < VS_STATS_NBUCKETS; b++)
+				val->hist[b] += LOAD(&s->hist[i][b]);
+		}
+	}
+	t = VS_ClockNow() - vsStatsT0;
+	AG_MutexUnlock(&vsStatsLock);
+	return (t);
+}
+
+/* Return the pct'th percentile of a timer (us, bucket upper edge). */
+Uint64
+VS_StatsPercentile(const VS_StatValue *val, int pct)
+{
+	Uint64 rank, cum = 0, maxUs = val->max/1000;
+	int b;
+
+	if (val->n == 0) {
+		return (0);
+	}
+	rank = (val->n*pct + 99)/100;
+	for (b = 0; b < VS_STATS_NBUCKETS-1; b++) {
+		if ((cum += val->hist[b]) >= rank)
+			return MIN(BucketStart(b+1), maxUs+1);
+	}
+	return (maxUs);
+}
+
+static __inline__ double
+MeanMs(const VS_StatValue *val)
+{
+	return (val->n > 0) ? (double)val->sum/val->n/1e6 : 0.0;
+}
+
+/* Percentage of player frames which did not need a synchronous decode. */
+static int
+CacheHitPct(const VS_StatValue *vals)
+{
+	Uint64 nHit = vals[VS_STAT_CUE_HIT].n + vals[VS_STAT_PREFETCH_HIT].n;
+	Uint64 nTotal = nHit + vals[VS_STAT_FRAME_MISS].n;
+
+	return (nTotal > 0) ? (int)(nHit*100/nTotal) : 0;
+}
+
+/* Format a short summary (for the player overlay). */
+void
+VS_StatsSummary(char *buf, size_t len)
+{
+	VS_StatValue vals[VS_STAT_LAST];
+
+	(void)VS_StatsGet(vals);
+	snprintf(buf, len,
+	    "Decode %.1fms (p95 %.1fms)\n"
+	    "Blit %.2fms  Frame %.2fms  Audio %.2fms\n"
+	    "Cache hits %d%%  Skipped %lu  Late %lu\n"
+	    "MIDI %lu events (%lu dropped)",
+	    MeanMs(&vals[VS_STAT_DECODE]),
+	    (double)VS_StatsPercentile(&vals[VS_STAT_DECODE], 95)/1000.0,
+	    MeanMs(&vals[VS_STAT_BLIT]),
+	    MeanMs(&vals[VS_STAT_FRAME]),
+	    MeanMs(&vals[VS_STAT_AUDIO]),
+	    CacheHitPct(vals),
+	    (Ulong)vals[VS_STAT_SKIPPED].n,
+	    (Ulong)vals[VS_STAT_LATE].n,
+	    (Ulong)vals[VS_STAT_MIDI_EVENTS].n,
+	    (Ulong)vals[VS_STAT_MIDI_DROPPED].n);
+}
+
+/* Format every statistic (for the statistics window). */
+void
+VS_StatsPrint(char *buf, size_t len)
+{
+	VS_StatValue vals[VS_STAT_LAST];
+	char line[256];
+	Uint64 t;
+	int i;
+
+	t = VS_StatsGet(vals);
+	snprintf(buf, len, _("Since reset: %.1fs\n"), (double)t/1e9);
+	for (i = 0; i < VS_STAT_NTIMERS; i++) {
+		VS_StatValue *val = &vals[i];
+
+		snprintf(line, sizeof(line),
+		    "%s: n=%lu mean=%.2fms p50=%.2fms p95=%.2fms "
+		    "p99=%.2fms max=%.2fms\n",
+		    _(vsStatInfo[i].descr), (Ulong)val->n, MeanMs(val),
+		    (double)VS_StatsPercentile(val, 50)/1000.0,
+		    (double)VS_StatsPercentile(val, 95)/1000.0,
+		    (double)VS_StatsPercentile(val, 99)/1000.0,
+		    (double)val->max/1e6);
+		Strlcat(buf, line, len);
+	}
+	for (; i < VS_STAT_LAST; i++) {
+		snprintf(line, sizeof(line), "%s: %lu\n",
+		    _(vsStatInfo[i].descr), (Ulong)vals[i].n);
+		Strlcat(buf, line, len);
+	}
+	snprintf(line, sizeof(line), _("Player cache hit rate: %d%%"),
+	    CacheHitPct(vals));
+	Strlcat(buf, line, len);
+}
+
+/*
+ * Write the statistics and the non-empty histogram buckets as JSON to
+ * a file (or to the standard output if path is "-").
+ */
+int
+VS_StatsSaveJSON(const char *path)
+{
+	VS_StatValue vals[VS_STAT_LAST];
+	Uint64 t;
+	FILE *f;
+	int i, b, nBuckets;
+
+	if (strcmp(path, "-") == 0) {
+		f = stdout;
+	} else if ((f = fopen(path, "w")) == NULL) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	t = VS_StatsGet(vals);
+	fprintf(f, "{\n  \"elapsed_s\": %.3f,\n", (double)t/1e9);
+	fprintf(f, "  \"cache_hit_pct\": %d,\n", CacheHitPct(vals));
+	fprintf(f, "  \"timers\": {\n");
+	for (i = 0; i < VS_STAT_NTIMERS; i++) {
+		VS_StatValue *val = &vals[i];
+
+		fprintf(f, "    \"%s\": { \"n\": %lu, \"mean_us\": %.1f, "
+		    "\"p50_us\": %lu, \"p95_us\": %lu, \"p99_us\": %lu, "
+		    "\"max_us\": %lu,\n      \"hist\": [",
+		    vsStatInfo[i].name, (Ulong)val->n, MeanMs(val)*1000.0,
+		    (Ulong)VS_StatsPercentile(val, 50),
+		    (Ulong)VS_StatsPercentile(val, 95),
+		    (Ulong)VS_StatsPercentile(val, 99),
+		    (Ulong)(val->max/1000));
+		for (b = 0, nBuckets = 0; b < VS_STATS_NBUCKETS; b++) {
+			if (val->hist[b] == 0) {
+				continue;
+			}
+			fprintf(f, "%s[%lu, %lu, %u]", (nBuckets++ > 0) ? ", " : "",
+			    (Ulong)BucketStart(b), (Ulong)BucketStart(b+1),
+			    (Uint)val->hist[b]);
+		}
+		fprintf(f, "] }%s\n", (i < VS_STAT_NTIMERS-1) ? "," : "");
+	}
+	fprintf(f, "  },\n  \"counters\": {\n");
+	for (; i < VS_STAT_LAST; i++) {
+		fprintf(f, "    \"%s\": %lu%s\n", vsStatInfo[i].name,
+		    (Ulong)vals[i].n, (i < VS_STAT_LAST-1) ? "," : "");
+	}
+	fprintf(f, "  }\n}\n");
+
+	if (f == stdout) {
+		fflush(f);
+	} else if (fclose(f) != 0) {
+		AG_SetError("%s: %s", path, strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Statistics window.
+ */
+static Uint32
+UpdateWindow(AG_Timer *to, AG_Event *event)
+{
+	AG_Label *lbl = AG_SELF();
+
+	VS_StatsPrint(vsStatsText, sizeof(vsStatsText));
+	AG_Redraw(lbl);
+	return (to->ival);
+}
+
+static void
+ResetStats(AG_Event *event)
+{
+	VS_StatsReset();
+	VS_StatsPrint(vsStatsText, sizeof(vsStatsText));
+}
+
+static void
+SaveJSONFile(AG_Event *event)
+{
+	char *path = AG_STRING(1);
+
+	if (VS_StatsSaveJSON(path) == -1) {
+		AG_TextMsgFromError();
+		return;
+	}
+	AG_TextTmsg(AG_MSG_INFO, 1250, _("Saved statistics to %s"),
+	    AG_ShortFilename(path));
+}
+
+static void
+SaveJSONDlg(AG_Event *event)
+{
+	AG_Window *win;
+	AG_FileDlg *fd;
+
+	win = AG_WindowNew(0);
+	AG_WindowSetCaption(win, _("Save statistics as..."));
+	fd = AG_FileDlgNewMRU(win, "vislak.mru.stats",
+	    AG_FILEDLG_SAVE|AG_FILEDLG_CLOSEWIN|AG_FILEDLG_EXPAND);
+	AG_FileDlgAddType(fd, _("JSON statistics"), "*.json",
+	    SaveJSONFile, NULL);
+	AG_WindowShow(win);
+}
+
+/* Show the statistics window (only one can be open). */
+void
+VS_StatsWindow(void)
+{
+	AG_Window *win;
+	AG_Label *lbl;
+	AG_Box *hBox;
+
+	if ((win = AG_WindowNewNamedS(0, "vs-stats")) == NULL) {
+		return;					/* Already open */
+	}
+	AG_WindowSetCaptionS(win, _("Performance statistics"));
+
+	VS_StatsPrint(vsStatsText, sizeof(vsStatsText));
+	lbl = AG_LabelNewPolled(win, AG_LABEL_EXPAND, "%s", vsStatsText);
+	AG_LabelSizeHint(lbl, VS_STAT_LAST+2,
+	    "<Frames decoded on demand: n=XXXXXX mean=XX.XXms "
+	    "p50=XX.XXms p95=XX.XXms p99=XX.XXms max=XXX.XXms>");
+	AG_AddTimer(lbl, &vsStatsTimer, 500, UpdateWindow, NULL);
+
+	hBox = AG_BoxNewHoriz(win, AG_BOX_HFILL|AG_BOX_HOMOGENOUS);
+	AG_ButtonNewFn(hBox, 0, _("Reset"), ResetStats, NULL);
+	AG_ButtonNewFn(hBox, 0, _("Save as JSON..."), SaveJSONDlg, NULL);
+	AG_ButtonNewFn(hBox, 0, _("Close"), AG_WindowCloseGenEv, "%p", win);
+	AG_WindowShow(win);
+}
@@ -0,0 +1,61 @@
+/*	Public domain	*/
+
+#ifndef _VISLAK_STATS_H_
+#define _VISLAK_STATS_H_
+
+/*
+ * Process-wide performance counters. Timers record durations into a
+ * log-linear histogram; counters only count. Each thread updates its own
+ * slot without locking, and readers sum the slots.
+ */
+enum vs_stat {
+	VS_STAT_DECODE,			/* JPEG decode (timer) */
+	VS_STAT_SCALE,			/* Surface scaling (timer) */
+	VS_STAT_IMPORT,			/* Thumbnail of imported frame (timer) */
+	VS_STAT_BLIT,			/* Player blit (timer) */
+	VS_STAT_AUDIO,			/* Audio callback (timer) */
+	VS_STAT_MIDI,			/* MIDI input processing (timer) */
+	VS_STAT_FRAME,			/* Frame clock processing (timer) */
+	VS_STAT_CUE_HIT,		/* Frame drawn from the cue cache */
+	VS_STAT_PREFETCH_HIT,		/* Frame drawn from the prefetch */
+	VS_STAT_FRAME_MISS,		/* Frame decoded synchronously */
+	VS_STAT_SKIPPED,		/* Frames never displayed by a player */
+	VS_STAT_LATE,			/* Frame periods missed by the clock */
+	VS_STAT_AUDIO_RESYNC,		/* Audio resynchronized to video */
+	VS_STAT_MIDI_EVENTS,		/* MIDI events processed */
+	VS_STAT_MIDI_DROPPED,		/* MIDI events lost (queue full) */
+	VS_STAT_LAST
+};
+#define VS_STAT_NTIMERS		(VS_STAT_FRAME+1)
+
+#define VS_STATS_SUB		8	/* Histogram buckets per octave */
+#define VS_STATS_NBUCKETS	200	/* Buckets (1us to ~60s) */
+
+typedef struct vs_stat_info {
+	const char *name;		/* Name in JSON output */
+	const char *descr;		/* Description */
+} VS_StatInfo;
+
+typedef struct vs_stat_value {
+	Uint64 n;			/* Samples (or counter value) */
+	Uint64 sum;			/* Sum of samples (ns) */
+	Uint64 max;			/* Largest sample (ns) */
+	Uint32 hist[VS_STATS_NBUCKETS];	/* Samples per bucket (timers) */
+} VS_StatValue;
+
+__BEGIN_DECLS
+extern const VS_StatInfo vsStatInfo[];
+
+void   VS_StatsInit(void);
+void   VS_StatsReset(void);
+void   VS_StatsAdd(enum vs_stat, Uint);
+void   VS_StatsTime(enum vs_stat, Uint64);
+Uint64 VS_StatsGet(VS_StatValue *);
+Uint64 VS_StatsPercentile(const VS_StatValue *, int);
+void   VS_StatsSummary(char *, size_t);
+void   VS_StatsPrint(char *, size_t);
+int    VS_StatsSaveJSON(const char *);
+void   VS_StatsWindow(void);
+__END_DECLS
+
+#endif /* _VISLAK_STATS_H_ */
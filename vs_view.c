@@ -47,14 +47,22 @@ MouseMotion(AG_Event *event)
 		return;
 	}
 	if (vv->flags & VS_VIEW_PANNING) {
+		int x = v->x;
+
 		if (dx < 0) {
-			v->x++;
+			x += (1 << vv->zoom);
 		} else if (dx > 0) {
-			v->x--;
+			x -= (1 << vv->zoom);
+		}
+		xLast = v->n - ((WIDTH(vv)/vsp->thumbSz) << vv->zoom);
+		if (x > xLast) {
+			x = xLast;
+		}
+		if (x < 0) {
+			x = 0;
 		}
-		xLast = v->n - WIDTH(vv)/vsp->thumbSz;
-		if (v->x > xLast)
-			v->x = xLast;
+		if (x != v->x)
+			VS_ClipSetPosition(v, x, 0);
 	}
 }
 
@@ -78,25 +86,17 @@ MouseButtonUp(AG_Event *event)
 static void
 DeleteFrames(VS_View *vv)
 {
-	Uint i, j, nDeleted = 0;
 	VS_Clip *v = vv->clip;
+	Uint nDeleted;
 
-scan:
-	for (i = 0; i < v->n; i++) {
-		VS_Frame *vf = &v->frames[i];
-
-		/* Look for a continuous selection. */
-		for (j = i; j < v->n; j++) {
-			if (!(v->frames[j].flags & VS_FRAME_SELECTED))
-				break;
-		}
-		if (j == i) {
-			continue;
-		}
-		VS_ClipDelFrames(v, i, j);
-		nDeleted += (j-i);
-		goto scan;
+	AG_MutexLock(&v->lock);
+	nDeleted = VS_SelCount(&v->sel);
+	if (VS_ClipDelSelection(v) == -1) {
+		AG_MutexUnlock(&v->lock);
+		VS_Status(vv, "%s", AG_GetError());
+		return;
 	}
+	AG_MutexUnlock(&v->lock);
 	VS_Status(vv, _("Deleted %u frames"), nDeleted);
 }
 
@@ -105,11 +105,11 @@ static void
 SelectAllFrames(VS_View *vv)
 {
 	VS_Clip *v = vv->clip;
-	Uint i;
 
-	for (i = 0; i < v->n; i++) {
-		v->frames[i].flags |= VS_FRAME_SELECTED;
-	}
+	AG_MutexLock(&v->lock);
+	VS_SelClear(&v->sel);
+	VS_SelAdd(&v->sel, 0, v->n);
+	AG_MutexUnlock(&v->lock);
 	VS_Status(vv, _("Selected all frames"));
 }
 
@@ -118,11 +118,10 @@ static void
 UnselectAllFrames(VS_View *vv)
 {
 	VS_Clip *v = vv->clip;
-	Uint i;
 
-	for (i = 0; i < v->n; i++) {
-		v->frames[i].flags &= ~(VS_FRAME_SELECTED);
-	}
+	AG_MutexLock(&v->lock);
+	VS_SelClear(&v->sel);
+	AG_MutexUnlock(&v->lock);
 	VS_Status(vv, _("Unselected all frames"));
 }
 
@@ -179,6 +178,8 @@ PartitionKeymapMIDI(AG_Event *event)
 		mid->keymap[key] = i;
 		nMapped++;
 	}
+	VS_JournalLogMidiKeymap(v);
+	VS_ClipCuesChanged(v);
 	VS_Status(vv, _("Mapped %u MIDI keys"), nMapped);
 }
 
@@ -200,15 +201,114 @@ InitKeymap11MIDI(AG_Event *event)
 		v->frames[i].midiKey = key;
 		mid->keymap[key] = i;
 	}
+	VS_JournalLogMidiKeymap(v);
+	VS_ClipCuesChanged(v);
 	VS_Status(vv, _("Mapped %u MIDI keys"), i);
 }
 
+/* Add each run of selected frames as an A/B loop region. */
+static void
+LoopSelection(AG_Event *event)
+{
+	VS_View *vv = AG_PTR(1);
+	VS_Clip *v = vv->clip;
+	VS_SelRun runs[VS_CLIP_MAXLOOPS];
+	Uint i, nRuns;
+
+	AG_MutexLock(&v->lock);
+	nRuns = MIN(v->sel.nRuns, VS_CLIP_MAXLOOPS);
+	memcpy(runs, v->sel.runs, nRuns*sizeof(VS_SelRun));
+	AG_MutexUnlock(&v->lock);
+
+	if (nRuns == 0) {
+		VS_Status(vv, _("No frames selected"));
+		return;
+	}
+	for (i = 0; i < nRuns; i++) {
+		if (VS_ClipAddLoop(v, runs[i].start, runs[i].end) == -1) {
+			AG_TextMsgFromError();
+			break;
+		}
+	}
+	VS_Status(vv, _("%u loop regions"), v->nLoops);
+}
+
+static void
+ClearLoops(AG_Event *event)
+{
+	VS_View *vv = AG_PTR(1);
+
+	VS_ClipClearLoops(vv->clip);
+	VS_Status(vv, _("Cleared loop regions"));
+}
+
+/* Set the number of frames pinned around each cue. */
+static void
+SetCueWindow(AG_Event *event)
+{
+	VS_View *vv = AG_PTR(1);
+	int window = AG_INT(2);
+	VS_Clip *v = vv->clip;
+
+	AG_MutexLock(&v->lock);
+	v->cueWindow = window;
+	VS_ClipCuesChanged(v);
+	AG_MutexUnlock(&v->lock);
+	VS_JournalTouch(v->proj);		/* Saved, but not journaled */
+}
+
+/*
+ * Set the zoom level, where each column represents 2^zoom frames. Zooming
+ * out stops once the whole clip fits in the view.
+ */
+static void
+SetZoom(VS_View *vv, int zoom)
+{
+	VS_Clip *v = vv->clip;
+
+	if (zoom < 0 || v->n == 0) {
+		zoom = 0;
+	}
+	while (zoom > 0 &&
+	    (zoom >= VS_CLIP_VIZLEVELS ||
+	     ((v->n - 1) >> (zoom-1)) < vv->xVis)) {
+		zoom--;
+	}
+	if (zoom == vv->zoom) {
+		return;
+	}
+	vv->zoom = zoom;
+	if (vv->sb != NULL) {
+		AG_SetUint(vv->sb, "inc", 10 << zoom);
+	}
+	VS_Status(vv, _("Zoom: %u frames per column"), 1U << zoom);
+	AG_Redraw(vv);
+}
+
+static void
+ZoomIn(AG_Event *event)
+{
+	VS_View *vv = AG_PTR(1);
+
+	SetZoom(vv, vv->zoom - 1);
+}
+
+static void
+ZoomOut(AG_Event *event)
+{
+	VS_View *vv = AG_PTR(1);
+
+	SetZoom(vv, vv->zoom + 1);
+}
+
 static void
 PopupMenu(VS_View *vv, int x, int y)
 {
+	static const int cueWindows[] = { 0, 2, 4, 8, 16 };
 	VS_Project *vsp = vv->clip->proj;
 	AG_PopupMenu *pm;
 	AG_MenuItem *m, *mMIDI, *mKeymaps, *mSub;
+	int i;
 
 	pm = AG_PopupNew(vv);
 	m = pm->root;
@@ -218,6 +318,11 @@ PopupMenu(VS_View *vv, int x, int y)
 
 	AG_MenuSeparator(m);
 
+	AG_MenuAction(m, _("Zoom in"), vsIconMagnifier.s, ZoomIn, "%p", vv);
+	AG_MenuAction(m, _("Zoom out"), vsIconMagnifier.s, ZoomOut, "%p", vv);
+
+	AG_MenuSeparator(m);
+
 	mMIDI = AG_MenuNode(m, _("MIDI"), NULL);
 	{
 		VS_MidiDevicesMenu(vv->clip->midi, mMIDI, VS_MIDI_INPUT);
@@ -240,6 +345,21 @@ PopupMenu(VS_View *vv, int x, int y)
 			AG_MenuAction(mSub, _("Initialize 1:1 keymap"), vsIconControls.s,
 			    InitKeymap11MIDI, "%p", vv);
 		}
+		mSub = AG_MenuNode(mKeymaps, _("Pinned cue window"), NULL);
+		for (i = 0; i < sizeof(cueWindows)/sizeof(cueWindows[0]); i++) {
+			AG_MenuAction(mSub, AG_Printf(_("+/- %d frames%s"),
+			    cueWindows[i],
+			    (cueWindows[i] == vv->clip->cueWindow) ? " *" : ""),
+			    NULL, SetCueWindow, "%p,%i", vv, cueWindows[i]);
+		}
+	}
+
+	mSub = AG_MenuNode(m, _("Loops"), NULL);
+	{
+		AG_MenuAction(mSub, _("Loop selected frames"), vsIconPlay.s,
+		    LoopSelection, "%p", vv);
+		AG_MenuAction(mSub, _("Clear loops"), agIconTrash.s,
+		    ClearLoops, "%p", vv);
 	}
 
 	AG_PopupShowAt(pm, x, y);
@@ -263,47 +383,48 @@ MouseButtonDown(AG_Event *event)
 	}
 	switch (button) {
 	case AG_MOUSE_WHEELUP:
-		if (v->x > 0) { v->x--; }
+		if (ms & AG_KEYMOD_CTRL) {
+			SetZoom(vv, vv->zoom - 1);
+		} else if (v->x > 0) {
+			VS_ClipSetPosition(v, (v->x > (1 << vv->zoom)) ?
+			    v->x - (1 << vv->zoom) : 0, 0);
+		}
 		break;
 	case AG_MOUSE_WHEELDOWN:
-		if (v->x < (v->n - 1)) { v->x++; }
+		if (ms & AG_KEYMOD_CTRL) {
+			SetZoom(vv, vv->zoom + 1);
+		} else if (v->x + (1 << vv->zoom) < v->n) {
+			VS_ClipSetPosition(v, v->x + (1 << vv->zoom), 0);
+		}
 		break;
 	case AG_MOUSE_LEFT:
-		f = v->x + x/vsp->thumbSz;
+		/* Columns select all the frames of their bucket. */
+		f = ((v->x >> vv->zoom) + x/vsp->thumbSz) << vv->zoom;
 		if (f >= 0 && f < v->n) {
-			VS_Frame *vf = &v->frames[f];
-			int i, fSel;
+			int fEnd = MIN(f + (1 << vv->zoom), (int)v->n);
+			int fSel;
 
+			AG_MutexLock(&v->lock);
 			if (ms & AG_KEYMOD_CTRL) {
-				if (vf->flags & VS_FRAME_SELECTED) {
-					vf->flags &= ~(VS_FRAME_SELECTED);
+				if (VS_SelIntersects(&v->sel, f, fEnd)) {
+					VS_SelRemove(&v->sel, f, fEnd);
 				} else {
-					vf->flags |= VS_FRAME_SELECTED;
-				} 
-			} else if (ms & AG_KEYMOD_SHIFT) {
-				for (fSel = 0; fSel < v->n; fSel++) {
-					if (v->frames[fSel].flags &
-					    VS_FRAME_SELECTED)
-						break;
+					VS_SelAdd(&v->sel, f, fEnd);
 				}
-				if (fSel == v->n) {
+			} else if (ms & AG_KEYMOD_SHIFT) {
+				if ((fSel = VS_SelFirst(&v->sel)) == -1) {
 					fSel = 0;
 				}
 				if (f < fSel) {
-					for (i = f; i < fSel; i++) {
-						v->frames[i].flags
-						    |= VS_FRAME_SELECTED;
-					}
+					VS_SelAdd(&v->sel, f, fSel);
 				} else {
-					for (i = f; i > fSel; i--) {
-						v->frames[i].flags
-						    |= VS_FRAME_SELECTED;
-					}
+					VS_SelAdd(&v->sel, fSel+1, fEnd);
 				}
 			} else {
-				UnselectAllFrames(vv);
-				vf->flags |= VS_FRAME_SELECTED;
+				VS_SelClear(&v->sel);
+				VS_SelAdd(&v->sel, f, fEnd);
 			}
+			AG_MutexUnlock(&v->lock);
 			vv->xSel = f;
 		}
 		AG_WidgetFocus(vv);
@@ -338,7 +459,11 @@ KbdMoveTimeout(AG_Timer *to, AG_Event *event)
 	x = vv->kbdCenter + vv->kbdOffset;
 	if (x < 0) { x = 0; }
 	if (x >= v->n) { x = v->n - 1; }
-	v->x = x;
+	VS_ClipSetPosition(v, x, vv->tKbd);
+	if (vv->tKbd != 0) {
+		VS_ClipTrigger(v, VS_TRIGGER_KBD, vv->tKbd);
+		vv->tKbd = 0;
+	}
 
 	AG_Redraw(vv);
 	return (to->ival);
@@ -359,8 +484,12 @@ KeyDown(AG_Event *event)
 	if ((isalpha(sym) || isdigit(sym)) &&
 	    (vsp->flags & VS_PROJECT_LEARNING) &&
 	    vv->xSel >= 0 && vv->xSel < v->n) {
+		AG_MutexLock(&v->lock);
 		v->kbdKeymap[sym] = vv->xSel;
 		v->frames[vv->xSel].kbdKey = sym;
+		VS_JournalLog(v, VS_JOURNAL_KBDKEY, vv->xSel, 0, sym);
+		VS_ClipCuesChanged(v);
+		AG_MutexUnlock(&v->lock);
 		VS_Status(vv, _("Mapped %d -> f%d"), sym, vv->xSel);
 		return;
 	}
@@ -386,6 +515,7 @@ KeyDown(AG_Event *event)
 			if (vv->kbdCenter != -1) {
 				AG_DelTimer(vv, &vv->toKbdMove);
 			}
+			vv->tKbd = VS_ClockNow();
 			vv->xSel = v->kbdKeymap[sym];
 			vv->kbdCenter = v->kbdKeymap[sym];
 			vv->kbdOffset = 0;
@@ -466,6 +596,7 @@ static void
 Init(void *obj)
 {
 	VS_View *vv = obj;
+	int i;
 
 	vv->flags = 0;
 	vv->clip = NULL;
@@ -473,11 +604,25 @@ Init(void *obj)
 	vv->hPre = 128;
 	vv->xSel = -1;
 	vv->xVis = 0;
+	vv->zoom = 0;
 	vv->rFrames = AG_RECT(0,0,0,0);
 	vv->rAudio = AG_RECT(0,0,0,0);
 	vv->sb = NULL;
 	vv->incr = 10;
 	vv->kbdCenter = -1;
+	vv->tKbd = 0;
+
+	for (i = 0; i < AG_KEY_LAST; i++) {
+		vv->suKbd[i] = -1;
+	}
+	for (i = 0; i < VS_MIDI_MAXKEYS; i++) {
+		vv->suMidi[i] = -1;
+	}
+	vv->suStrip = NULL;
+	vv->suStripID = -1;
+	vv->stripX = -1;
+	vv->stripZoom = 0;
+	vv->stripGen = 0;
 }
 
 void
@@ -546,6 +691,178 @@ SizeAllocate(void *p, const AG_SizeAlloc *a)
 	return (0);
 }
 
+/*
+ * Return the surface handle of a key label, rendering and mapping it on
+ * first use. There is a small, fixed number of possible labels, so they
+ * are kept for the lifetime of the widget.
+ */
+static __inline__ int
+KbdLabel(VS_View *vv, int key)
+{
+	if (vv->suKbd[key] == -1) {
+		vv->suKbd[key] = AG_WidgetMapSurface(vv,
+		    AG_TextRenderf("%c", (char)key));
+	}
+	return (vv->suKbd[key]);
+}
+static __inline__ int
+MidiLabel(VS_View *vv, int key)
+{
+	if (vv->suMidi[key] == -1) {
+		vv->suMidi[key] = AG_WidgetMapSurface(vv,
+		    AG_TextRenderf("%x", key));
+	}
+	return (vv->suMidi[key]);
+}
+
+/*
+ * Render the columns [c1,c2) of the cached strip (thumbnails and audio
+ * waveform), for a view scrolled to column bx. Each column shows the
+ * first frame of its 2^zoom frame bucket and the matching level of the
+ * waveform pyramid, so no decoding is needed at any zoom level.
+ * Clip must be locked.
+ */
+static void
+RenderStripColumns(VS_View *vv, VS_Clip *v, Uint bx, int c1, int c2)
+{
+	VS_Project *vsp = v->proj;
+	AG_Surface *su = vv->suStrip;
+	int thumbSz = vsp->thumbSz;
+	int zoom = vv->zoom;
+	const float *viz;
+	sf_count_t vizFrames;
+	AG_Rect r;
+	AG_Color c;
+	Uint pos;
+	int col, px, pxEnd, yMid, val;
+
+	r.x = c1*thumbSz;
+	r.y = vv->rFrames.y;
+	r.w = (c2-c1)*thumbSz;
+	r.h = vv->rFrames.h;
+	AG_ColorRGB(&c, 100,100,100);
+	AG_FillRect(su, &r, &c);
+
+	for (col = c1; col < c2; col++) {
+		Uint f = (bx+col) << zoom;
+
+		if (f >= v->n) {
+			break;
+		}
+		if (v->frames[f].thumb != NULL)
+			AG_SurfaceBlit(v->frames[f].thumb, NULL, su,
+			    col*thumbSz, vv->rFrames.y);
+	}
+
+	if (vv->rAudio.h <= 0) {
+		return;
+	}
+	r.y = vv->rAudio.y;
+	r.h = vv->rAudio.h;
+	AG_ColorBlack(&c);
+	AG_FillRect(su, &r, &c);
+
+	/* Center line */
+	yMid = vv->rAudio.y + vsp->waveSz/2;
+	r.y = yMid;
+	r.h = 1;
+	AG_ColorRGB(&c, 0,50,250);
+	AG_FillRect(su, &r, &c);
+	
+	/* Samples */
+	AG_MutexLock(&v->sndLock);
+	viz = v->sndVizLvl[zoom];
+	vizFrames = v->sndVizLvlFrames[zoom];
+	if (viz != NULL) {
+		AG_ColorRGB(&c, 0,250,0);
+		r.w = 1;
+		pxEnd = MIN(c2*thumbSz, su->w);
+		for (px = c1*thumbSz, pos = bx*thumbSz + px;
+		     px < pxEnd && pos < vizFrames;
+		     px++, pos++) {
+			val = (int)(viz[pos]*vsp->waveSz);
+			if (val != 0) {
+				r.x = px;
+				r.y = yMid - val;
+				r.h = val*2;
+				AG_FillRect(su, &r, &c);
+			}
+		}
+	}
+	AG_MutexUnlock(&v->sndLock);
+}
+
+/*
+ * Bring the cached strip up to date. The strip is only re-rendered as a
+ * whole when the clip or zoom level changes (see VS_Clip gen); scrolling
+ * shifts the existing pixels and renders the newly exposed columns.
+ * Returns 1 if the strip was modified.
+ */
+static int
+UpdateStrip(VS_View *vv, VS_Clip *v)
+{
+	VS_Project *vsp = v->proj;
+	int thumbSz = vsp->thumbSz;
+	int w = WIDTH(vv);
+	int h = vv->rFrames.h + vv->rAudio.h;
+	int nCols = (w + thumbSz - 1)/thumbSz;
+	int bx = (int)(v->x >> vv->zoom);
+	int dx, dxPx, Bpp, y;
+	AG_Surface *su;
+
+	if (vv->suStrip == NULL || vv->suStrip->w != w ||
+	    vv->suStrip->h != h) {
+		if ((su = AG_SurfaceStdRGB(w, h)) == NULL) {
+			return (0);
+		}
+		if (vv->suStripID == -1) {
+			vv->suStripID = AG_WidgetMapSurfaceNODUP(vv, su);
+		} else {
+			AG_WidgetReplaceSurfaceNODUP(vv, vv->suStripID, su);
+		}
+		vv->suStrip = su;
+		vv->stripX = -1;
+	}
+	su = vv->suStrip;
+
+	if (vv->stripX == -1 || vv->stripGen != v->gen ||
+	    vv->stripZoom != vv->zoom) {
+		RenderStripColumns(vv, v, bx, 0, nCols);
+		goto out;
+	}
+	if (vv->stripX == bx) {
+		return (0);
+	}
+	dx = bx - vv->stripX;
+	if (dx >= nCols || dx <= -nCols) {
+		RenderStripColumns(vv, v, bx, 0, nCols);
+		goto out;
+	}
+
+	/* Shift the existing columns and render the exposed ones. */
+	Bpp = su->format->BytesPerPixel;
+	dxPx = dx*thumbSz;
+	for (y = 0; y < su->h; y++) {
+		Uint8 *row = (Uint8 *)su->pixels + y*su->pitch;
+
+		if (dx > 0) {
+			memmove(row, row + dxPx*Bpp, (w - dxPx)*Bpp);
+		} else {
+			memmove(row - dxPx*Bpp, row, (w + dxPx)*Bpp);
+		}
+	}
+	if (dx > 0) {
+		RenderStripColumns(vv, v, bx, (w - dxPx)/thumbSz, nCols);
+	} else {
+		RenderStripColumns(vv, v, bx, 0, -dx);
+	}
+out:
+	vv->stripX = bx;
+	vv->stripZoom = vv->zoom;
+	vv->stripGen = v->gen;
+	return (1);
+}
+
 static void
 Draw(void *p)
 {
@@ -554,99 +871,70 @@ Draw(void *p)
 	VS_Project *vsp = v->proj;
 	AG_Rect r;
 	AG_Color c;
-	int i;
+	Uint i, bx, xEnd;
+	int key, f;
 
 	if (vv->rFrames.h <= 0 && vv->rAudio.h <= 0)
 		return;
 
 	AG_MutexLock(&v->lock);
-	
+
 	/*
-	 * Render video frames.
+	 * Render the filmstrip and waveform from the cached strip.
 	 */
-	AG_ColorRGB(&c, 100,100,100);
-	AG_DrawBox(vv, &vv->rFrames, -1, &c);
-	r = vv->rFrames;
-	r.w = vsp->thumbSz;
+	if (UpdateStrip(vv, v)) {
+		AG_WidgetUpdateSurface(vv, vv->suStripID);
+	}
+	if (vv->suStripID != -1)
+		AG_WidgetBlitSurface(vv, vv->suStripID, 0, 0);
 
+	/*
+	 * Render selection and key mapping overlays.
+	 */
 	AG_PushTextState();
 	AG_TextBGColorRGB(0,0,0);
 	AG_TextColorRGB(255,255,255);
 
 	AG_PushClipRect(vv, &vv->rFrames);
-	for (i = v->x;
+	r = vv->rFrames;
+	r.w = vsp->thumbSz;
+	bx = v->x >> vv->zoom;
+	for (i = bx << vv->zoom;
 	     i < v->n && r.x < WIDTH(vv);
-	     i++) {
-		VS_Frame *vf = &v->frames[i];
-
-		if (i < 0) {
-			r.x += vf->thumb->w;
-			continue;
-		}
-
-		AG_WidgetBlit(vv, vf->thumb, r.x, 0);
-		if (vf->flags & VS_FRAME_SELECTED) {
+	     i += (1 << vv->zoom), r.x += vsp->thumbSz) {
+		if (VS_SelIntersects(&v->sel, i, i + (1 << vv->zoom))) {
 			AG_ColorRGB(&c, 250,250,250);
 			AG_DrawRectOutline(vv, &r, &c);
 			AG_ColorRGBA(&c, 0,0,255,64);
 			AG_DrawRectBlended(vv, &r, &c, AG_ALPHA_SRC,
 			    AG_ALPHA_ONE_MINUS_SRC);
 		}
-		if (vf->kbdKey != -1) {
-			AG_Surface *S;
-
-			S = AG_TextRenderf("%c", (char)vf->kbdKey);
-			AG_WidgetBlit(vv, S, r.x, 0);
-			AG_SurfaceFree(S);
-		}
-		if (vf->midiKey != -1) {
-			AG_Surface *S;
-
-			S = AG_TextRenderf("%x", vf->midiKey);
-			AG_WidgetBlit(vv, S, r.x, 0);
-			AG_SurfaceFree(S);
-		}
-		r.x += vf->thumb->w;
 	}
-	AG_PopClipRect(vv);
 
 	/*
-	 * Render the audio waveform.
+	 * Key labels are placed from the keymaps rather than by scanning
+	 * the visible frames, whose number grows with the zoom level.
 	 */
-	if (vv->rAudio.h > 0 && v->sndViz != NULL) {
-		Uint pos;
-		int val;
-
-		AG_ColorBlack(&c);
-		AG_DrawBox(vv, &vv->rAudio, 1, &c);
-		r = vv->rAudio;
-
-		AG_PushClipRect(vv, &vv->rAudio);
-
-		/* Center line */
-		r.y += vsp->waveSz/2;
-		AG_ColorRGB(&c, 0,50,250);
-		AG_DrawLineH(vv, 0, WIDTH(vv), r.y, &c);
-
-		/* Samples */
-		AG_MutexLock(&v->sndLock);
-		for (r.x = 0, pos = v->x*vsp->thumbSz;
-		     r.x < WIDTH(vv) && pos < v->sndVizFrames;
-		     r.x++) {
-			val = (int)(v->sndViz[pos]*vsp->waveSz);
-			if (val != 0) {
-				AG_ColorRGB(&c, 0,250,0);
-				AG_DrawLineV(vv, r.x,
-				    r.y - val,
-				    r.y + val, &c);
-			}
-			pos++;
+	xEnd = (bx + vv->xVis + 1) << vv->zoom;
+	for (key = 0; key < AG_KEY_LAST; key++) {
+		if ((f = v->kbdKeymap[key]) < 0 || f >= v->n ||
+		    v->frames[f].kbdKey != key ||
+		    (Uint)f < (bx << vv->zoom) || (Uint)f >= xEnd) {
+			continue;
 		}
-		AG_MutexUnlock(&v->sndLock);
-		
-		AG_PopClipRect(vv);
+		AG_WidgetBlitSurface(vv, KbdLabel(vv, key),
+		    (int)((f >> vv->zoom) - bx)*vsp->thumbSz, 0);
 	}
-
+	for (key = 0; v->midi != NULL && key < VS_MIDI_MAXKEYS; key++) {
+		if ((f = v->midi->keymap[key]) < 0 || f >= v->n ||
+		    v->frames[f].midiKey != key ||
+		    (Uint)f < (bx << vv->zoom) || (Uint)f >= xEnd) {
+			continue;
+		}
+		AG_WidgetBlitSurface(vv, MidiLabel(vv, key),
+		    (int)((f >> vv->zoom) - bx)*vsp->thumbSz, 0);
+	}
+	AG_PopClipRect(vv);
 	AG_PopTextState();
 
 	AG_MutexUnlock(&v->lock);
@@ -654,9 +942,9 @@ Draw(void *p)
 	/* Render the scrollbar. */
 	if (vv->sb != NULL) {
 		if (v->n > 0 && vv->xVis > 0 &&
-		    vv->xVis < v->n) {
+		    (vv->xVis << vv->zoom) < v->n) {
 			AG_ScrollbarSetControlLength(vv->sb,
-			    (vv->xVis * vv->sb->length / v->n));
+			    ((vv->xVis << vv->zoom) * vv->sb->length / v->n));
 		} else {
 			AG_ScrollbarSetControlLength(vv->sb, -1);
 		}
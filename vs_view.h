@@ -18,7 +18,8 @@ typedef struct vs_view {
 #define VS_VIEW_EXPAND	(VS_VIEW_HFILL|VS_VIEW_VFILL)
 
 	int wPre, hPre;			/* Requested geometry */
-	Uint xVis;			/* # of on-screen frames */
+	Uint xVis;			/* # of on-screen columns */
+	int zoom;			/* Frames per column (log2) */
 	AG_Rect rFrames;		/* Video frames area */
 	AG_Rect rAudio;			/* Audio waveform area */
 	AG_Scrollbar *sb;		/* Scrollbar */
@@ -28,6 +29,14 @@ typedef struct vs_view {
 	int xSel;			/* Last selected frame */
 	int kbdCenter, kbdOffset, kbdDir;
 	AG_Timeout toKbdMove;
+	Uint64 tKbd;			/* Key press not yet applied (or 0) */
+	int suKbd[AG_KEY_LAST];		/* Cached KBD key labels (or -1) */
+	int suMidi[VS_MIDI_MAXKEYS];	/* Cached MIDI key labels (or -1) */
+	AG_Surface *suStrip;		/* Cached filmstrip and waveform */
+	int suStripID;			/* Mapped suStrip (or -1) */
+	int stripX;			/* Column offset of suStrip (-1 = none) */
+	int stripZoom;			/* Zoom level of suStrip */
+	Uint stripGen;			/* Clip generation of suStrip */
 } VS_View;
 
 __BEGIN_DECLS